@@ -0,0 +1,130 @@
+#include "aot.h"
+#include "idle.h"
+#include <string.h>
+
+int aot_init(struct aot *aot, const struct aot_program *prog,
+        const struct interpreter *chip) {
+    aot->prog  = prog;
+    aot->valid = memcmp(chip->ram + PC_INIT, prog->rom, prog->rom_size) == 0;
+    return aot->valid ? 0 : -1;
+}
+
+// Stops running the blocks if one of the len bytes written from addr to the
+// RAM of chip was compiled and no longer holds the compiled ROM.
+static void invalidate(struct aot *aot, const struct interpreter *chip,
+        uint16_t addr, int len) {
+    for (int i = 0; i < len; i++) {
+        uint16_t a = (addr + i) & ADDR_MASK;
+        if (aot->prog->covered[a]
+                && chip->ram[a] != aot->prog->rom[a - PC_INIT]) {
+            aot->valid = 0;
+            return;
+        }
+    }
+}
+
+// Returns 1 if instr is a call or a return, which write the stack.
+static int is_call_ret(uint16_t instr) {
+    return instr >> 12 == 0x2 || instr == 0x00ee;
+}
+
+// Runs the rest of a batch of aot_run, n of its budget instructions being
+// already run.
+static int run_blocks(struct aot *aot, struct interpreter *chip,
+        struct proc_state *ps, int n, int budget) {
+    struct idle_watch watch;
+    idle_reset(&watch);
+    while (n < budget) {
+        // once the compiled code was overwritten, the threaded loop of the
+        // interpreter runs the rest
+        if (!aot->valid) {
+            n += run_rom_cycles(chip, ps, budget - n);
+            break;
+        }
+        uint16_t pc = chip->pc;
+        if (pc < RAM_SIZE) {
+            const struct aot_block *b = &aot->prog->blocks[pc];
+            if (b->compiled) {
+                n = aot->prog->run(chip, pc, n, budget, &ps->curr_instr);
+                ps->pc = chip->pc;
+                // calls and returns end chains, a chain ending elsewhere
+                // backward closes a loop, see run_rom_cycles
+                // in strict mode, calls, returns and Fx65 leave the chain on
+                // a fault
+                if (chip->strict && chip->fault) {
+                    ps->err_code    = take_fault(chip);
+                    ps->exit_reason = RUN_ERR;
+                    break;
+                }
+                if (is_call_ret(ps->curr_instr)) {
+                    idle_reset(&watch);
+                } else if (chip->pc <= pc) {
+                    ps->idle_period = idle_pass(&watch, chip, chip->pc, n);
+                    if (ps->idle_period > 0) {
+                        ps->exit_reason = RUN_IDLE;
+                        break;
+                    }
+                }
+                continue;
+            }
+        }
+
+        // a run left to the interpreter goes at once, none of its
+        // instructions changes I
+        if (pc < RAM_SIZE && aot->prog->blocks[pc].count > 0) {
+            const struct aot_block *b   = &aot->prog->blocks[pc];
+            int                     len = b->count < budget - n ? b->count
+                : budget - n;
+            uint16_t                I   = chip->I;
+            if (b->resets)
+                idle_reset(&watch);
+            n += run_rom_cycles(chip, ps, len);
+            if (b->write_len > 0)
+                invalidate(aot, chip, I, b->write_len);
+            if (ps->exit_reason != RUN_BUDGET)
+                break;
+            continue;
+        }
+
+        // run a single instruction through the interpreter, watching the
+        // writes to compiled code
+        uint16_t instr = 0;
+        uint16_t I     = chip->I;
+        if (pc < RAM_SIZE)
+            instr = (uint16_t)chip->ram[pc] << 8
+                | chip->ram[(pc + 1) & ADDR_MASK];
+        n += run_rom_cycles(chip, ps, 1);
+        if ((instr & 0xf0ff) == 0xf033)
+            invalidate(aot, chip, I, 3);
+        else if ((instr & 0xf0ff) == 0xf055)
+            invalidate(aot, chip, I, (instr >> 8 & 0xf) + 1);
+        if ((instr & 0xf0ff) == 0xf033 || (instr & 0xf0ff) == 0xf055
+                || instr >> 12 == 0xc || is_call_ret(instr))
+            idle_reset(&watch);
+        if (ps->exit_reason != RUN_BUDGET)
+            break;
+    }
+    return n;
+}
+
+int aot_run(struct aot *aot, struct interpreter *chip, struct proc_state *ps,
+        int budget) {
+    // a batch starting on a run left to the interpreter, as one waiting for
+    // a key or drawing does, goes straight to it, and ends with it if the run
+    // ends the batch
+    const struct aot_block *b = &aot->prog->blocks[chip->pc & ADDR_MASK];
+    if (aot->valid && chip->pc < RAM_SIZE && !b->compiled && b->count > 0
+            && b->write_len == 0) {
+        int len = b->count < budget ? b->count : budget;
+        if (b->stops)
+            return run_rom_cycles(chip, ps, len);
+        int n = run_rom_cycles(chip, ps, len);
+        if (n == budget || ps->exit_reason != RUN_BUDGET)
+            return n;
+        return run_blocks(aot, chip, ps, n, budget);
+    }
+    ps->err_code    = 0;
+    ps->exit_reason = RUN_BUDGET;
+    ps->idle_period = 0;
+    return run_blocks(aot, chip, ps, 0, budget);
+}
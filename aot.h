@@ -0,0 +1,72 @@
+#ifndef AOT_H
+#define AOT_H
+#include <stdint.h>
+#include "interpreter.h"
+
+/*
+ * Ahead-of-time compiled ROMs. chip8-aot translates the code reachable from
+ * PC_INIT in a ROM to a C translation unit defining aot_program, with one
+ * function holding every basic block, entered through a switch on the
+ * address of the first one. The unit is linked with aot.o and the
+ * interpreter, which runs whatever was not translated. Blocks ending with a
+ * call or a return leave it to aot_run to find the next one.
+ */
+
+// Code of the program: runs the block starting at start, updating chip as the
+// interpreter would do, PC included, then goes on with the blocks that
+// statically follow it, n instructions being already run, until budget
+// instructions are. The blocks jump to each other, so that the stack does not
+// grow with the budget. Returns n plus the number of instructions it ran, and
+// stores the last one to last_instr.
+typedef int (*aot_code)(struct interpreter *chip, int start, int n,
+        int budget, uint16_t *last_instr);
+
+struct aot_block {
+    uint8_t  compiled;   // 1 if a compiled block starts here
+    uint16_t last_instr; // last instruction of the block
+    uint8_t  count;      // number of instructions in the block, or in the run
+                         // left to the interpreter if compiled is 0 (the rest
+                         // of a block if it starts inside one)
+    uint8_t  write_len;  // bytes from I the run may write (Fx33, Fx55)
+    uint8_t  resets;     // 1 if the run resets the idle watch
+    uint8_t  stops;      // 1 if the run ends the batch (draws, key waits,
+                         // sound, exits)
+};
+
+struct aot_program {
+    const char             *name;     // file name of the compiled ROM
+    const uint8_t          *rom;      // contents of the compiled ROM
+    uint16_t                rom_size; // size of the ROM, in bytes
+    aot_code                run;      // code of the blocks
+    const struct aot_block *blocks;   // RAM_SIZE blocks by start address
+    const uint8_t          *covered;  // RAM_SIZE flags, 1 if the byte is
+                                      // part of a block
+};
+
+// Program of the generated translation unit
+extern const struct aot_program aot_program;
+
+struct aot {
+    const struct aot_program *prog;  // compiled program
+    int                       valid; // 0 once its code was overwritten
+};
+
+/*
+ * Sets aot up to run prog on chip. The blocks of prog are only run if the
+ * ROM loaded in chip is the one prog was compiled from. Returns 0 if they
+ * are, -1 otherwise (chip is then only interpreted).
+ */
+int aot_init(struct aot *aot, const struct aot_program *prog,
+        const struct interpreter *chip);
+
+/*
+ * Same as run_rom_cycles, but runs the compiled blocks of aot, up to the
+ * budget. The runs of instructions that were not compiled are run by the
+ * interpreter, so that the final state of chip is the same as with
+ * run_rom_cycles. Once the ROM overwrites its compiled code (Fx33, Fx55),
+ * the blocks are no longer run. Returns the number of executed instructions.
+ */
+int aot_run(struct aot *aot, struct interpreter *chip, struct proc_state *ps,
+        int budget);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "aot.h"
+
+#define CHECK_CYCLES 5000000 // Default instructions per run
+#define REPEATS      3       // Runs per engine, the fastest is kept
+#define CHECK_SEED   0       // RNG seed of the runs
+#define MIN_SPEEDUP  1.2     // Speedup of the compiled run that makes it
+                             // worth its code, above the run to run noise
+#define EXIT_NO_WIN  2       // Exit status if the compiled run is slower
+
+// Returns the current value of the monotonic clock in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs cycles instructions of chip, ipf per frame followed by a timers
+// update, with aot if it is not NULL and with run_rom_cycles otherwise.
+// Returns the number of executed instructions, which is less than cycles if
+// the processor reported an error.
+static uint64_t run(struct interpreter *chip, struct aot *aot,
+        uint64_t cycles, int ipf) {
+    struct proc_state ps;
+    uint64_t          n    = 0;
+    int               left = ipf;
+    while (n < cycles) {
+        int budget = cycles - n < (uint64_t)left ? (int)(cycles - n) : left;
+        int done   = aot != NULL ? aot_run(aot, chip, &ps, budget)
+            : run_rom_cycles(chip, &ps, budget);
+        n    += done;
+        left -= done;
+        if (ps.err_code > 0)
+            break;
+        if (left == 0) {
+            update_timers(chip);
+            left = ipf;
+        }
+    }
+    return n;
+}
+
+// Runs the ROM filename interpreted, then with the compiled program, and
+// prints the results as chip8-bench does. Returns 0 if both end in the same
+// state and the compiled run is at least MIN_SPEEDUP times faster, 1 if it is
+// not, -1 if the states differ.
+static int check(char *filename, uint64_t cycles, int ipf) {
+    static struct interpreter chip;
+    uint64_t                  hashes[2];
+    double                    times[2];
+    for (int e = 0; e <= 1; e++) {
+        struct aot aot;
+        double     best = 0;
+        uint64_t   n    = 0;
+        for (int r = 0; r < REPEATS; r++) {
+            init(&chip);
+            seed_rng(&chip, CHECK_SEED);
+            if (load_rom(filename, &chip) < 0)
+                return -1;
+            if (e == 1 && aot_init(&aot, &aot_program, &chip) < 0) {
+                dprintf(STDERR_FILENO, "%s: not the ROM of %s\n", filename,
+                        aot_program.name);
+                return -1;
+            }
+            double start = now();
+            n = run(&chip, e == 1 ? &aot : NULL, cycles, ipf);
+            double t = now() - start;
+            if (r == 0 || t < best)
+                best = t;
+        }
+        hashes[e] = state_hash(&chip);
+        times[e]  = best;
+        printf("aot\t%s\t%s\t%llu\t%.3f\t%.0f\t%016llx\n", aot_program.name,
+                e == 1 ? "aot" : "batch", (unsigned long long)n,
+                best * 1e9 / n, n / best, (unsigned long long)hashes[e]);
+    }
+    if (hashes[0] != hashes[1]) {
+        dprintf(STDERR_FILENO, "%s: compiled state differs\n",
+                aot_program.name);
+        return -1;
+    }
+    if (times[0] >= MIN_SPEEDUP * times[1])
+        return 0;
+    dprintf(STDERR_FILENO, "%s: compiled run %.2f times as fast, keep it "
+            "interpreted\n", aot_program.name, times[0] / times[1]);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    uint64_t cycles = CHECK_CYCLES;
+    int      ipf    = DEFAULT_IPF;
+    int      opt;
+    while ((opt = getopt(argc, argv, "n:i:")) != -1) {
+        switch (opt) {
+          case 'n':
+            cycles = strtoull(optarg, NULL, 0);
+            break;
+          case 'i':
+            ipf = atoi(optarg);
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (ipf <= 0 || cycles == 0 || argc - optind != 1) {
+        dprintf(STDERR_FILENO, "Usage: %s [-n <cycles>] [-i <count>] <rom>\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    int ret = check(argv[optind], cycles, ipf);
+    return ret < 0 ? EXIT_FAILURE : ret > 0 ? EXIT_NO_WIN : EXIT_SUCCESS;
+}
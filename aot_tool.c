@@ -0,0 +1,442 @@
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "aot.h"
+
+#define MAX_BLOCK_LEN 64 // Maximal number of instructions in a block
+#define MIN_BLOCK_LEN 4  // Minimal length of a block going on with a run
+
+// Code discovered in a ROM loaded at PC_INIT
+struct rom_code {
+    uint8_t  ram[RAM_SIZE];      // RAM holding the ROM
+    int      end;                // address after the last byte of the ROM
+    uint8_t  reached[RAM_SIZE];  // 1 if an instruction starts at the address
+    uint8_t  leader[RAM_SIZE];   // 1 if a block must start at the address
+    uint16_t work[RAM_SIZE];     // addresses left to walk
+    int      nwork;              // number of addresses in work
+    uint8_t  count[RAM_SIZE];    // length of the block starting at the address
+    uint16_t last[RAM_SIZE];     // last instruction of that block
+    uint8_t  compiled[RAM_SIZE]; // 1 if the byte is part of a compiled block
+};
+
+// Returns the instruction at addr.
+static uint16_t instr_at(const struct rom_code *rc, int addr) {
+    return (uint16_t)rc->ram[addr] << 8 | rc->ram[addr + 1];
+}
+
+// Returns 1 if the operation op is translated to C, 0 if it is left to the
+// interpreter: draws, scrolls and resolution changes, exits, key waits, sound,
+// random numbers, writes to the RAM, computed jumps and invalid instructions.
+static int is_translated(int op) {
+    switch (op) {
+      case OP_CLS:
+      case OP_DRW:
+      case OP_LD_KEY:
+      case OP_LD_ST:
+      case OP_RND:
+      case OP_LD_B:
+      case OP_LD_MEM:
+      case OP_JP_V0:
+      case OP_SCD:
+      case OP_SCR:
+      case OP_SCL:
+      case OP_EXIT:
+      case OP_LOW:
+      case OP_HIGH:
+      case OP_INVALID:
+        return 0;
+      default:
+        return 1;
+    }
+}
+
+// Returns 1 if the operation op ends a block.
+static int ends_block(int op) {
+    switch (op) {
+      case OP_RET:
+      case OP_JP:
+      case OP_CALL:
+      case OP_SE_KK:
+      case OP_SNE_KK:
+      case OP_SE_XY:
+      case OP_SNE_XY:
+      case OP_SKP:
+      case OP_SKNP:
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+// Returns 1 if the operation op always ends the batch of run_rom_cycles:
+// draws, scrolls and resolution changes, exits, key waits and sound.
+static int ends_batch(int op) {
+    switch (op) {
+      case OP_CLS:
+      case OP_DRW:
+      case OP_LD_KEY:
+      case OP_LD_ST:
+      case OP_SCD:
+      case OP_SCR:
+      case OP_SCL:
+      case OP_EXIT:
+      case OP_LOW:
+      case OP_HIGH:
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+// Marks addr as a block start and queues it to be walked, if it is in the
+// ROM.
+static void add_leader(struct rom_code *rc, int addr) {
+    if (addr < PC_INIT || addr + 1 >= rc->end)
+        return;
+    rc->leader[addr] = 1;
+    if (!rc->reached[addr])
+        rc->work[rc->nwork++] = addr;
+}
+
+// Walks the code reachable from PC_INIT, following jumps, calls, returns and
+// skips. Computed jumps (Bnnn) are left to the interpreter at run time, as
+// well as the code only they reach.
+static void discover(struct rom_code *rc) {
+    add_leader(rc, PC_INIT);
+    while (rc->nwork > 0) {
+        int addr = rc->work[--rc->nwork];
+        while (addr + 1 < rc->end && !rc->reached[addr]) {
+            struct decoded_instr d;
+            rc->reached[addr] = 1;
+            decode_instr(instr_at(rc, addr), &d);
+            if (d.op == OP_JP) {
+                add_leader(rc, d.nnn);
+                break;
+            }
+            if (d.op == OP_CALL) {
+                add_leader(rc, d.nnn);
+                add_leader(rc, addr + 2);
+                break;
+            }
+            if (d.op == OP_RET || d.op == OP_JP_V0 || d.op == OP_INVALID)
+                break;
+            if (ends_block(d.op)) {
+                add_leader(rc, addr + 2);
+                add_leader(rc, addr + 4);
+                break;
+            }
+            // the interpreter runs the instruction, a block starts after it
+            if (!is_translated(d.op)) {
+                add_leader(rc, addr + 2);
+                break;
+            }
+            addr += 2;
+        }
+    }
+}
+
+// Writes to out the C statements of the instruction d located at addr, the
+// registers being V, count being the length of the block up to d.
+// Instructions ending the block set PC, as do the ones leaving it on a fault
+// in strict mode.
+static void emit_instr(FILE *out, const struct decoded_instr *d, int addr,
+        int count) {
+    int x = d->x;
+    int y = d->y;
+    fprintf(out, "    // %03x: %04x %s\n", addr, d->instr, op_name(d->op));
+    switch (d->op) {
+      case OP_NOP:
+        break;
+      case OP_RET: // see exec_ret
+        fprintf(out, "    c->pc = c->stack[c->sp];\n"
+                "    c->fault |= (c->sp - 1) & FAULT_UNDERFLOW;\n"
+                "    c->sp = (c->sp - 1) & SP_MASK;\n");
+        break;
+      case OP_JP:
+        fprintf(out, "    c->pc = 0x%03x;\n", d->nnn);
+        break;
+      case OP_CALL: // see exec_call
+        fprintf(out, "    c->fault |= (c->sp + 1) & FAULT_OVERFLOW;\n"
+                "    c->sp = (c->sp + 1) & SP_MASK;\n"
+                "    c->stack[c->sp] = 0x%03x;\n    c->pc = 0x%03x;\n",
+                addr + 2, d->nnn);
+        break;
+      case OP_SE_KK:
+      case OP_SNE_KK:
+        fprintf(out, "    c->pc = V[%d] %s 0x%02x ? 0x%03x : 0x%03x;\n", x,
+                d->op == OP_SE_KK ? "==" : "!=", d->kk, addr + 4, addr + 2);
+        break;
+      case OP_SE_XY:
+      case OP_SNE_XY:
+        fprintf(out, "    c->pc = V[%d] %s V[%d] ? 0x%03x : 0x%03x;\n", x,
+                d->op == OP_SE_XY ? "==" : "!=", y, addr + 4, addr + 2);
+        break;
+      case OP_SKP:
+      case OP_SKNP:
+        fprintf(out, "    c->pc = c->keyboard[%d] == %s ? 0x%03x : 0x%03x;\n",
+                x, d->op == OP_SKP ? "KEY_DOWN" : "KEY_UP", addr + 4,
+                addr + 2);
+        break;
+      case OP_LD_KK:
+        fprintf(out, "    V[%d] = 0x%02x;\n", x, d->kk);
+        break;
+      case OP_ADD_KK:
+        fprintf(out, "    V[%d] += 0x%02x;\n", x, d->kk);
+        break;
+      case OP_LD_XY:
+        fprintf(out, "    V[%d] = V[%d];\n", x, y);
+        break;
+      case OP_OR:
+      case OP_AND:
+      case OP_XOR:
+        fprintf(out, "    V[%d] %s= V[%d];\n", x,
+                d->op == OP_OR ? "|" : d->op == OP_AND ? "&" : "^", y);
+        break;
+      case OP_ADD_XY:
+        fprintf(out, "    V[%d] += V[%d];\n    V[VF] = V[%d] < V[%d];\n",
+                x, y, x, y);
+        break;
+      case OP_SUB:
+        fprintf(out, "    V[VF] = V[%d] > V[%d];\n"
+                "    V[%d] = V[%d] - V[%d];\n", x, y, x, x, y);
+        break;
+      case OP_SUBN:
+        fprintf(out, "    V[VF] = V[%d] > V[%d];\n"
+                "    V[%d] = V[%d] - V[%d];\n", y, x, x, y, x);
+        break;
+      case OP_SHR:
+        fprintf(out, "    V[VF] = V[%d] & 1;\n    V[%d] /= 2;\n", x, x);
+        break;
+      case OP_SHL: // VF is always cleared, see exec_shl
+        fprintf(out, "    V[VF] = 0;\n    V[%d] *= 2;\n", x);
+        break;
+      case OP_LD_I:
+        fprintf(out, "    c->I = 0x%03x;\n", d->nnn);
+        break;
+      case OP_LD_X_DT:
+        fprintf(out, "    V[%d] = c->dt;\n", x);
+        break;
+      case OP_LD_DT:
+        fprintf(out, "    c->dt = V[%d];\n", x);
+        break;
+      case OP_ADD_I:
+        fprintf(out, "    c->I += V[%d];\n", x);
+        break;
+      case OP_LD_F:
+        fprintf(out, "    c->I = CHAR_SPRITES_ADDR + CHAR_SPRITE_SIZE "
+                "* V[%d];\n", x);
+        break;
+      case OP_LD_REG: // see exec_ld_reg
+        fprintf(out, "    c->fault |= (c->I + %d > ADDR_MASK) * FAULT_RAM;\n"
+                "    for (int i = 0; i <= %d; i++)\n"
+                "        V[i] = c->ram[(c->I + i) & ADDR_MASK];\n", x, x);
+        fprintf(out, "    if (c->strict && c->fault) {\n"
+                "        c->pc = 0x%03x;\n        *last_instr = 0x%04x;\n"
+                "        return n + %d;\n    }\n", addr + 2, d->instr, count);
+        break;
+      default: // left to the interpreter, see is_translated
+        break;
+    }
+}
+
+// Measures the block starting at start: records its length in
+// rc->count[start] and its last instruction in rc->last[start]. The length is
+// 0 if the instruction at start is left to the interpreter.
+static void measure_block(struct rom_code *rc, int start) {
+    struct decoded_instr d;
+    int                  addr = start;
+    rc->count[start] = 0;
+    do {
+        decode_instr(instr_at(rc, addr), &d);
+        if (!is_translated(d.op))
+            break;
+        rc->last[start] = d.instr;
+        rc->count[start]++;
+        addr += 2;
+    } while (!ends_block(d.op) && rc->count[start] < MAX_BLOCK_LEN
+            && addr + 1 < rc->end && !rc->leader[addr]);
+}
+
+// Measures the run of instructions left to the interpreter from start, which
+// ends with a computed jump or before a compiled block, and stores it to run:
+// its length, the number of bytes from I it may write (none of its
+// instructions changes I), whether it resets the idle watch (Fx33, Fx55,
+// Cxkk) and whether it ends the batch of run_rom_cycles.
+static void measure_run(const struct rom_code *rc, int start,
+        struct aot_block *run) {
+    struct decoded_instr d;
+    int                  addr = start;
+    memset(run, 0, sizeof(*run));
+    do {
+        if (rc->compiled[addr])
+            break;
+        decode_instr(instr_at(rc, addr), &d);
+        if (d.op == OP_LD_B && run->write_len < 3)
+            run->write_len = 3;
+        else if (d.op == OP_LD_MEM && run->write_len < d.x + 1)
+            run->write_len = d.x + 1;
+        run->resets |= d.op == OP_LD_B || d.op == OP_LD_MEM || d.op == OP_RND;
+        run->stops  |= ends_batch(d.op);
+        run->count++;
+        addr += 2;
+    } while (d.op != OP_JP_V0 && d.op != OP_INVALID
+            && run->count < MAX_BLOCK_LEN && addr + 1 < rc->end
+            && rc->reached[addr]);
+}
+
+// Writes to out the jump to the block at addr if PC is cond, or always if
+// cond is NULL, provided there is one and some budget is left.
+static void emit_chain(FILE *out, const struct rom_code *rc, int addr,
+        const char *cond) {
+    if (addr >= RAM_SIZE || rc->count[addr] == 0)
+        return;
+    fprintf(out, "    if (%s%sn < budget)\n        goto block_%03x;\n",
+            cond != NULL ? cond : "", cond != NULL ? " && " : "", addr);
+}
+
+// Writes to out the code of the block starting at start, labelled after it.
+// The block stops before the instruction that would exceed the budget. Unless
+// it ends with a call or a return, a block whose successor is known jumps
+// straight to its block.
+static void emit_block(FILE *out, const struct rom_code *rc, int start) {
+    struct decoded_instr d;
+    int                  addr = start;
+    fprintf(out, "block_%03x:\n", start);
+    for (int i = 0; i < rc->count[start]; i++, addr += 2) {
+        if (i > 0)
+            fprintf(out, "    if (n + %d == budget) {\n"
+                    "        c->pc = 0x%03x;\n        *last_instr = 0x%04x;\n"
+                    "        return budget;\n    }\n", i, addr, d.instr);
+        decode_instr(instr_at(rc, addr), &d);
+        emit_instr(out, &d, addr, i + 1);
+    }
+    if (!ends_block(d.op))
+        fprintf(out, "    c->pc = 0x%03x;\n", addr);
+    fprintf(out, "    n += %d;\n", rc->count[start]);
+    char cond[32];
+    switch (d.op) {
+      case OP_RET:
+      case OP_CALL:
+        break;
+      case OP_JP:
+        emit_chain(out, rc, d.nnn, NULL);
+        break;
+      case OP_SE_KK:
+      case OP_SNE_KK:
+      case OP_SE_XY:
+      case OP_SNE_XY:
+      case OP_SKP:
+      case OP_SKNP:
+        for (int skip = 0; skip <= 1; skip++) {
+            snprintf(cond, sizeof(cond), "c->pc == 0x%03x", addr + 2 * skip);
+            emit_chain(out, rc, addr + 2 * skip, cond);
+        }
+        break;
+      default:
+        emit_chain(out, rc, addr, NULL);
+        break;
+    }
+    fprintf(out, "    *last_instr = 0x%04x;\n    return n;\n\n",
+            rc->last[start]);
+}
+
+// Writes to out the C translation unit of the ROM of rc named name.
+static void emit_program(FILE *out, struct rom_code *rc, const char *name) {
+    fprintf(out, "// Generated by chip8-aot from %s, do not edit\n", name);
+    fprintf(out, "#include \"aot.h\"\n\n#define V c->registers\n\n");
+    fprintf(out, "static const uint8_t rom[%d] = {", rc->end - PC_INIT);
+    for (int a = PC_INIT; a < rc->end; a++)
+        fprintf(out, "%s0x%02x,", (a - PC_INIT) % 12 ? " " : "\n    ",
+                rc->ram[a]);
+    fprintf(out, "\n};\n\n");
+
+    // a short block going on with a run is left to the interpreter with it,
+    // as entering the block would cost more than it saves (draws and key
+    // waits end the batches)
+    for (int a = PC_INIT; a < rc->end; a++) {
+        if (!rc->leader[a])
+            continue;
+        measure_block(rc, a);
+        int                  next = a + 2 * rc->count[a];
+        struct decoded_instr d;
+        decode_instr(rc->last[a], &d);
+        if (rc->count[a] > 0 && rc->count[a] < MIN_BLOCK_LEN
+                && !ends_block(d.op) && next + 1 < rc->end
+                && !rc->leader[next])
+            rc->count[a] = 0;
+        else
+            memset(rc->compiled + a, 1, 2 * rc->count[a]);
+    }
+    fprintf(out, "static int run(struct interpreter *c, int start, int n, "
+            "int budget,\n        uint16_t *last_instr) {\n"
+            "    switch (start) {\n");
+    for (int a = PC_INIT; a < rc->end; a++)
+        if (rc->count[a] > 0)
+            fprintf(out, "      case 0x%03x:\n        goto block_%03x;\n", a,
+                    a);
+    fprintf(out, "    }\n    return n;\n\n");
+    for (int a = PC_INIT; a < rc->end; a++)
+        if (rc->count[a] > 0)
+            emit_block(out, rc, a);
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "static const struct aot_block blocks[RAM_SIZE] = {\n");
+    for (int a = PC_INIT; a < rc->end; a++) {
+        if (rc->count[a] == 0)
+            continue;
+        fprintf(out, "    [0x%03x] = {1, 0x%04x, %d, 0, 0, 0},\n", a,
+                rc->last[a], rc->count[a]);
+        // the rest of a block left at the budget is left to the interpreter,
+        // it only resets the idle watch if it ends with a call or a return
+        struct decoded_instr d;
+        decode_instr(rc->last[a], &d);
+        for (int i = 1; i < rc->count[a]; i++)
+            fprintf(out, "    [0x%03x] = {0, 0, %d, 0, %d, 0},\n",
+                    a + 2 * i, rc->count[a] - i,
+                    d.op == OP_CALL || d.op == OP_RET);
+    }
+    // the runs left to the interpreter start at any instruction out of the
+    // compiled blocks
+    for (int a = PC_INIT; a + 1 < rc->end; a++) {
+        if (!rc->reached[a] || rc->compiled[a])
+            continue;
+        struct aot_block run;
+        measure_run(rc, a, &run);
+        fprintf(out, "    [0x%03x] = {0, 0, %d, %d, %d, %d},\n", a,
+                run.count, run.write_len, run.resets, run.stops);
+    }
+    fprintf(out, "};\n\nstatic const uint8_t covered[RAM_SIZE] = {\n");
+    for (int a = PC_INIT; a < rc->end; a++)
+        if (rc->count[a] > 0)
+            fprintf(out, "    [0x%03x ... 0x%03x] = 1,\n", a,
+                    a + 2 * rc->count[a] - 1);
+    fprintf(out, "};\n\nconst struct aot_program aot_program = {\n"
+            "    \"%s\", rom, sizeof(rom), run, blocks, covered\n};\n", name);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        dprintf(STDERR_FILENO, "Usage: %s <rom> <output.c>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    static struct rom_code rc;
+    int size = read_rom(argv[1], rc.ram + PC_INIT);
+    if (size < 0)
+        return EXIT_FAILURE;
+    rc.end = PC_INIT + size;
+    discover(&rc);
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) {
+        perror("Could not open output");
+        return EXIT_FAILURE;
+    }
+    emit_program(out, &rc, basename(argv[1]));
+    if (fclose(out) == EOF) {
+        perror("Could not write output");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#include "audio.h"
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL3/SDL.h>
+#include "interpreter.h"
+#include "spsc.h"
+
+#define AUDIO_CHUNK  512   // Samples generated at once by the audio thread
+#define AUDIO_RESYNC 8192  // Samples an event may be ahead of the audio
+                           // thread before it catches up
+#define TONE_PERIOD  (AUDIO_RATE / TONE_FREQ) // Samples of a tone period
+#define TONE_LEVEL   0.15f // Amplitude of the tone
+
+struct beeper {
+    struct spsc_queue   queue;    // events from the emulation thread
+    SDL_AudioStream    *stream;   // stream of the audio device
+    // emulation thread
+    int                 ipf;      // instructions per 60 Hz frame
+    int                 on;       // tone state of the last queued event
+    // audio thread
+    int64_t             pos;      // emulated sample of the next sample
+    struct sound_event  next;     // next event, if has_next
+    int                 has_next; // 1 if next was taken from the queue
+    int                 tone;     // 1 if the tone is on
+    int                 phase;    // sample in the tone period
+};
+
+// Takes the next event of the queue of b into b->next, audio thread. An event
+// out of reach of the current sample (the emulation stalled or ran ahead)
+// moves the sample to AUDIO_DELAY before it. Returns 0 if there is none.
+static int take_event(struct beeper *b) {
+    if (!spsc_peek(&b->queue, &b->next))
+        return 0;
+    spsc_pop(&b->queue);
+    int64_t t = b->next.time;
+    if (t < b->pos || t > b->pos + AUDIO_RESYNC)
+        b->pos = t - AUDIO_DELAY;
+    b->has_next = 1;
+    return 1;
+}
+
+// Audio stream callback: generates the additional bytes the device needs,
+// applying each event at its sample.
+static void SDLCALL fill(void *userdata, SDL_AudioStream *stream,
+        int additional, int total) {
+    struct beeper *b = userdata;
+    float          buf[AUDIO_CHUNK];
+    int            left = additional / sizeof(float);
+    (void)total;
+    while (left > 0) {
+        int n = left < AUDIO_CHUNK ? left : AUDIO_CHUNK;
+        for (int i = 0; i < n; i++) {
+            while ((b->has_next || take_event(b))
+                    && (int64_t)b->next.time <= b->pos) {
+                b->tone     = b->next.on;
+                b->has_next = 0;
+            }
+            buf[i]   = !b->tone ? 0
+                : b->phase < TONE_PERIOD / 2 ? TONE_LEVEL : -TONE_LEVEL;
+            b->phase = (b->phase + 1) % TONE_PERIOD;
+            b->pos++;
+        }
+        SDL_PutAudioStreamData(stream, buf, n * sizeof(float));
+        left -= n;
+    }
+}
+
+struct beeper *beeper_open(int ipf) {
+    struct beeper *b = aligned_alloc(alignof(struct beeper),
+            sizeof(struct beeper));
+    if (b == NULL) {
+        perror("Could not allocate beeper");
+        return NULL;
+    }
+    memset(b, 0, sizeof(*b));
+    spsc_init(&b->queue);
+    b->ipf = ipf;
+    b->pos = -AUDIO_DELAY;
+
+    const SDL_AudioSpec spec = {SDL_AUDIO_F32, 1, AUDIO_RATE};
+    b->stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK,
+            &spec, fill, b);
+    if (b->stream == NULL) {
+        SDL_LogError(
+          SDL_LOG_CATEGORY_APPLICATION,
+          "Could not open audio device: %s\n",
+          SDL_GetError()
+        );
+        free(b);
+        return NULL;
+    }
+    SDL_ResumeAudioStreamDevice(b->stream);
+    return b;
+}
+
+void beeper_close(struct beeper *b) {
+    if (b == NULL)
+        return;
+    SDL_DestroyAudioStream(b->stream);
+    free(b);
+}
+
+void beeper_set(struct beeper *b, int on, uint64_t cycle) {
+    if (b == NULL || on == b->on)
+        return;
+    struct sound_event e;
+    e.time = cycle * AUDIO_RATE / ((uint64_t)b->ipf * TIMERS_FREQ);
+    e.on   = on;
+    // with the queue full, the change is queued by a later call instead
+    if (spsc_push(&b->queue, e))
+        b->on = on;
+}
@@ -0,0 +1,34 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+#include <stdint.h>
+
+#define AUDIO_RATE  44100 // Sample rate of the beeper, in Hz
+#define TONE_FREQ   440   // Frequency of the beeper tone, in Hz
+#define AUDIO_DELAY 1470  // Samples the tone lags behind the emulation (2
+                          // frames), so that the events of a frame are
+                          // queued before they are played
+
+struct beeper;
+
+/*
+ * Opens the default audio device and plays a square tone whenever the sound
+ * timer of an emulation running ipf instructions per 60 Hz frame is on. SDL
+ * audio must be initialized. Returns NULL on failure (an error message is
+ * printed).
+ */
+struct beeper *beeper_open(int ipf);
+
+/*
+ * Stops the sound and closes b.
+ */
+void beeper_close(struct beeper *b);
+
+/*
+ * Turns the tone of b on or off after the given number of emulated
+ * instructions, from the emulation thread. Never blocks: the change is queued
+ * for the audio thread, which applies it at the matching sample. Does nothing
+ * if b is NULL or on did not change.
+ */
+void beeper_set(struct beeper *b, int on, uint64_t cycle);
+
+#endif
@@ -0,0 +1,311 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "interpreter.h"
+#include "headless.h"
+#include "input.h"
+#include "pack.h"
+
+#define LINE_SIZE   1024 // Maximal length of a manifest line
+#define MAX_THREADS 256  // Maximal number of worker threads
+
+struct job {
+    char     *rom;      // ROM file, or name or hash of a ROM of the pack
+    int       index;    // index of the ROM in the pack, PACK_NONE if none
+    char     *script;   // input script file, NULL for no input
+    uint64_t  cycles;   // instruction budget
+    uint64_t  seed;     // RNG seed
+    int       has_seed; // 1 if the manifest gives the seed
+    int       loaded;   // 1 if the ROM and script could be loaded
+    uint64_t  hash;     // state hash at the end of the run
+    struct headless_result res;
+};
+
+// Jobs of a worker, the range [next, end) not taken yet. Other workers steal
+// from it once their own range is exhausted.
+struct worker {
+    pthread_t          thread;
+    atomic_size_t      next;
+    size_t             end;
+    struct pool       *pool;
+};
+
+struct pool {
+    struct job      *jobs;
+    size_t           njobs;
+    struct worker   *workers;
+    int              nworkers;
+    int              ipf;
+    int              jit;
+    struct rom_pack *pack; // ROMs of the jobs, NULL to read their files
+};
+
+// Returns the current value of the monotonic clock in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs job on an interpreter of its own, as run_headless does for chip8 -H.
+static void run_job(struct job *job, int ipf, int jit,
+        const struct rom_pack *pack) {
+    struct interpreter  *chip   = malloc(sizeof(struct interpreter));
+    struct input_script  script = {NULL, 0};
+    job->loaded = 0;
+    if (chip == NULL) {
+        perror("malloc()");
+        return;
+    }
+    init(chip);
+    if (job->index != PACK_NONE ? pack_load(pack, job->index, chip) < 0
+            : load_rom(job->rom, chip) < 0)
+        goto clean_up;
+    if (job->script != NULL && load_input_script(job->script, &script) < 0)
+        goto clean_up;
+    // the seed of a recording applies unless the manifest overrides it
+    if (job->has_seed || !script.has_seed)
+        seed_rng(chip, job->seed);
+    else
+        seed_rng(chip, script.seed);
+
+    struct headless_opts opts;
+    headless_opts_init(&opts);
+    opts.max_cycles = job->cycles > 0 ? job->cycles : script.end;
+    if (opts.max_cycles == 0) {
+        dprintf(STDERR_FILENO, "%s: no end cycle in input script\n",
+                job->script);
+        goto clean_up;
+    }
+    opts.ipf        = script.ipf > 0 ? script.ipf : ipf;
+    opts.jit        = jit;
+    opts.input      = &script;
+    if (run_headless(chip, &opts, &job->res) < 0)
+        goto clean_up;
+    job->hash   = state_hash(chip);
+    job->loaded = 1;
+
+ clean_up:
+    free_input_script(&script);
+    free(chip);
+}
+
+// Takes the next job of w, returns its index or njobs if w has none left.
+static size_t take_job(struct worker *w, size_t njobs) {
+    if (atomic_load_explicit(&w->next, memory_order_relaxed) >= w->end)
+        return njobs;
+    size_t i = atomic_fetch_add(&w->next, 1);
+    return i < w->end ? i : njobs;
+}
+
+// Worker thread: runs its own jobs, then steals from the other workers.
+static void *work(void *arg) {
+    struct worker *self = arg;
+    struct pool   *pool = self->pool;
+    int            id   = self - pool->workers;
+    for (int k = 0; k < pool->nworkers; k++) {
+        struct worker *victim = &pool->workers[(id + k) % pool->nworkers];
+        size_t         i;
+        while ((i = take_job(victim, pool->njobs)) < pool->njobs)
+            run_job(&pool->jobs[i], pool->ipf, pool->jit, pool->pack);
+    }
+    return NULL;
+}
+
+// Returns the next whitespace separated field of the line *s and moves *s past
+// it, or NULL if there is none. A field may be quoted with '"' to hold spaces.
+static char *next_field(char **s) {
+    char *p = *s + strspn(*s, " \t\r\n");
+    char *field;
+    if (*p == '\0')
+        return NULL;
+    if (*p == '"') {
+        field = ++p;
+        p     = strchr(p, '"');
+        if (p == NULL)
+            return NULL;
+    } else {
+        field = p;
+        p    += strcspn(p, " \t\r\n");
+    }
+    if (*p != '\0')
+        *p++ = '\0';
+    *s = p;
+    return field;
+}
+
+// Returns the index in pack of the ROM rom of a manifest, given by its name or
+// by the 16 hexadecimal digits of its hash, PACK_NONE if there is none.
+static int find_rom(const struct rom_pack *pack, const char *rom) {
+    int index = pack_find(pack, rom);
+    if (index == PACK_NONE && strlen(rom) == 16
+            && strspn(rom, "0123456789abcdefABCDEF") == 16)
+        index = pack_find_hash(pack, strtoull(rom, NULL, 16));
+    return index;
+}
+
+// Appends the jobs listed in the manifest file filename to *jobs, their ROMs
+// being looked up in pack if it is not NULL. Returns 0 on success, -1
+// otherwise.
+static int load_manifest(const char *filename, struct job **jobs,
+        size_t *njobs, const struct rom_pack *pack) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        perror("Could not open manifest");
+        return -1;
+    }
+
+    size_t cap  = 0;
+    int    line = 0;
+    char   buf[LINE_SIZE];
+    *jobs  = NULL;
+    *njobs = 0;
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        line++;
+        char *s = buf + strspn(buf, " \t");
+        if (*s == '#')
+            continue;
+        char *rom = next_field(&s);
+        if (rom == NULL)
+            continue;
+        char *cycles = next_field(&s);
+        char *seed   = next_field(&s);
+        char *script = next_field(&s);
+        // a budget of 0 runs a recording up to its end
+        if (cycles == NULL
+                || (strtoull(cycles, NULL, 0) == 0 && script == NULL)) {
+            dprintf(STDERR_FILENO, "%s:%d: missing cycle budget\n", filename,
+                    line);
+            fclose(f);
+            return -1;
+        }
+        int index = PACK_NONE;
+        if (pack != NULL && (index = find_rom(pack, rom)) == PACK_NONE) {
+            dprintf(STDERR_FILENO, "%s:%d: %s is not in the ROM pack\n",
+                    filename, line, rom);
+            fclose(f);
+            return -1;
+        }
+
+        if (*njobs == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            struct job *grown = realloc(*jobs, cap * sizeof(struct job));
+            if (grown == NULL) {
+                perror("Could not load manifest");
+                fclose(f);
+                return -1;
+            }
+            *jobs = grown;
+        }
+        struct job *job = &(*jobs)[(*njobs)++];
+        memset(job, 0, sizeof(*job));
+        job->rom      = strdup(rom);
+        job->index    = index;
+        job->script   = script != NULL ? strdup(script) : NULL;
+        job->cycles   = strtoull(cycles, NULL, 0);
+        job->seed     = seed != NULL ? strtoull(seed, NULL, 0) : 0;
+        job->has_seed = seed != NULL && strcmp(seed, "-") != 0;
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct pool pool;
+    const char *pack_file = NULL;
+    int         nthreads  = sysconf(_SC_NPROCESSORS_ONLN);
+    int         opt;
+    pool.ipf  = DEFAULT_IPF;
+    pool.jit  = 0;
+    pool.pack = NULL;
+    while ((opt = getopt(argc, argv, "Jj:i:p:")) != -1) {
+        switch (opt) {
+          case 'J':
+            pool.jit = 1;
+            break;
+          case 'j':
+            nthreads = atoi(optarg);
+            break;
+          case 'i':
+            pool.ipf = atoi(optarg);
+            break;
+          case 'p':
+            pack_file = optarg;
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1) {
+        dprintf(STDERR_FILENO, "Usage: %s [-j <threads>] [-i <count>] [-J] "
+                "[-p <pack>] <manifest>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (pool.ipf <= 0) {
+        dprintf(STDERR_FILENO, "Invalid instructions per frame: %d\n",
+                pool.ipf);
+        return EXIT_FAILURE;
+    }
+    if (nthreads <= 0)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    if (pack_file != NULL && (pool.pack = pack_open(pack_file)) == NULL)
+        return EXIT_FAILURE;
+    if (load_manifest(argv[optind], &pool.jobs, &pool.njobs, pool.pack) < 0)
+        return EXIT_FAILURE;
+    if ((size_t)nthreads > pool.njobs)
+        nthreads = pool.njobs > 0 ? pool.njobs : 1;
+
+    // each worker starts with a contiguous share of the manifest
+    struct worker workers[MAX_THREADS];
+    pool.workers  = workers;
+    pool.nworkers = nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        atomic_init(&workers[i].next, pool.njobs * i / nthreads);
+        workers[i].end  = pool.njobs * (i + 1) / nthreads;
+        workers[i].pool = &pool;
+    }
+
+    double start   = now();
+    int    started = 0;
+    for (; started < nthreads; started++) {
+        if (pthread_create(&workers[started].thread, NULL, work,
+                    &workers[started]) != 0) {
+            perror("pthread_create()");
+            break;
+        }
+    }
+    // with no thread at all, the jobs are run by the main thread
+    if (started == 0)
+        work(&workers[0]);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+    double elapsed = now() - start;
+
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 0; i < pool.njobs; i++) {
+        struct job *job = &pool.jobs[i];
+        if (!job->loaded) {
+            printf("%zu %s failed\n", i, job->rom);
+            ret = EXIT_FAILURE;
+        } else {
+            printf("%zu %s cycles=%llu err=%d hash=%016llx time=%.6f\n", i,
+                    job->rom, (unsigned long long)job->res.cycles,
+                    job->res.ps.err_code, (unsigned long long)job->hash,
+                    job->res.seconds);
+        }
+        free(job->rom);
+        free(job->script);
+    }
+    free(pool.jobs);
+    pack_close(pool.pack);
+    dprintf(STDERR_FILENO, "%zu jobs, %d threads, %.3f s\n", pool.njobs,
+            nthreads, elapsed);
+    return ret;
+}
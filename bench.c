@@ -0,0 +1,327 @@
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "interpreter.h"
+#include "headless.h"
+#include "jit.h"
+
+#define MICRO_CYCLES  10000000 // Default instructions per microbenchmark
+#define ROM_CYCLES    5000000  // Default instructions per ROM benchmark
+#define REPEATS       3        // Runs per benchmark, the fastest is kept
+#define BODY_REPEATS  32       // Copies of a family body in its loop
+#define MAX_BODY      8        // Maximal number of instructions of a body
+#define MAX_GOLDEN    256      // Maximal number of entries of a golden file
+#define NAME_SIZE     256      // Maximal length of a ROM name
+#define BENCH_SEED    0        // RNG seed of the ROM benchmarks
+
+#define ENGINE_DECODE 0 // dec_exec, decoding every instruction
+#define ENGINE_STEP   1 // run_rom_cycle, one instruction per call
+#define ENGINE_BATCH  2 // run_rom_cycles, a frame per call
+#define ENGINE_JIT    3 // jit_run, a frame per call
+#define ENGINE_COUNT  4
+
+static const char *engine_names[ENGINE_COUNT] = {
+    "decode", "step", "batch", "jit"
+};
+
+// A family of instructions benchmarked together: its body is repeated in a
+// loop run from 0x200, after the registers and I are set up
+struct family {
+    const char *name;
+    uint16_t    body[MAX_BODY];
+    int         len;
+    uint16_t    I;
+};
+
+static const struct family families[] = {
+    // ALU 8xyN, on registers that never make the skips below taken
+    {"alu", {0x8014, 0x8125, 0x8231, 0x8342, 0x8453, 0x8566, 0x8607, 0x870e},
+        8, 0},
+    // skips that are not taken, so that every instruction runs
+    {"skip", {0x3aff, 0x4a0c, 0x5ab0, 0x9aa0}, 4, 0},
+    // a counter whose skips are taken over ALU instructions in turn, as in
+    // the loops of ROMs
+    {"branch", {0x7a01, 0x4a00, 0x8014, 0x3a00, 0x8125, 0x9ab0, 0x8231},
+        7, 0},
+    // 5 lines sprites at an unaligned column
+    {"draw", {0xdab5}, 1, CHAR_SPRITES_ADDR},
+    // block moves of all the registers
+    {"ldmem", {0xff55, 0xff65}, 2, 0x800},
+    // binary coded decimal
+    {"bcd", {0xfb33}, 1, 0x800},
+};
+
+struct golden {
+    char     name[NAME_SIZE];
+    uint64_t hash;
+};
+
+// Returns the current value of the monotonic clock in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sets chip up to run family f in a loop.
+static void load_family(struct interpreter *chip, const struct family *f) {
+    init(chip);
+    seed_rng(chip, BENCH_SEED);
+    uint16_t addr = PC_INIT;
+    for (int i = 0; i < BODY_REPEATS; i++) {
+        for (int j = 0; j < f->len; j++) {
+            chip->ram[addr++] = f->body[j] >> 8;
+            chip->ram[addr++] = f->body[j] & 0xff;
+        }
+    }
+    chip->ram[addr++] = 0x10 | PC_INIT >> 8;
+    chip->ram[addr++] = PC_INIT & 0xff;
+    for (int i = 0; i < REGISTERS_SIZE; i++)
+        chip->registers[i] = 0x11 * i + 3;
+    chip->registers[0xa] = 0x0c;
+    chip->registers[0xb] = 0xb7;
+    chip->I = f->I;
+    flush_dcache(chip);
+}
+
+// Runs cycles instructions of chip with engine, each call being given at most
+// ipf instructions. Returns the number of executed instructions, which is less
+// than cycles if the processor reported an error.
+static uint64_t run_engine(struct interpreter *chip, struct jit *jit,
+        int engine, uint64_t cycles, int ipf) {
+    struct proc_state ps;
+    uint64_t          n = 0;
+    ps.err_code = 0;
+    while (n < cycles) {
+        int budget = cycles - n < (uint64_t)ipf ? (int)(cycles - n) : ipf;
+        switch (engine) {
+          case ENGINE_DECODE:
+            for (int i = 0; i < budget; i++) {
+                uint16_t instr = chip->ram[chip->pc] << 8
+                    | chip->ram[chip->pc + 1];
+                chip->pc += 2;
+                if (dec_exec(instr, chip, 0) < 0)
+                    return n + i;
+            }
+            n += budget;
+            break;
+          case ENGINE_STEP:
+            for (int i = 0; i < budget; i++) {
+                run_rom_cycle(chip, &ps, 0);
+                if (ps.err_code > 0)
+                    return n + i;
+            }
+            n += budget;
+            break;
+          case ENGINE_BATCH:
+            n += run_rom_cycles(chip, &ps, budget);
+            break;
+          default:
+            n += jit_run(jit, chip, &ps, budget);
+            break;
+        }
+        if (ps.err_code > 0)
+            return n;
+    }
+    return n;
+}
+
+// Prints a result line: kind, name, engine, instructions, ns/instruction,
+// instructions/s and state hash.
+static void print_result(const char *kind, const char *name,
+        const char *engine, uint64_t cycles, double seconds, uint64_t hash) {
+    printf("%s\t%s\t%s\t%llu\t%.3f\t%.0f\t%016llx\n", kind, name, engine,
+            (unsigned long long)cycles, seconds * 1e9 / cycles,
+            cycles / seconds, (unsigned long long)hash);
+}
+
+// Runs every family with every engine, printing the results. Returns 0 on
+// success, -1 if a benchmark did not run its budget.
+static int run_micro(uint64_t cycles, int ipf, struct jit *jit) {
+    static struct interpreter chip;
+    int                       ret = 0;
+    for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++) {
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            if (e == ENGINE_JIT && jit == NULL)
+                continue;
+            double   best = 0;
+            uint64_t n    = 0;
+            for (int r = 0; r < REPEATS; r++) {
+                load_family(&chip, &families[f]);
+                jit_flush(jit);
+                double start = now();
+                n = run_engine(&chip, jit, e, cycles, ipf);
+                double t = now() - start;
+                if (r == 0 || t < best)
+                    best = t;
+            }
+            if (n < cycles) {
+                dprintf(STDERR_FILENO, "%s/%s: error after %llu cycles\n",
+                        families[f].name, engine_names[e],
+                        (unsigned long long)n);
+                ret = -1;
+                continue;
+            }
+            print_result("micro", families[f].name, engine_names[e], n, best,
+                    state_hash(&chip));
+        }
+    }
+    return ret;
+}
+
+// Loads the golden hashes of filename into golden. Returns their number, 0 if
+// the file does not exist yet.
+static int load_golden(const char *filename, struct golden *golden) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+        return 0;
+    int  n = 0;
+    char line[NAME_SIZE + 32];
+    while (n < MAX_GOLDEN && fgets(line, sizeof(line), f) != NULL) {
+        // the hash is the last field, names may hold spaces
+        char *sep = strrchr(line, ' ');
+        if (line[0] == '#' || sep == NULL)
+            continue;
+        *sep = '\0';
+        snprintf(golden[n].name, NAME_SIZE, "%s", line);
+        golden[n].hash = strtoull(sep + 1, NULL, 16);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+// Runs every ROM of roms with the batch and JIT engines, printing the results
+// and checking their final state against each other and against golden.
+// Writes the hashes to update if it is not NULL. Returns 0 on success, -1 if
+// a hash differs or a ROM can not be run.
+static int run_roms(char **roms, int nroms, uint64_t cycles, int ipf,
+        const struct golden *golden, int ngolden, FILE *update) {
+    static struct interpreter chip;
+    int                       ret = 0;
+    for (int i = 0; i < nroms; i++) {
+        char path[NAME_SIZE];
+        snprintf(path, sizeof(path), "%s", roms[i]);
+        const char *name = basename(path);
+        uint64_t    hash = 0;
+        for (int jit = 0; jit <= 1; jit++) {
+            struct headless_opts   opts;
+            struct headless_result res;
+            double                 best = 0;
+            headless_opts_init(&opts);
+            opts.max_cycles = cycles;
+            opts.ipf        = ipf;
+            opts.jit        = jit;
+            opts.skip_idle  = 0; // the engines are measured, not the skips
+            for (int r = 0; r < REPEATS; r++) {
+                init(&chip);
+                seed_rng(&chip, BENCH_SEED);
+                if (load_rom(roms[i], &chip) < 0
+                        || run_headless(&chip, &opts, &res) < 0)
+                    return -1;
+                if (r == 0 || res.seconds < best)
+                    best = res.seconds;
+            }
+            uint64_t batch_hash = hash;
+            hash = state_hash(&chip);
+            print_result("rom", name, engine_names[jit ? ENGINE_JIT
+                        : ENGINE_BATCH], res.cycles, best, hash);
+            if (jit && hash != batch_hash) {
+                dprintf(STDERR_FILENO, "%s: JIT hash %016llx, batch hash "
+                        "%016llx\n", name, (unsigned long long)hash,
+                        (unsigned long long)batch_hash);
+                ret = -1;
+            }
+
+            int found = 0;
+            for (int g = 0; g < ngolden; g++) {
+                if (strcmp(golden[g].name, name) != 0)
+                    continue;
+                found = 1;
+                if (golden[g].hash != hash && update == NULL) {
+                    dprintf(STDERR_FILENO, "%s: hash %016llx, expected "
+                            "%016llx\n", name, (unsigned long long)hash,
+                            (unsigned long long)golden[g].hash);
+                    ret = -1;
+                }
+            }
+            if (!found && ngolden > 0 && update == NULL && !jit)
+                dprintf(STDERR_FILENO, "%s: no golden hash\n", name);
+        }
+        if (update != NULL)
+            fprintf(update, "%s %016llx\n", name, (unsigned long long)hash);
+    }
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    uint64_t    micro_cycles = MICRO_CYCLES;
+    uint64_t    rom_cycles   = ROM_CYCLES;
+    int         ipf          = DEFAULT_IPF;
+    int         update       = 0;
+    const char *golden_file  = NULL;
+    int         opt;
+    while ((opt = getopt(argc, argv, "m:n:i:g:u")) != -1) {
+        switch (opt) {
+          case 'm':
+            micro_cycles = strtoull(optarg, NULL, 0);
+            break;
+          case 'n':
+            rom_cycles = strtoull(optarg, NULL, 0);
+            break;
+          case 'i':
+            ipf = atoi(optarg);
+            break;
+          case 'g':
+            golden_file = optarg;
+            break;
+          case 'u':
+            update = 1;
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (ipf <= 0 || (update && golden_file == NULL)) {
+        dprintf(STDERR_FILENO, "Usage: %s [-m <cycles>] [-n <cycles>] "
+                "[-i <count>] [-g <golden file> [-u]] [<rom>...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct golden golden[MAX_GOLDEN];
+    int           ngolden = 0;
+    if (golden_file != NULL && !update) {
+        ngolden = load_golden(golden_file, golden);
+        if (ngolden == 0)
+            dprintf(STDERR_FILENO, "No golden hash in %s\n", golden_file);
+    }
+
+    struct jit *jit = jit_create();
+    int         ret = EXIT_SUCCESS;
+    printf("# kind\tname\tengine\tcycles\tns/instr\tinstr/s\thash\n");
+    if (micro_cycles > 0 && run_micro(micro_cycles, ipf, jit) < 0)
+        ret = EXIT_FAILURE;
+    jit_destroy(jit);
+
+    FILE *out = NULL;
+    if (update) {
+        out = fopen(golden_file, "w");
+        if (out == NULL) {
+            perror("Could not open golden file");
+            return EXIT_FAILURE;
+        }
+        fprintf(out, "# final state hashes after %llu instructions, %d per "
+                "frame\n", (unsigned long long)rom_cycles, ipf);
+    }
+    if (run_roms(argv + optind, argc - optind, rom_cycles, ipf, golden,
+                ngolden, out) < 0)
+        ret = EXIT_FAILURE;
+    if (out != NULL && fclose(out) == EOF) {
+        perror("Could not write golden file");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
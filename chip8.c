@@ -0,0 +1,145 @@
+#include "chip8.h"
+#include "idle.h"
+#include "interpreter.h"
+#include <string.h>
+
+_Static_assert(CHIP8_WIDTH == HIRES_WIDTH && CHIP8_HEIGHT == HIRES_HEIGHT,
+        "display size");
+_Static_assert(CHIP8_KEYS == KEYBOARD_SIZE && CHIP8_MAX_ROM == MAX_ROM_SIZE,
+        "keypad or ROM size");
+
+struct chip8 {
+    struct interpreter chip;
+    struct proc_state  ps;         // state of the last error, if any
+    uint8_t            rom[MAX_ROM_SIZE]; // loaded ROM, for the resets
+    size_t             rom_size;   // size of the ROM, 0 if none
+    uint64_t           seed;       // RNG seed of the resets
+    int                ipf;        // instructions per timer tick
+    int                frame_left; // instructions left before the next tick
+    uint64_t           cycles;     // instructions run since the reset
+};
+
+struct chip8 *chip8_create(uint64_t seed, int ipf) {
+    if (ipf <= 0)
+        return NULL;
+    struct chip8 *c = malloc(sizeof(struct chip8));
+    if (c == NULL)
+        return NULL;
+    c->rom_size = 0;
+    c->seed     = seed;
+    c->ipf      = ipf;
+    chip8_reset(c);
+    return c;
+}
+
+void chip8_destroy(struct chip8 *c) {
+    free(c);
+}
+
+int chip8_load(struct chip8 *c, const uint8_t *rom, size_t size) {
+    if (c == NULL || rom == NULL || size == 0 || size > MAX_ROM_SIZE)
+        return -1;
+    memcpy(c->rom, rom, size);
+    c->rom_size = size;
+    chip8_reset(c);
+    return 0;
+}
+
+void chip8_reset(struct chip8 *c) {
+    if (c == NULL)
+        return;
+    init(&c->chip);
+    seed_rng(&c->chip, c->seed);
+    if (c->rom_size > 0)
+        load_rom_buffer(c->rom, c->rom_size, &c->chip);
+    memset(&c->ps, 0, sizeof(c->ps));
+    c->frame_left = c->ipf;
+    c->cycles     = 0;
+}
+
+int chip8_step(struct chip8 *c, uint64_t n, uint64_t *executed) {
+    if (c == NULL)
+        return CHIP8_STEP_ERROR;
+    uint64_t start  = c->cycles;
+    int      reason = CHIP8_STEP_DONE;
+    while (c->cycles - start < n) {
+        if (c->chip.exited) {
+            reason = CHIP8_STEP_EXIT;
+            break;
+        }
+        // a batch never crosses a timer tick
+        uint64_t left   = n - (c->cycles - start);
+        int      budget = left < (uint64_t)c->frame_left ? (int)left
+            : c->frame_left;
+        struct proc_state ps;
+        int done = run_rom_cycles(&c->chip, &ps, budget);
+        c->cycles     += done;
+        c->frame_left -= done;
+        if (ps.err_code > 0) {
+            c->ps  = ps;
+            reason = CHIP8_STEP_ERROR;
+            break;
+        }
+
+        // keys only change between calls: an idle loop runs up to the tick,
+        // or once the delay timer it may poll is out, up to the end of the
+        // call
+        if (ps.idle_period > 0) {
+            uint64_t skip = idle_skip_len(&c->chip, budget - done,
+                    n - (c->cycles - start), ps.idle_period);
+            c->cycles += skip;
+            idle_skip(&c->chip, &c->frame_left, c->ipf, skip);
+        }
+        if (c->frame_left == 0) {
+            update_timers(&c->chip);
+            c->frame_left = c->ipf;
+        }
+    }
+    if (executed != NULL)
+        *executed = c->cycles - start;
+    return reason;
+}
+
+void chip8_set_keys(struct chip8 *c, uint16_t keys) {
+    if (c == NULL)
+        return;
+    for (int i = 0; i < KEYBOARD_SIZE; i++)
+        c->chip.keyboard[i] = keys >> i & 1 ? KEY_DOWN : KEY_UP;
+}
+
+int chip8_framebuffer(struct chip8 *c, uint8_t *pixels, int *width,
+        int *height) {
+    if (c == NULL || pixels == NULL)
+        return 0;
+    int w = display_width(&c->chip);
+    int h = display_height(&c->chip);
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++)
+            pixels[i * w + j] = get_pixel(&c->chip, i, j);
+    }
+    if (width != NULL)
+        *width = w;
+    if (height != NULL)
+        *height = h;
+    int updated = c->chip.update_display;
+    c->chip.update_display = 0;
+    return updated;
+}
+
+uint64_t chip8_cycles(const struct chip8 *c) {
+    return c != NULL ? c->cycles : 0;
+}
+
+uint64_t chip8_hash(const struct chip8 *c) {
+    return c != NULL ? state_hash(&c->chip) : 0;
+}
+
+int chip8_error(const struct chip8 *c, uint16_t *instr, uint16_t *pc) {
+    if (c == NULL)
+        return 0;
+    if (instr != NULL)
+        *instr = c->ps.curr_instr;
+    if (pc != NULL)
+        *pc = c->ps.pc;
+    return c->ps.err_code;
+}
@@ -0,0 +1,94 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Embeddable CHIP-8 machine. This is the public interface of libchip8
+ * (libchip8.a, libchip8.so), which has no SDL dependency: a machine is only
+ * run, fed keys and read by its caller. Each machine holds all of its state,
+ * its random number generator included, so that any number of them can run
+ * side by side, one thread each.
+ */
+
+#define CHIP8_WIDTH      128 // Largest width of the display (high resolution)
+#define CHIP8_HEIGHT     64  // Largest height of the display
+#define CHIP8_KEYS       16  // Keys of the keypad
+#define CHIP8_MAX_ROM    3584 // Largest size in bytes of a ROM
+
+#define CHIP8_STEP_DONE  0 // Exit reason: every requested instruction ran
+#define CHIP8_STEP_EXIT  1 // Exit reason: the ROM exited (00FD)
+#define CHIP8_STEP_ERROR 2 // Exit reason: the processor reported an error
+
+struct chip8;
+
+/*
+ * Returns a new machine with no ROM, whose random numbers are drawn from seed
+ * and whose timers tick every ipf instructions (60 times per emulated
+ * second), NULL on failure.
+ */
+struct chip8 *chip8_create(uint64_t seed, int ipf);
+
+/*
+ * Releases c.
+ */
+void chip8_destroy(struct chip8 *c);
+
+/*
+ * Resets c and loads the size bytes of rom. Returns 0 on success, -1 if size
+ * is not between 1 and CHIP8_MAX_ROM.
+ */
+int chip8_load(struct chip8 *c, const uint8_t *rom, size_t size);
+
+/*
+ * Puts c back in the state that followed the load of its ROM, its random
+ * number generator included: a reset machine runs as it did the first time
+ * for the same keys.
+ */
+void chip8_reset(struct chip8 *c);
+
+/*
+ * Runs at most n instructions of c, ticking the timers every ipf
+ * instructions across calls, and stores the number of instructions run to
+ * *executed if executed is not NULL. Idle loops are fast-forwarded, the
+ * skipped iterations count as run. Returns CHIP8_STEP_DONE once the n
+ * instructions ran, CHIP8_STEP_EXIT if the ROM exited (right away if it
+ * already had), or CHIP8_STEP_ERROR on error, see chip8_error.
+ */
+int chip8_step(struct chip8 *c, uint64_t n, uint64_t *executed);
+
+/*
+ * Sets the keypad of c: key i is down if bit i of keys is set. The keys apply
+ * from the next instruction on.
+ */
+void chip8_set_keys(struct chip8 *c, uint16_t keys);
+
+/*
+ * Copies the display of c to pixels, one byte per pixel set to 1 if it is on
+ * and 0 otherwise, row by row, and stores its current size to *width and
+ * *height: 64 x 32, or CHIP8_WIDTH x CHIP8_HEIGHT in high resolution. Pixels
+ * must hold CHIP8_WIDTH * CHIP8_HEIGHT bytes. Returns 1 if the display was
+ * updated since the previous call, 0 otherwise.
+ */
+int chip8_framebuffer(struct chip8 *c, uint8_t *pixels, int *width,
+        int *height);
+
+/*
+ * Returns the number of instructions c ran since its ROM was loaded.
+ */
+uint64_t chip8_cycles(const struct chip8 *c);
+
+/*
+ * Returns a hash of the machine state of c: two machines in the same state
+ * have the same hash.
+ */
+uint64_t chip8_hash(const struct chip8 *c);
+
+/*
+ * Returns the error code of the last error of c, 0 if there was none, and
+ * stores the instruction and address it happened at to *instr and *pc if
+ * they are not NULL.
+ */
+int chip8_error(const struct chip8 *c, uint16_t *instr, uint16_t *pc);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "interpreter.h"
+
+#define CHECK_STEPS  5000  // Default chip8_step calls per run
+#define KEY_PERIOD   37    // Calls between two changes of the keys
+#define CHECK_SEED   0     // RNG seed of the runs
+
+// Returns the next value of the xorshift generator state *s, which draws the
+// step sizes and keys of a run.
+static uint64_t next_rand(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+// Returns a number of instructions to step: single instructions, sizes around
+// the timer period ipf and long runs that let idle loops be skipped.
+static uint64_t step_size(uint64_t *s, int ipf) {
+    switch (next_rand(s) % 6) {
+      case 0:
+        return 1;
+      case 1:
+        return ipf - 1 > 0 ? ipf - 1 : 1;
+      case 2:
+        return ipf;
+      case 3:
+        return ipf + 1;
+      case 4:
+        return 1 + next_rand(s) % (7 * ipf);
+      default:
+        return 1 + next_rand(s) % (60 * ipf);
+    }
+}
+
+// Runs at most n instructions of chip one at a time, the timers ticking every
+// ipf instructions as counted by *cycles. Stops early if chip exits or ps
+// reports an error.
+static void ref_step(struct interpreter *chip, struct proc_state *ps,
+        uint64_t *cycles, int ipf, uint64_t n) {
+    for (uint64_t i = 0; i < n && !chip->exited; i++) {
+        run_rom_cycle(chip, ps, 0);
+        if (ps->err_code > 0)
+            return;
+        (*cycles)++;
+        if (*cycles % ipf == 0)
+            update_timers(chip);
+    }
+}
+
+// Runs the ROM filename through chip8_step with varied step sizes and keys,
+// and through run_rom_cycle and update_timers with the same inputs. Returns 0
+// if both are in the same state after every call, -1 otherwise.
+static int check(const char *filename, int steps, int ipf) {
+    static struct interpreter ref;
+    uint8_t                   rom[MAX_ROM_SIZE];
+    int                       size = read_rom(filename, rom);
+    if (size < 0)
+        return -1;
+    struct chip8 *c = chip8_create(CHECK_SEED, ipf);
+    if (c == NULL || chip8_load(c, rom, size) < 0) {
+        dprintf(STDERR_FILENO, "%s: could not create the machine\n",
+                filename);
+        chip8_destroy(c);
+        return -1;
+    }
+    init(&ref);
+    seed_rng(&ref, CHECK_SEED);
+    load_rom_buffer(rom, size, &ref);
+
+    struct proc_state ps     = {0};
+    uint64_t          cycles = 0;
+    uint64_t          rng    = 0x9e3779b97f4a7c15;
+    int               ret    = 0;
+    for (int i = 0; i < steps; i++) {
+        if (i % KEY_PERIOD == 0) {
+            uint16_t keys = next_rand(&rng) % 3 == 0 ? 0
+                : 1 << next_rand(&rng) % CHIP8_KEYS;
+            chip8_set_keys(c, keys);
+            for (int k = 0; k < KEYBOARD_SIZE; k++)
+                ref.keyboard[k] = keys >> k & 1 ? KEY_DOWN : KEY_UP;
+        }
+        uint64_t n     = step_size(&rng, ipf);
+        uint64_t start = cycles;
+        uint64_t executed;
+        int      reason = chip8_step(c, n, &executed);
+        ref_step(&ref, &ps, &cycles, ipf, n);
+
+        int err = chip8_error(c, NULL, NULL);
+        if (err != ps.err_code || chip8_hash(c) != state_hash(&ref)
+                || (err == 0 && (chip8_cycles(c) != cycles
+                        || executed != cycles - start))) {
+            dprintf(STDERR_FILENO, "%s: state differs after step %d of %llu "
+                    "instructions (cycle %llu)\n", filename, i,
+                    (unsigned long long)n, (unsigned long long)cycles);
+            ret = -1;
+            break;
+        }
+        if (reason != CHIP8_STEP_DONE)
+            break;
+    }
+    printf("%s\t%llu\t%016llx\n", filename, (unsigned long long)cycles,
+            (unsigned long long)chip8_hash(c));
+    chip8_destroy(c);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int steps = CHECK_STEPS;
+    int ipf   = DEFAULT_IPF;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:")) != -1) {
+        switch (opt) {
+          case 'n':
+            steps = atoi(optarg);
+            break;
+          case 'i':
+            ipf = atoi(optarg);
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (steps <= 0 || ipf <= 0 || argc - optind != 1) {
+        dprintf(STDERR_FILENO, "Usage: %s [-n <steps>] [-i <count>] <rom>\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    return check(argv[optind], steps, ipf) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#include "delta.h"
+#include <string.h>
+
+// Appends a 16-bit little endian value to *p.
+static void put16(uint8_t **p, size_t v) {
+    *(*p)++ = v & 0xff;
+    *(*p)++ = v >> 8;
+}
+
+static size_t get16(const uint8_t **p) {
+    size_t v = (*p)[0] | (*p)[1] << 8;
+    *p += 2;
+    return v;
+}
+
+size_t delta_encode(const uint8_t *key, const uint8_t *state, size_t size,
+        uint8_t *out) {
+    uint8_t *p = out;
+    size_t   i = 0;
+    while (i < size) {
+        // skip the equal bytes, a word at a time while possible
+        size_t zeros = i;
+        while (i + 8 <= size) {
+            uint64_t a, b;
+            memcpy(&a, key + i, 8);
+            memcpy(&b, state + i, 8);
+            if (a != b)
+                break;
+            i += 8;
+        }
+        while (i < size && key[i] == state[i])
+            i++;
+        zeros = i - zeros;
+        if (i == size)
+            break;
+
+        // literals go on until a run of equal bytes is long enough
+        size_t start = i;
+        size_t run   = 0;
+        while (i < size && run < DELTA_MIN_RUN) {
+            run = key[i] == state[i] ? run + 1 : 0;
+            i++;
+        }
+        if (run == DELTA_MIN_RUN)
+            i -= run;
+        put16(&p, zeros);
+        put16(&p, i - start);
+        for (size_t j = start; j < i; j++)
+            *p++ = key[j] ^ state[j];
+    }
+    return p - out;
+}
+
+int delta_decode(const uint8_t *key, const uint8_t *in, size_t len,
+        uint8_t *state, size_t size) {
+    const uint8_t *p   = in;
+    size_t         pos = 0;
+    if (state != key)
+        memcpy(state, key, size);
+    while (p + 4 <= in + len) {
+        pos += get16(&p);
+        size_t n = get16(&p);
+        if (pos + n > size || p + n > in + len)
+            return -1;
+        for (size_t j = 0; j < n; j++)
+            state[pos++] ^= *p++;
+    }
+    return p == in + len ? 0 : -1;
+}
@@ -0,0 +1,30 @@
+#ifndef DELTA_H
+#define DELTA_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_MIN_RUN 4 // Shortest run of equal bytes worth a record
+// Worst size of the delta of size bytes: the literals plus a 4 bytes record
+// header every DELTA_MIN_RUN + 1 bytes
+#define DELTA_MAX_SIZE(size) \
+    ((size) + 4 * ((size) / (DELTA_MIN_RUN + 1) + 1))
+
+/*
+ * Encodes the size bytes of state XOR key to out, as records of a 16-bit
+ * count of equal bytes, a 16-bit count of literal bytes and the literals
+ * (XORed with key), counts in little endian. Out must hold
+ * DELTA_MAX_SIZE(size) bytes and size must be lower than 65536. Returns the
+ * encoded size, 0 if state equals key.
+ */
+size_t delta_encode(const uint8_t *key, const uint8_t *state, size_t size,
+        uint8_t *out);
+
+/*
+ * Rebuilds in state the size bytes encoded in the len bytes of in against
+ * key, which may be state itself. Returns 0 on success, -1 if in does not fit
+ * in size bytes.
+ */
+int delta_decode(const uint8_t *key, const uint8_t *in, size_t len,
+        uint8_t *state, size_t size);
+
+#endif
@@ -0,0 +1,197 @@
+#include "frames.h"
+#include "delta.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_BUF_SIZE (1 << 16) // Bytes buffered before a write
+#define ROW_BYTES       (HIRES_WIDTH / 8) // Bytes of a frame row
+
+struct frame_stream {
+    FILE     *out;
+    int       format;             // FRAMES_*
+    uint64_t  last[HIRES_HEIGHT][VBUF_WORDS]; // rows of the last written
+                                              // frame, see vbuf_to_rows
+    uint64_t  cycle;              // instruction count of the last frame
+    uint64_t  tick;               // timer tick of the last frame
+    // record being written: header and encoded frame
+    uint8_t   record[3 * MAX_VARINT + DELTA_MAX_SIZE(FRAME_SIZE)];
+};
+
+// Appends v to *p as a LEB128 varint.
+static void put_varint(uint8_t **p, uint64_t v) {
+    while (v >= 0x80) {
+        *(*p)++ = v | 0x80;
+        v >>= 7;
+    }
+    *(*p)++ = v;
+}
+
+// Reads a LEB128 varint from in to *v. Returns 1 on success, 0 at the end of
+// in, -1 if the varint is truncated or too long.
+static int get_varint(FILE *in, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 7 * MAX_VARINT; shift += 7) {
+        int c = getc(in);
+        if (c == EOF)
+            return shift == 0 ? 0 : -1;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return 1;
+    }
+    return -1;
+}
+
+// Appends a 16-bit little endian value to *p.
+static void put16(uint8_t **p, size_t v) {
+    *(*p)++ = v & 0xff;
+    *(*p)++ = v >> 8;
+}
+
+// Returns byte j of the row of words words, the leftmost pixels being the
+// first bytes.
+static uint8_t row_byte(const uint64_t *words, int j) {
+    return words[j / 8] >> (56 - 8 * (j % 8));
+}
+
+// Encodes the rows of chip XOR the last frame of s to *p, in the format of
+// delta_encode with a record per changed row, and makes them the last frame.
+// Returns 0 if no row changed.
+static int encode_rows(struct frame_stream *s, const struct interpreter *chip,
+        uint8_t **p) {
+    uint64_t rows[HIRES_HEIGHT][VBUF_WORDS];
+    size_t   zeros   = 0;
+    int      changed = 0;
+    vbuf_to_rows(chip, rows);
+    for (int i = 0; i < HIRES_HEIGHT; i++) {
+        uint64_t x[VBUF_WORDS];
+        for (int w = 0; w < VBUF_WORDS; w++)
+            x[w] = rows[i][w] ^ s->last[i][w];
+        if ((x[0] | x[1]) == 0) {
+            zeros += ROW_BYTES;
+            continue;
+        }
+        // the equal bytes at both ends of the row are left out of the
+        // literals
+        int lead  = x[0] != 0 ? __builtin_clzll(x[0]) / 8
+            : 8 + __builtin_clzll(x[1]) / 8;
+        int trail = x[1] != 0 ? __builtin_ctzll(x[1]) / 8
+            : 8 + __builtin_ctzll(x[0]) / 8;
+        put16(p, zeros + lead);
+        put16(p, ROW_BYTES - lead - trail);
+        for (int j = lead; j < ROW_BYTES - trail; j++)
+            *(*p)++ = row_byte(x, j);
+        zeros = trail;
+        memcpy(s->last[i], rows[i], sizeof(s->last[i]));
+        changed = 1;
+    }
+    return changed;
+}
+
+struct frame_stream *frames_open(const char *filename, int format) {
+    if (filename == NULL)
+        return NULL;
+    struct frame_stream *s = calloc(1, sizeof(struct frame_stream));
+    if (s == NULL) {
+        perror("Could not allocate frame stream");
+        return NULL;
+    }
+    s->format = format;
+    s->out    = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "wb");
+    if (s->out == NULL) {
+        perror("Could not open frame stream");
+        free(s);
+        return NULL;
+    }
+    setvbuf(s->out, NULL, _IOFBF, STREAM_BUF_SIZE);
+    if (format == FRAMES_DELTA) {
+        struct frames_header h;
+        memcpy(h.magic, FRAMES_MAGIC, sizeof(h.magic));
+        h.version = FRAMES_VERSION;
+        h.width   = HIRES_WIDTH;
+        h.height  = HIRES_HEIGHT;
+        if (fwrite(&h, sizeof(h), 1, s->out) != 1) {
+            perror("Could not write frame stream");
+            frames_close(s);
+            return NULL;
+        }
+    }
+    return s;
+}
+
+int frames_write(struct frame_stream *s, const struct interpreter *chip,
+        uint64_t cycle, uint64_t tick) {
+    if (s == NULL || chip == NULL)
+        return -1;
+
+    // the frame is encoded after the room of the largest record header, then
+    // the header is put right before it, so that the record is sent in one
+    // write
+    uint8_t *start = s->record + 3 * MAX_VARINT;
+    uint8_t *end   = start;
+    if (!encode_rows(s, chip, &end))
+        return 0;
+
+    int ok;
+    if (s->format == FRAMES_PBM) {
+        uint8_t frame[FRAME_SIZE];
+        for (int i = 0; i < HIRES_HEIGHT; i++) {
+            for (int j = 0; j < ROW_BYTES; j++)
+                frame[i * ROW_BYTES + j] = row_byte(s->last[i], j);
+        }
+        ok = write_pbm(s->out, frame, cycle, tick) == 0;
+    } else {
+        uint8_t  header[3 * MAX_VARINT];
+        uint8_t *p = header;
+        put_varint(&p, cycle - s->cycle);
+        put_varint(&p, tick - s->tick);
+        put_varint(&p, end - start);
+        start -= p - header;
+        memcpy(start, header, p - header);
+        ok = fwrite(start, end - start, 1, s->out) == 1;
+    }
+    s->cycle = cycle;
+    s->tick  = tick;
+    if (!ok) {
+        perror("Could not write frame stream");
+        return -1;
+    }
+    return 0;
+}
+
+int frames_close(struct frame_stream *s) {
+    if (s == NULL)
+        return -1;
+    int ret = s->out == stdout ? fflush(s->out) : fclose(s->out);
+    free(s);
+    if (ret == EOF) {
+        perror("Could not write frame stream");
+        return -1;
+    }
+    return 0;
+}
+
+int write_pbm(FILE *out, const uint8_t *frame, uint64_t cycle, uint64_t tick) {
+    if (out == NULL || frame == NULL)
+        return -1;
+    if (fprintf(out, "P4\n# cycle=%llu tick=%llu\n%d %d\n",
+                (unsigned long long)cycle, (unsigned long long)tick,
+                HIRES_WIDTH, HIRES_HEIGHT) < 0
+            || fwrite(frame, FRAME_SIZE, 1, out) != 1)
+        return -1;
+    return 0;
+}
+
+int read_frame(FILE *in, uint8_t *frame, uint64_t *cycle, uint64_t *tick) {
+    uint64_t dcycle, dtick, size;
+    uint8_t  delta[DELTA_MAX_SIZE(FRAME_SIZE)];
+    int      ret = get_varint(in, &dcycle);
+    if (ret <= 0)
+        return ret;
+    if (get_varint(in, &dtick) <= 0 || get_varint(in, &size) <= 0
+            || size > sizeof(delta) || fread(delta, size, 1, in) != 1
+            || delta_decode(frame, delta, size, frame, FRAME_SIZE) < 0)
+        return -1;
+    *cycle += dcycle;
+    *tick  += dtick;
+    return 1;
+}
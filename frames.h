@@ -0,0 +1,70 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+#include <stdint.h>
+#include <stdio.h>
+#include "interpreter.h"
+
+#define FRAMES_MAGIC   "CH8F" // First bytes of a frame stream
+#define FRAMES_VERSION 2      // Format of the frame streams
+#define FRAME_SIZE     (HIRES_HEIGHT * HIRES_WIDTH / 8) // Bytes of a frame
+#define MAX_VARINT     10     // Maximal size in bytes of a LEB128 varint
+#define FRAMES_DELTA   0      // Format: frames XORed with the previous one and
+                              // run-length encoded, see delta.h
+#define FRAMES_PBM     1      // Format: concatenated raw PBM (P4) images
+
+/*
+ * Header of a delta frame stream, in the byte order of the host. Each frame
+ * follows as a record of three LEB128 varints, the instructions executed and
+ * the 60 Hz timer ticks elapsed since the previous frame (since the start of
+ * the run for the first one) and the size of the encoded frame, then the frame
+ * encoded against the previous one (a blank frame for the first one).
+ * Frames are always HIRES_WIDTH x HIRES_HEIGHT, a low resolution display
+ * being stored with every pixel doubled in both directions.
+ */
+struct frames_header {
+    char     magic[4];
+    uint32_t version;
+    uint16_t width;
+    uint16_t height;
+};
+
+struct frame_stream;
+
+/*
+ * Opens a frame stream of the given format (FRAMES_*) to the file filename,
+ * or to the standard output if filename is "-". Returns NULL on failure (an
+ * error message is printed).
+ */
+struct frame_stream *frames_open(const char *filename, int format);
+
+/*
+ * Writes the framebuffer of chip to s, tagged with the given instruction
+ * count and timer tick, unless it equals the last written frame. Returns 0 on
+ * success, -1 otherwise (an error message is printed).
+ */
+int frames_write(struct frame_stream *s, const struct interpreter *chip,
+        uint64_t cycle, uint64_t tick);
+
+/*
+ * Flushes and closes s. Returns 0 on success, -1 otherwise (an error message
+ * is printed).
+ */
+int frames_close(struct frame_stream *s);
+
+/*
+ * Writes the FRAME_SIZE bytes of frame to out as a raw PBM image, rows of 16
+ * bytes with the leftmost pixel in the most significant bit, with the
+ * instruction count and timer tick as a comment. Returns 0 on success, -1
+ * otherwise.
+ */
+int write_pbm(FILE *out, const uint8_t *frame, uint64_t cycle, uint64_t tick);
+
+/*
+ * Reads the next frame of the delta stream in, after the header, into frame
+ * which holds the previous frame. *cycle and *tick, the instruction count and
+ * timer tick of the previous frame, are updated too. Returns 1 if a frame was
+ * read, 0 at the end of the stream, -1 if it is corrupted.
+ */
+int read_frame(FILE *in, uint8_t *frame, uint64_t *cycle, uint64_t *tick);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "frames.h"
+
+int main(int argc, char **argv) {
+    int list = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "l")) != -1) {
+        switch (opt) {
+          case 'l':
+            list = 1;
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1) {
+        dprintf(STDERR_FILENO, "Usage: %s [-l] <frame stream>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *filename = argv[optind];
+    FILE       *in       = strcmp(filename, "-") == 0 ? stdin
+        : fopen(filename, "rb");
+    if (in == NULL) {
+        perror("Could not open frame stream");
+        return EXIT_FAILURE;
+    }
+    struct frames_header h;
+    if (fread(&h, sizeof(h), 1, in) != 1
+            || memcmp(h.magic, FRAMES_MAGIC, sizeof(h.magic)) != 0
+            || h.version != FRAMES_VERSION || h.width != HIRES_WIDTH
+            || h.height != HIRES_HEIGHT) {
+        dprintf(STDERR_FILENO, "%s: not a frame stream of this interpreter\n",
+                filename);
+        return EXIT_FAILURE;
+    }
+
+    // each frame is decoded against the previous one, the first against a
+    // blank frame
+    static uint8_t     frame[FRAME_SIZE];
+    uint64_t           cycle = 0;
+    uint64_t           tick  = 0;
+    unsigned long long index = 0;
+    int                ret   = EXIT_SUCCESS;
+    int                read;
+    while ((read = read_frame(in, frame, &cycle, &tick)) > 0) {
+        if (list) {
+            printf("%llu cycle=%llu tick=%llu\n", index,
+                    (unsigned long long)cycle, (unsigned long long)tick);
+        } else if (write_pbm(stdout, frame, cycle, tick) < 0) {
+            perror("Could not write image");
+            ret = EXIT_FAILURE;
+            break;
+        }
+        index++;
+    }
+    if (read < 0) {
+        dprintf(STDERR_FILENO, "%s: frame %llu is corrupted\n", filename,
+                index);
+        ret = EXIT_FAILURE;
+    }
+    if (in != stdin)
+        fclose(in);
+    return ret;
+}
@@ -0,0 +1,209 @@
+#include "headless.h"
+#include "idle.h"
+#include "jit.h"
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#define CLOCK_CHECK_CYCLES 4096 // Instructions between two wall clock reads
+
+static const char *stop_reasons[] = {
+    "cycles", "time", "pc", "error", "stable", "exit"
+};
+
+// Returns the current value of the monotonic clock in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void headless_opts_init(struct headless_opts *opts) {
+    if (opts == NULL)
+        return;
+    opts->max_cycles    = 0;
+    opts->max_seconds   = 0;
+    opts->stop_pc       = -1;
+    opts->stable_cycles = 0;
+    opts->ipf           = DEFAULT_IPF;
+    opts->single_step   = 0;
+    opts->jit           = 0;
+    opts->debug         = 0;
+    opts->skip_idle     = 1;
+    opts->input         = NULL;
+    opts->frames        = NULL;
+}
+
+// Returns the cycle of the next key edge or stop condition of opts that does
+// not depend on the wall time, UINT64_MAX if there is none.
+static uint64_t next_stop(const struct headless_opts *opts, size_t next_event,
+        uint64_t last_change) {
+    uint64_t stop = UINT64_MAX;
+    if (opts->input != NULL && next_event < opts->input->count)
+        stop = opts->input->events[next_event].cycle;
+    if (opts->max_cycles > 0 && opts->max_cycles < stop)
+        stop = opts->max_cycles;
+    if (opts->stable_cycles > 0 && last_change + opts->stable_cycles < stop)
+        stop = last_change + opts->stable_cycles;
+    return stop;
+}
+
+int run_headless(struct interpreter *chip, const struct headless_opts *opts,
+        struct headless_result *res) {
+    if (chip == NULL || opts == NULL || res == NULL || opts->ipf <= 0)
+        return -1;
+
+    uint64_t last_vbuf[VBUF_SIZE];
+    int      last_hires  = chip->hires;
+    uint64_t last_change = 0;
+    uint64_t next_check  = CLOCK_CHECK_CYCLES;
+    int      frame_left  = opts->ipf;
+    size_t   next_event  = 0;
+    size_t   nevents     = opts->input != NULL ? opts->input->count : 0;
+    int      single_step = opts->debug || opts->single_step
+                               || opts->stop_pc >= 0;
+    memcpy(last_vbuf, chip->vbuf, sizeof(last_vbuf));
+
+    struct jit *jit = NULL;
+    if (opts->jit && !single_step) {
+        jit = jit_create();
+        if (jit == NULL)
+            fprintf(stderr, "JIT unavailable, using the interpreter\n");
+    }
+
+    res->cycles         = 0;
+    res->ps.curr_instr  = 0;
+    res->ps.pc          = chip->pc;
+    res->ps.err_code    = 0;
+    res->ps.exit_reason = RUN_BUDGET;
+    res->ps.idle_period = 0;
+    res->reason         = STOP_CYCLES;
+
+    int    ret   = 0;
+    double start = now();
+    if (opts->frames != NULL && frames_write(opts->frames, chip, 0, 0) < 0)
+        ret = -1;
+    while (ret == 0) {
+        if (opts->max_cycles > 0 && res->cycles >= opts->max_cycles) {
+            res->reason = STOP_CYCLES;
+            break;
+        }
+        if (opts->stop_pc >= 0 && chip->pc == opts->stop_pc) {
+            res->reason = STOP_PC;
+            break;
+        }
+
+        // apply the key edges that are due
+        while (next_event < nevents
+                && opts->input->events[next_event].cycle <= res->cycles) {
+            apply_input_event(chip, &opts->input->events[next_event]);
+            next_event++;
+        }
+
+        // a batch never crosses a frame boundary, a key edge nor a stop
+        // condition
+        uint64_t budget = frame_left;
+        if (next_event < nevents
+                && opts->input->events[next_event].cycle - res->cycles < budget)
+            budget = opts->input->events[next_event].cycle - res->cycles;
+        if (opts->max_cycles > 0 && opts->max_cycles - res->cycles < budget)
+            budget = opts->max_cycles - res->cycles;
+        if (opts->stable_cycles > 0
+                && last_change + opts->stable_cycles - res->cycles < budget)
+            budget = last_change + opts->stable_cycles - res->cycles;
+
+        int n = 1;
+        chip->update_display = 0;
+        if (single_step)
+            run_rom_cycle(chip, &res->ps, opts->debug);
+        else if (jit != NULL)
+            n = jit_run(jit, chip, &res->ps, budget);
+        else
+            n = run_rom_cycles(chip, &res->ps, budget);
+        res->cycles += n;
+        if (res->ps.err_code > 0) {
+            res->reason = STOP_ERR;
+            break;
+        }
+        frame_left -= n;
+
+        // the rest of an idle loop is skipped up to the end of the batch, or
+        // once the delay timer it may poll is out, up to the next key edge or
+        // stop condition
+        if (opts->skip_idle && res->ps.idle_period > 0) {
+            uint64_t stop = next_stop(opts, next_event, last_change);
+            uint64_t skip = idle_skip_len(chip, budget - n,
+                    stop != UINT64_MAX ? stop - res->cycles : UINT64_MAX,
+                    res->ps.idle_period);
+            res->cycles += skip;
+            idle_skip(chip, &frame_left, opts->ipf, skip);
+        }
+        if (frame_left == 0) {
+            update_timers(chip);
+            frame_left = opts->ipf;
+        }
+
+        // draws that XOR the same sprite twice do not count as a change
+        if (chip->update_display && (chip->hires != last_hires
+                    || memcmp(last_vbuf, chip->vbuf, sizeof(last_vbuf)) != 0)) {
+            memcpy(last_vbuf, chip->vbuf, sizeof(last_vbuf));
+            last_hires  = chip->hires;
+            last_change = res->cycles;
+            if (opts->frames != NULL && frames_write(opts->frames, chip,
+                        res->cycles, res->cycles / opts->ipf) < 0)
+                ret = -1;
+        }
+        if (chip->exited) {
+            res->reason = STOP_EXIT;
+            break;
+        }
+        if (opts->stable_cycles > 0
+                && res->cycles - last_change >= opts->stable_cycles) {
+            res->reason = STOP_STABLE;
+            break;
+        }
+
+        if (opts->max_seconds > 0 && res->cycles >= next_check) {
+            next_check = res->cycles + CLOCK_CHECK_CYCLES;
+            if (now() - start >= opts->max_seconds) {
+                res->reason = STOP_TIME;
+                break;
+            }
+        }
+    }
+    res->seconds = now() - start;
+    jit_destroy(jit);
+    return ret;
+}
+
+void dump_state(FILE *out, const struct interpreter *chip,
+        const struct headless_result *res) {
+    if (out == NULL || chip == NULL)
+        return;
+    for (int i = 0; i < REGISTERS_SIZE; i++) {
+        fprintf(out, "V%X=%02x%c", i, chip->registers[i],
+                i % 8 == 7 ? '\n' : ' ');
+    }
+    fprintf(out, "I=%03x PC=%03x SP=%d DT=%d ST=%d\n",
+            chip->I, chip->pc, chip->sp, chip->dt, chip->st);
+    fprintf(out, "stack:");
+    for (int i = 0; i < LEVELS_SIZE; i++)
+        fprintf(out, " %03x", chip->stack[i]);
+    fprintf(out, "\n");
+    for (int i = 0; i < display_height(chip); i++) {
+        for (int j = 0; j < display_width(chip); j++) {
+            if (get_pixel(chip, i, j))
+                fputc('#', out);
+            else
+                fputc('.', out);
+        }
+        fputc('\n', out);
+    }
+    if (res == NULL)
+        return;
+    double ips = res->seconds > 0 ? res->cycles / res->seconds : 0;
+    fprintf(out, "stop=%s instr=%04x err=%d\n", stop_reasons[res->reason],
+            res->ps.curr_instr, res->ps.err_code);
+    fprintf(out, "cycles=%llu seconds=%.6f ips=%.0f\n",
+            (unsigned long long)res->cycles, res->seconds, ips);
+}
@@ -0,0 +1,75 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+#include <stdint.h>
+#include <stdio.h>
+#include "interpreter.h"
+#include "input.h"
+#include "frames.h"
+
+#define STOP_CYCLES  0 // The instruction budget was exhausted
+#define STOP_TIME    1 // The wall time budget was exhausted
+#define STOP_PC      2 // PC reached the requested address
+#define STOP_ERR     3 // The processor reported an error
+#define STOP_STABLE  4 // The framebuffer did not change for long enough
+#define STOP_EXIT    5 // The ROM exited (00FD)
+
+struct headless_opts {
+    uint64_t max_cycles;    // instruction budget, 0 for unlimited
+    double   max_seconds;   // wall time budget in seconds, 0 for unlimited
+    int      stop_pc;       // stop when PC reaches this address, -1 to disable
+    uint64_t stable_cycles; // stop when the framebuffer is unchanged for that
+                            // many instructions, 0 to disable
+    int      ipf;           // instructions per emulated 60 Hz frame
+    int      single_step;   // run cycles one by one with run_rom_cycle
+                            // instead of batches of run_rom_cycles
+    int      jit;           // run batches with the x86-64 JIT when available
+    int      debug;         // debug mode passed to run_rom_cycle, implies
+                            // single_step
+    int      skip_idle;     // skip the iterations of idle loops, see
+                            // run_rom_cycles
+    const struct input_script *input; // key edges to apply, NULL for none
+    struct frame_stream       *frames; // stream the changed frames are
+                                       // written to, NULL for none
+};
+
+struct headless_result {
+    uint64_t          cycles;  // number of instructions executed
+    double            seconds; // wall time spent running
+    int               reason;  // why the run stopped (STOP_*)
+    struct proc_state ps;      // state of the last processor cycle
+};
+
+/*
+ * Sets opts to its default values: no budget, no stop condition, DEFAULT_IPF
+ * instructions per frame run in batches skipping idle loops, debug mode
+ * disabled, no input and no frame stream. Such a run only stops on error.
+ */
+void headless_opts_init(struct headless_opts *opts);
+
+/*
+ * Runs the ROM loaded in chip without any display and as fast as possible,
+ * until one of the stop conditions of opts is met, the ROM exits or the
+ * processor reports an error. Timers are updated every opts->ipf instructions,
+ * which emulates a 60 Hz clock regardless of the host speed. The key edges of
+ * opts->input are applied right before the instruction their cycle
+ * designates, so that a run with the same input and RNG seed always ends in
+ * the same state. Idle loops
+ * are fast-forwarded up to the next timer tick, or once the delay timer is
+ * out, up to the next key edge or stop condition: the skipped instructions
+ * count as executed and the final state is the same as without skipping.
+ * Every frame that differs from the previous one is written to opts->frames,
+ * tagged with the instructions executed so far and the timer ticks (one every
+ * opts->ipf instructions). Populates res with the run statistics. Chip must be previously initialized.
+ * Returns 0 on success, -1 otherwise.
+ */
+int run_headless(struct interpreter *chip, const struct headless_opts *opts,
+        struct headless_result *res);
+
+/*
+ * Prints to out the registers, timers, stack and framebuffer of chip, followed
+ * by the statistics of res (executed instructions and instructions/s).
+ */
+void dump_state(FILE *out, const struct interpreter *chip,
+        const struct headless_result *res);
+
+#endif
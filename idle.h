@@ -0,0 +1,86 @@
+#ifndef IDLE_H
+#define IDLE_H
+#include <stdint.h>
+#include <string.h>
+#include "interpreter.h"
+
+#define NO_LOOP RAM_SIZE // Head of an idle watch that watches no loop
+
+/*
+ * Watch of a loop head: the state the registers had the last time the head
+ * was passed. The rest of the machine state is left out: RAM, stack and RNG
+ * are only changed by the operations that reset the watch (Fx33, Fx55, 2nnn,
+ * 00EE, Cxkk), while the display, the keys and the timer ticks end the batch
+ * the watch lives in.
+ */
+struct idle_watch {
+    uint16_t pc;                        // watched loop head, NO_LOOP if none
+    int      n;                         // instruction count at the last pass
+    uint8_t  registers[REGISTERS_SIZE]; // registers at the last pass
+    uint16_t I;                         // I at the last pass
+    uint8_t  dt;                        // delay timer at the last pass
+    uint8_t  st;                        // sound timer at the last pass
+};
+
+/*
+ * Stops watching any loop, after an operation with effects beyond the
+ * registers, I and the timers.
+ */
+static inline void idle_reset(struct idle_watch *w) {
+    w->pc = NO_LOOP;
+}
+
+/*
+ * Records that the loop head pc is reached by chip after n instructions of the
+ * batch. Returns the number of instructions per iteration if the state
+ * repeats since the previous pass, in which case every further iteration
+ * repeats it too until the next timer tick or key edge. Returns 0 otherwise.
+ */
+static inline int idle_pass(struct idle_watch *w,
+        const struct interpreter *chip, uint16_t pc, int n) {
+    if (w->pc == pc && w->I == chip->I && w->dt == chip->dt
+            && w->st == chip->st
+            && memcmp(w->registers, chip->registers, REGISTERS_SIZE) == 0)
+        return n - w->n;
+    w->pc = pc;
+    w->n  = n;
+    w->I  = chip->I;
+    w->dt = chip->dt;
+    w->st = chip->st;
+    memcpy(w->registers, chip->registers, REGISTERS_SIZE);
+    return 0;
+}
+
+/*
+ * Returns the number of instructions of an idle loop of period instructions
+ * that chip may skip: up to batch_left, the end of its batch, or once the
+ * delay timer the loop may poll is out, up to stop_left, the next key edge or
+ * stop condition (UINT64_MAX if there is none).
+ */
+static inline uint64_t idle_skip_len(const struct interpreter *chip,
+        uint64_t batch_left, uint64_t stop_left, int period) {
+    uint64_t left = chip->dt == 0 && stop_left != UINT64_MAX ? stop_left
+        : batch_left;
+    return left - left % period;
+}
+
+/*
+ * Counts skip more instructions of an idle loop as executed by chip, whose
+ * timers tick every ipf instructions, frame_left more instructions from now,
+ * updating the timers at every tick crossed and frame_left.
+ */
+static inline void idle_skip(struct interpreter *chip, int *frame_left,
+        int ipf, uint64_t skip) {
+    if (skip < (uint64_t)*frame_left) {
+        *frame_left -= skip;
+        return;
+    }
+    skip -= *frame_left;
+    uint64_t ticks = 1 + skip / ipf;
+    *frame_left = ipf - skip % ipf;
+    // further ticks leave the timers out
+    for (uint64_t i = 0; i < ticks && (chip->dt > 0 || chip->st > 0); i++)
+        update_timers(chip);
+}
+
+#endif
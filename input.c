@@ -0,0 +1,134 @@
+#include "input.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINE_SIZE 256 // Maximal length of a script line
+
+int load_input_script(const char *filename, struct input_script *script) {
+    if (filename == NULL || script == NULL)
+        return -1;
+    script->events   = NULL;
+    script->count    = 0;
+    script->has_seed = 0;
+    script->seed     = 0;
+    script->ipf      = 0;
+    script->end      = 0;
+
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        perror("Could not open input script");
+        return -1;
+    }
+
+    size_t   cap  = 0;
+    int      line = 0;
+    uint64_t last = 0;
+    char     buf[LINE_SIZE];
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        line++;
+        unsigned long long cycle;
+        unsigned int       key;
+        char               edge[8];
+        char               first;
+        if (sscanf(buf, " %c", &first) != 1 || first == '#')
+            continue;
+        if (sscanf(buf, " seed %llu", &cycle) == 1) {
+            script->has_seed = 1;
+            script->seed     = cycle;
+            continue;
+        }
+        if (sscanf(buf, " ipf %u", &key) == 1) {
+            script->ipf = key;
+            continue;
+        }
+        if (sscanf(buf, " end %llu", &cycle) == 1) {
+            script->end = cycle;
+            continue;
+        }
+        if (sscanf(buf, "%llu %x %7s", &cycle, &key, edge) != 3
+                || key >= KEYBOARD_SIZE
+                || (strcmp(edge, "down") != 0 && strcmp(edge, "up") != 0)) {
+            dprintf(STDERR_FILENO, "%s:%d: invalid input event\n", filename,
+                    line);
+            goto error;
+        }
+        if (cycle < last) {
+            dprintf(STDERR_FILENO, "%s:%d: events are not sorted by cycle\n",
+                    filename, line);
+            goto error;
+        }
+        last = cycle;
+
+        if (script->count == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            struct input_event *events = realloc(script->events,
+                    cap * sizeof(struct input_event));
+            if (events == NULL) {
+                perror("Could not load input script");
+                goto error;
+            }
+            script->events = events;
+        }
+        script->events[script->count].cycle = cycle;
+        script->events[script->count].key   = key;
+        script->events[script->count].down  = edge[0] == 'd';
+        script->count++;
+    }
+    fclose(f);
+    return 0;
+
+ error:
+    fclose(f);
+    free_input_script(script);
+    return -1;
+}
+
+void free_input_script(struct input_script *script) {
+    if (script == NULL)
+        return;
+    free(script->events);
+    script->events   = NULL;
+    script->count    = 0;
+    script->has_seed = 0;
+    script->seed     = 0;
+    script->ipf      = 0;
+    script->end      = 0;
+}
+
+// Flushes out after a line was written to it, returns 0 if both succeeded.
+static int flush_line(FILE *out, int written) {
+    if (written < 0 || fflush(out) == EOF) {
+        perror("Could not record input");
+        return -1;
+    }
+    return 0;
+}
+
+int record_header(FILE *out, uint64_t seed, int ipf) {
+    if (out == NULL)
+        return -1;
+    return flush_line(out, fprintf(out, "seed %llu\nipf %d\n",
+                (unsigned long long)seed, ipf));
+}
+
+int record_input_event(FILE *out, const struct input_event *e) {
+    if (out == NULL || e == NULL)
+        return -1;
+    return flush_line(out, fprintf(out, "%llu %X %s\n",
+                (unsigned long long)e->cycle, e->key, e->down ? "down" : "up"));
+}
+
+int record_end(FILE *out, uint64_t cycle) {
+    if (out == NULL)
+        return -1;
+    return flush_line(out, fprintf(out, "end %llu\n",
+                (unsigned long long)cycle));
+}
+
+void apply_input_event(struct interpreter *chip, const struct input_event *e) {
+    if (chip == NULL || e == NULL)
+        return;
+    chip->keyboard[e->key] = e->down ? KEY_DOWN : KEY_UP;
+}
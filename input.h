@@ -0,0 +1,55 @@
+#ifndef INPUT_H
+#define INPUT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "interpreter.h"
+
+struct input_event {
+    uint64_t cycle; // number of executed instructions when the edge happens
+    uint8_t  key;   // CHIP-8 key, from 0x0 to 0xF
+    uint8_t  down;  // 1 if the key is pressed, 0 if it is released
+};
+
+struct input_script {
+    struct input_event *events;   // edges sorted by increasing cycle
+    size_t              count;    // number of events
+    int                 has_seed; // 1 if the script gives an RNG seed
+    uint64_t            seed;     // RNG seed of the recorded session
+    int                 ipf;      // instructions per frame of the recorded
+                                  // session, 0 if unknown
+    uint64_t            end;      // instructions run by the recorded session,
+                                  // 0 if unknown
+};
+
+/*
+ * Loads the input script stored in the text file filename into script. Each
+ * line holds one key edge "<cycle> <key> <down|up>", with the key as a single
+ * hexadecimal digit. A recording also holds "seed <value>", "ipf <count>" and
+ * "end <cycles>" lines. Empty lines and lines starting with '#' are ignored.
+ * Events must be sorted by cycle. Returns 0 on success, -1 otherwise (an
+ * error message is printed).
+ */
+int load_input_script(const char *filename, struct input_script *script);
+
+/*
+ * Releases the events of script and resets it to an empty script.
+ */
+void free_input_script(struct input_script *script);
+
+/*
+ * Write to out the header of a recording (RNG seed and instructions per
+ * frame), then a key edge e or the end line at the given cycle. The lines are
+ * flushed right away, so that the recording survives a crash of the
+ * interpreter. Return 0 on success, -1 otherwise.
+ */
+int record_header(FILE *out, uint64_t seed, int ipf);
+int record_input_event(FILE *out, const struct input_event *e);
+int record_end(FILE *out, uint64_t cycle);
+
+/*
+ * Applies the key edge e to the keyboard of chip.
+ */
+void apply_input_event(struct interpreter *chip, const struct input_event *e);
+
+#endif
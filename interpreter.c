@@ -1,6 +1,10 @@
 #include "interpreter.h"
+#include "idle.h"
+#include "profile.h"
+#include "trace.h"
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -10,11 +14,8 @@
 #define NOT_REGULAR_ERR "Not a regular file\n"
 #define TOO_LARGE_ERR   "File too large\n"
 #define TOO_SHORT_ERR   "File too short\n"
-#define MAX_ROM_SIZE    3840    // The maximal size in bytes of a ROM
-#define OUT_OF_RAM_ERR  1
-#define EXEC_ERR        2
 
-uint8_t char_sprites[CHAR_SPRITES_SIZE] = {
+static const uint8_t char_sprites[CHAR_SPRITES_SIZE] = {
     0xf0, 0x90, 0x90, 0x90, 0xf0, // "0"
     0x20, 0x60, 0x20, 0x20, 0x70, // "1"
     0xf0, 0x10, 0xf0, 0x80, 0xf0, // "2"
@@ -47,10 +48,10 @@ void init(struct interpreter *chip) {
     chip->st = (uint8_t)0;
     for (int i = 0; i < LEVELS_SIZE; i++)
         chip->stack[i] = (uint16_t)0;
-    for (int i = 0; i < VBUF_HEIGHT; i++) {
-        for (int j = 0; j < VBUF_WIDTH; j++)
-            chip->vbuf[i * VBUF_WIDTH + j] = (uint32_t)PIXEL_OFF;
-    }
+    for (int i = 0; i < VBUF_SIZE; i++)
+        chip->vbuf[i] = (uint64_t)0;
+    chip->hires  = 0;
+    chip->exited = 0;
     for (int i = 0; i < CHAR_SPRITES_SIZE; i++)
         chip->ram[CHAR_SPRITES_ADDR + i] = char_sprites[i];
     for (int i = 0; i < KEYBOARD_SIZE; i++)
@@ -59,11 +60,46 @@ void init(struct interpreter *chip) {
         chip->prev_keyboard[i] = (uint8_t)KEY_UP;
     chip->checking_key_press = 0;
     chip->update_display = 1;
-    srandom(time(NULL));
+    chip->fault          = 0;
+    chip->strict         = 0;
+    flush_dcache(chip);
+    chip->written = UINT64_MAX; // the whole RAM was rewritten
+    seed_rng(chip, time(NULL));
+    chip->trace = NULL;
+#ifdef CHIP8_PROFILE
+    chip->prof = NULL;
+#endif
 }
 
-int load_rom(char *filename, struct interpreter *chip) {
-    if (chip == NULL || filename == NULL)
+void set_strict(struct interpreter *chip, int strict) {
+    if (chip == NULL)
+        return;
+    if (strict && !chip->strict)
+        chip->fault = 0;
+    chip->strict = strict != 0;
+}
+
+void seed_rng(struct interpreter *chip, uint64_t seed) {
+    if (chip == NULL)
+        return;
+    // splitmix64 step, so that close seeds give unrelated states
+    uint64_t z = seed + 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z ^= z >> 31;
+    chip->rng = z != 0 ? z : 1; // xorshift states must not be zero
+}
+
+// Returns the next byte of the xorshift64* generator of chip.
+static uint8_t next_random(struct interpreter *chip) {
+    chip->rng ^= chip->rng >> 12;
+    chip->rng ^= chip->rng << 25;
+    chip->rng ^= chip->rng >> 27;
+    return (chip->rng * 0x2545f4914f6cdd1d) >> 56;
+}
+
+int read_rom(const char *filename, uint8_t *buf) {
+    if (filename == NULL || buf == NULL)
         return -1;
     
     struct stat sb;
@@ -93,7 +129,7 @@ int load_rom(char *filename, struct interpreter *chip) {
         return -1;
     }
 
-    if (read(fd, chip->ram + chip->pc, sb.st_size) < 0) {
+    if (read(fd, buf, sb.st_size) < 0) {
         perror("read()");
         close(fd);
         return -1;
@@ -103,284 +139,747 @@ int load_rom(char *filename, struct interpreter *chip) {
         perror("close()");
         return -1;
     }
+    return sb.st_size;
+}
+
+// Records in chip->written the 64 bytes ranges of the len bytes from addr,
+// which a ROM was loaded to.
+static void mark_loaded(struct interpreter *chip, unsigned addr,
+        unsigned len) {
+    for (unsigned r = addr / 64; r <= (addr + len - 1) / 64; r++)
+        chip->written |= (uint64_t)1 << (r & (RAM_SIZE / 64 - 1));
+}
+
+int load_rom(char *filename, struct interpreter *chip) {
+    int size;
+    if (chip == NULL || (size = read_rom(filename, chip->ram + chip->pc)) < 0)
+        return -1;
+    flush_dcache(chip);
+    if (size > 0)
+        mark_loaded(chip, chip->pc, size);
+    chip->fault = 0;
     return 0;
 }
 
-// Decodes and executes 0nnn, 00E0, 00EE instructions. 0nnn is in fact ignored.
-static int dec_exec0(uint16_t instr, struct interpreter *chip) {
-    if (chip == NULL)
+int load_rom_buffer(const uint8_t *rom, size_t size, struct interpreter *chip) {
+    if (rom == NULL || chip == NULL || size == 0 || size > MAX_ROM_SIZE)
         return -1;
+    memcpy(chip->ram + chip->pc, rom, size);
+    // only the instructions that overlap the ROM are stale
+    for (int addr = chip->pc - 1; addr < chip->pc + (int)size; addr++)
+        chip->dcache[addr & (RAM_SIZE - 1)].handler = NULL;
+    mark_loaded(chip, chip->pc, size);
+    chip->fault = 0;
+    return 0;
+}
+
+// Records to chip->fault whether the len bytes from addr, accessed through I,
+// go beyond the RAM. The accesses themselves wrap with ADDR_MASK.
+static void check_ram(struct interpreter *chip, unsigned addr, unsigned len) {
+    chip->fault |= (addr + len - 1 > ADDR_MASK) * FAULT_RAM;
+}
+
+// Returns the value an executer that may fault returns: -1 if chip is in
+// strict mode and recorded a fault, 0 otherwise.
+static int fault_status(const struct interpreter *chip) {
+    return -(chip->strict & (chip->fault != 0));
+}
+
+// Invalidates the predecoded instructions that overlap the len bytes from
+// addr, which are about to be written, wrapped around the RAM, and records
+// the written bytes in chip->written (len is at most 16, so that they span two
+// of its 64 bytes ranges at most). An instruction at the last address
+// overlaps address 0, invalidating an extra entry only costs a new decoding.
+static void invalidate(struct interpreter *chip, unsigned addr,
+        unsigned len) {
+    for (unsigned a = addr - 1; a != addr + len; a++)
+        chip->dcache[a & ADDR_MASK].handler = NULL;
+    chip->written |= (uint64_t)1 << (addr & ADDR_MASK) / 64
+        | (uint64_t)1 << ((addr + len - 1) & ADDR_MASK) / 64;
+}
+
+void flush_dcache(struct interpreter *chip) {
+    if (chip == NULL)
+        return;
+    for (int i = 0; i < RAM_SIZE; i++)
+        chip->dcache[i].handler = NULL;
+}
+
+// Executes 0nnn and the null instruction, which are ignored.
+static int exec_nop(struct interpreter *chip, const struct decoded_instr *d) {
+    return 0;
+}
+
+// Executes an instruction that could not be decoded.
+static int exec_invalid(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    return -1;
+}
+
+// Executes 00E0.
+static int exec_cls(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->update_display = 1;
+    for (int i = 0; i < VBUF_SIZE; i++)
+        chip->vbuf[i] = 0;
+    return 0;
+}
+
+// Executes 00Cn. The rows are moved down at once, n rows of the current
+// resolution, and the top ones cleared.
+static int exec_scd(struct interpreter *chip, const struct decoded_instr *d) {
+    int words = chip->hires ? VBUF_WORDS : 1;
+    int n     = (d->kk & N_MASK) * words;
+    int size  = display_height(chip) * words;
+    memmove(chip->vbuf + n, chip->vbuf, (size - n) * sizeof(uint64_t));
+    memset(chip->vbuf, 0, n * sizeof(uint64_t));
+    chip->update_display = 1;
+    return 0;
+}
+
+// Executes 00FB, a shift of every row by SCROLL_STEP pixels to the right.
+static int exec_scr(struct interpreter *chip, const struct decoded_instr *d) {
+    if (chip->hires) {
+        for (int i = 0; i < VBUF_SIZE; i += VBUF_WORDS) {
+            uint64_t *row = &chip->vbuf[i];
+            row[1] = row[1] >> SCROLL_STEP | row[0] << (64 - SCROLL_STEP);
+            row[0] >>= SCROLL_STEP;
+        }
+    } else {
+        for (int i = 0; i < VBUF_HEIGHT; i++)
+            chip->vbuf[i] >>= SCROLL_STEP;
+    }
+    chip->update_display = 1;
+    return 0;
+}
+
+// Executes 00FC, a shift of every row by SCROLL_STEP pixels to the left.
+static int exec_scl(struct interpreter *chip, const struct decoded_instr *d) {
+    if (chip->hires) {
+        for (int i = 0; i < VBUF_SIZE; i += VBUF_WORDS) {
+            uint64_t *row = &chip->vbuf[i];
+            row[0] = row[0] << SCROLL_STEP | row[1] >> (64 - SCROLL_STEP);
+            row[1] <<= SCROLL_STEP;
+        }
+    } else {
+        for (int i = 0; i < VBUF_HEIGHT; i++)
+            chip->vbuf[i] <<= SCROLL_STEP;
+    }
+    chip->update_display = 1;
+    return 0;
+}
+
+// Executes 00FD. PC stays on it, the ROM is over.
+static int exec_exit(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->exited  = 1;
+    chip->pc     -= 2;
+    return 0;
+}
+
+// Executes 00FE and 00FF, which clear the display as the rows change size.
+static int exec_low(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->hires = d->op == OP_HIGH;
+    return exec_cls(chip, d);
+}
+
+// Executes 00EE. The stack pointer wraps, bit 5 of sp - 1 being set if the
+// stack was empty.
+static int exec_ret(struct interpreter *chip, const struct decoded_instr *d) {
+    unsigned sp = chip->sp - 1;
+    chip->pc     = chip->stack[chip->sp];
+    chip->sp     = sp & SP_MASK;
+    chip->fault |= sp & FAULT_UNDERFLOW;
+    return fault_status(chip);
+}
+
+// Executes 1nnn.
+static int exec_jp(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->pc = d->nnn;
+    return 0;
+}
+
+// Executes 2nnn. The stack pointer wraps, bit 4 of sp + 1 being set if the
+// stack was full.
+static int exec_call(struct interpreter *chip, const struct decoded_instr *d) {
+    unsigned sp = chip->sp + 1;
+    chip->sp              = sp & SP_MASK;
+    chip->fault          |= sp & FAULT_OVERFLOW;
+    chip->stack[chip->sp] = chip->pc;
+    chip->pc              = d->nnn;
+    return fault_status(chip);
+}
+
+// Executes 3xkk.
+static int exec_se_kk(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    if (chip->registers[d->x] == d->kk)
+        chip->pc += 2;
+    return 0;
+}
+
+// Executes 4xkk.
+static int exec_sne_kk(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    if (chip->registers[d->x] != d->kk)
+        chip->pc += 2;
+    return 0;
+}
+
+// Executes 5xy0.
+static int exec_se_xy(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    if (chip->registers[d->x] == chip->registers[d->y])
+        chip->pc += 2;
+    return 0;
+}
+
+// Executes 6xkk.
+static int exec_ld_kk(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->registers[d->x] = d->kk;
+    return 0;
+}
+
+// Executes 7xkk.
+static int exec_add_kk(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->registers[d->x] += d->kk;
+    return 0;
+}
+
+// Executes 8xy0.
+static int exec_ld_xy(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->registers[d->x] = chip->registers[d->y];
+    return 0;
+}
+
+// Executes 8xy1.
+static int exec_or(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->registers[d->x] |= chip->registers[d->y];
+    return 0;
+}
+
+// Executes 8xy2.
+static int exec_and(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->registers[d->x] &= chip->registers[d->y];
+    return 0;
+}
+
+// Executes 8xy3.
+static int exec_xor(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->registers[d->x] ^= chip->registers[d->y];
+    return 0;
+}
+
+// Executes 8xy4.
+static int exec_add_xy(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    uint8_t x = d->x;
+    uint8_t y = d->y;
+    chip->registers[x] += chip->registers[y];
+    if (chip->registers[x] < chip->registers[y]) // bigger than 8 bits
+        chip->registers[VF] = 1;
+    else
+        chip->registers[VF] = 0;
+    return 0;
+}
+
+// Executes 8xy5.
+static int exec_sub(struct interpreter *chip, const struct decoded_instr *d) {
+    uint8_t x = d->x;
+    uint8_t y = d->y;
+    if (chip->registers[x] > chip->registers[y])
+        chip->registers[VF] = 1;
+    else
+        chip->registers[VF] = 0;
+    chip->registers[x] = chip->registers[x] - chip->registers[y];
+    return 0;
+}
+
+// Executes 8xy6.
+static int exec_shr(struct interpreter *chip, const struct decoded_instr *d) {
+    uint8_t x = d->x;
+    if ((chip->registers[x] & 1) == 1)
+        chip->registers[VF] = 1;
+    else
+        chip->registers[VF] = 0;
+    chip->registers[x] /= 2;
+    return 0;
+}
+
+// Executes 8xy7.
+static int exec_subn(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    uint8_t x = d->x;
+    uint8_t y = d->y;
+    if (chip->registers[y] > chip->registers[x])
+        chip->registers[VF] = 1;
+    else
+        chip->registers[VF] = 0;
+    chip->registers[x] = chip->registers[y] - chip->registers[x];
+    return 0;
+}
+
+// Executes 8xyE.
+static int exec_shl(struct interpreter *chip, const struct decoded_instr *d) {
+    uint8_t x = d->x;
+    if ((chip->registers[x] & 128) == 1)
+        chip->registers[VF] = 1;
+    else
+        chip->registers[VF] = 0;
+    chip->registers[x] *= 2;
+    return 0;
+}
+
+// Executes 9xy0.
+static int exec_sne_xy(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    if (chip->registers[d->x] != chip->registers[d->y])
+        chip->pc += 2;
+    return 0;
+}
+
+// Executes Annn.
+static int exec_ld_i(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->I = d->nnn;
+    return 0;
+}
+
+// Executes Bnnn.
+static int exec_jp_v0(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->pc = d->nnn + chip->registers[0];
+    return 0;
+}
+
+// Executes Cxkk.
+static int exec_rnd(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->registers[d->x] = d->kk & next_random(chip);
+    return 0;
+}
+
+// Returns row rotated by n bits to the right, n being lower than 64.
+static uint64_t rotate_right(uint64_t row, unsigned n) {
+    return row >> n | row << ((VBUF_WIDTH - n) % VBUF_WIDTH);
+}
+
+// Returns the high resolution row rotated by n bits to the right, n being
+// lower than 128.
+static unsigned __int128 rotate_right_hires(unsigned __int128 row,
+        unsigned n) {
+    return row >> n | row << ((HIRES_WIDTH - n) % HIRES_WIDTH);
+}
+
+// Returns the width-bit row of the sprite at addr, width being 8 or 16, read
+// wrapped around the RAM.
+static unsigned sprite_row(const struct interpreter *chip, unsigned addr,
+        int row, int width) {
+    if (width == 8)
+        return chip->ram[(addr + row) & ADDR_MASK];
+    addr += 2 * row;
+    return chip->ram[addr & ADDR_MASK] << 8 | chip->ram[(addr + 1) & ADDR_MASK];
+}
+
+// Executes Dxyn, and Dxy0 which draws a 16x16 sprite of 2 bytes per row. Each
+// sprite row is rotated to its column, wrapping around the right edge, and
+// XORed into its display row at once, two words at once in high resolution.
+static int exec_drw(struct interpreter *chip, const struct decoded_instr *d) {
+    PROFILE_DRAW_BEGIN(chip);
+    int      rows  = d->kk & N_MASK;
+    int      width = rows == 0 ? 16 : 8;
+    unsigned line  = chip->registers[d->y];
+    unsigned I     = chip->I;
+    if (rows == 0)
+        rows = 16;
+    check_ram(chip, I, rows * width / 8);
+    chip->registers[VF] = 0;
+    if (chip->hires) {
+        unsigned col = chip->registers[d->x] % HIRES_WIDTH;
+        for (int i = 0; i < rows; i++) {
+            unsigned __int128 bits   = sprite_row(chip, I, i, width);
+            unsigned __int128 sprite = rotate_right_hires(
+                    bits << (HIRES_WIDTH - width), col);
+            uint64_t *row = &chip->vbuf[(line + i) % HIRES_HEIGHT * VBUF_WORDS];
+            uint64_t  hi  = sprite >> 64;
+            uint64_t  lo  = (uint64_t)sprite;
+            if ((row[0] & hi) | (row[1] & lo))
+                chip->registers[VF] = 1;
+            row[0] ^= hi;
+            row[1] ^= lo;
+        }
+    } else {
+        unsigned col = chip->registers[d->x] % VBUF_WIDTH;
+        for (int i = 0; i < rows; i++) {
+            uint64_t  bits   = sprite_row(chip, I, i, width);
+            uint64_t  sprite = rotate_right(bits << (VBUF_WIDTH - width), col);
+            uint64_t *row    = &chip->vbuf[(line + i) % VBUF_HEIGHT];
+            if (*row & sprite)
+                chip->registers[VF] = 1;
+            *row ^= sprite;
+        }
+    }
+    chip->update_display = 1;
+    PROFILE_DRAW_END(chip);
+    return fault_status(chip);
+}
+
+// Executes Ex9E.
+static int exec_skp(struct interpreter *chip, const struct decoded_instr *d) {
+    if (chip->keyboard[d->x] == KEY_DOWN)
+        chip->pc += 2;
+    return 0;
+}
+
+// Executes ExA1.
+static int exec_sknp(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    if (chip->keyboard[d->x] == KEY_UP)
+        chip->pc += 2;
+    return 0;
+}
+
+// Executes Fx07.
+static int exec_ld_x_dt(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->registers[d->x] = chip->dt;
+    return 0;
+}
+
+// Executes Fx0A. The first execution copies the keypad, the next ones wait
+// for a key of the copy to be released.
+static int exec_ld_key(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    uint8_t key_pressed = 0;
+    if (!chip->checking_key_press) {
+        memcpy(chip->prev_keyboard, chip->keyboard, KEYBOARD_SIZE);
+        chip->checking_key_press = 1;
+        chip->pc -= 2;
+    } else {
+        for (int i = 0; i < KEYBOARD_SIZE; i++) {
+            if (chip->keyboard[i] == KEY_UP
+                    && chip->prev_keyboard[i] == KEY_DOWN) {
+                chip->checking_key_press = 0;
+                chip->registers[d->x] = i;
+                key_pressed = 1;
+                break;
+            }
+        }
+        if (!key_pressed)
+            chip->pc -= 2;
+        memcpy(chip->prev_keyboard, chip->keyboard, KEYBOARD_SIZE);
+    }
+    return 0;
+}
+
+// Executes Fx15.
+static int exec_ld_dt(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->dt = chip->registers[d->x];
+    return 0;
+}
+
+// Executes Fx18.
+static int exec_ld_st(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->st = chip->registers[d->x];
+    return 0;
+}
+
+// Executes Fx1E.
+static int exec_add_i(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    chip->I += chip->registers[d->x];
+    return 0;
+}
+
+// Executes Fx29.
+static int exec_ld_f(struct interpreter *chip, const struct decoded_instr *d) {
+    chip->I = CHAR_SPRITES_ADDR + CHAR_SPRITE_SIZE * chip->registers[d->x];
+    return 0;
+}
+
+// Executes Fx33.
+static int exec_ld_b(struct interpreter *chip, const struct decoded_instr *d) {
+    uint8_t  tmp = chip->registers[d->x];
+    unsigned I   = chip->I;
+    check_ram(chip, I, 3);
+    invalidate(chip, I, 3);
+    chip->ram[I & ADDR_MASK]       = tmp / 100;
+    chip->ram[(I + 1) & ADDR_MASK] = tmp / 10 % 10;
+    chip->ram[(I + 2) & ADDR_MASK] = tmp % 10;
+    return fault_status(chip);
+}
+
+// Executes Fx55, the registers being copied at once unless the copy wraps
+// around the RAM.
+static int exec_ld_mem(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    unsigned I   = chip->I & ADDR_MASK;
+    unsigned len = d->x + 1;
+    check_ram(chip, chip->I, len);
+    invalidate(chip, I, len);
+    if (I + len <= RAM_SIZE) {
+        memcpy(chip->ram + I, chip->registers, len);
+    } else {
+        for (unsigned i = 0; i < len; i++)
+            chip->ram[(I + i) & ADDR_MASK] = chip->registers[i];
+    }
+    return fault_status(chip);
+}
+
+// Executes Fx65, as exec_ld_mem.
+static int exec_ld_reg(struct interpreter *chip,
+        const struct decoded_instr *d) {
+    unsigned I   = chip->I & ADDR_MASK;
+    unsigned len = d->x + 1;
+    check_ram(chip, chip->I, len);
+    if (I + len <= RAM_SIZE) {
+        memcpy(chip->registers, chip->ram + I, len);
+    } else {
+        for (unsigned i = 0; i < len; i++)
+            chip->registers[i] = chip->ram[(I + i) & ADDR_MASK];
+    }
+    return fault_status(chip);
+}
+
+// Executers of the decoded instructions, indexed by operation number
+static const instr_handler handlers[OP_COUNT] = {
+    [OP_NOP]     = exec_nop,     [OP_INVALID] = exec_invalid,
+    [OP_CLS]     = exec_cls,     [OP_RET]     = exec_ret,
+    [OP_JP]      = exec_jp,      [OP_CALL]    = exec_call,
+    [OP_SE_KK]   = exec_se_kk,   [OP_SNE_KK]  = exec_sne_kk,
+    [OP_SE_XY]   = exec_se_xy,   [OP_LD_KK]   = exec_ld_kk,
+    [OP_ADD_KK]  = exec_add_kk,  [OP_LD_XY]   = exec_ld_xy,
+    [OP_OR]      = exec_or,      [OP_AND]     = exec_and,
+    [OP_XOR]     = exec_xor,     [OP_ADD_XY]  = exec_add_xy,
+    [OP_SUB]     = exec_sub,     [OP_SHR]     = exec_shr,
+    [OP_SUBN]    = exec_subn,    [OP_SHL]     = exec_shl,
+    [OP_SNE_XY]  = exec_sne_xy,  [OP_LD_I]    = exec_ld_i,
+    [OP_JP_V0]   = exec_jp_v0,   [OP_RND]     = exec_rnd,
+    [OP_DRW]     = exec_drw,     [OP_SKP]     = exec_skp,
+    [OP_SKNP]    = exec_sknp,    [OP_LD_X_DT] = exec_ld_x_dt,
+    [OP_LD_KEY]  = exec_ld_key,  [OP_LD_DT]   = exec_ld_dt,
+    [OP_LD_ST]   = exec_ld_st,   [OP_ADD_I]   = exec_add_i,
+    [OP_LD_F]    = exec_ld_f,    [OP_LD_B]    = exec_ld_b,
+    [OP_LD_MEM]  = exec_ld_mem,  [OP_LD_REG]  = exec_ld_reg,
+    [OP_SCD]     = exec_scd,     [OP_SCR]     = exec_scr,
+    [OP_SCL]     = exec_scl,     [OP_EXIT]    = exec_exit,
+    [OP_LOW]     = exec_low,     [OP_HIGH]    = exec_low
+};
+
+// Returns the operation of the instructions 0nnn, 00E0, 00EE and of the
+// SUPER-CHIP 00Cn, 00FB, 00FC, 00FD, 00FE, 00FF.
+static uint8_t decode0(uint16_t instr) {
+    if ((instr & 0xfff0) == 0x00c0)
+        return OP_SCD;
     switch (instr) {
       case 0x00e0:
-        chip->update_display = 1;
-        for (int i = 0; i < VBUF_HEIGHT; i++) {
-            for (int j = 0; j < VBUF_WIDTH; j++)
-                chip->vbuf[i * VBUF_WIDTH + j] = 0;
-        }
-        break;
+        return OP_CLS;
       case 0x00ee:
-        chip->pc = chip->stack[chip->sp];
-        chip->sp--;
-        break;
-      default:
-        // ignore 0x0nnn
-        break;
+        return OP_RET;
+      case 0x00fb:
+        return OP_SCR;
+      case 0x00fc:
+        return OP_SCL;
+      case 0x00fd:
+        return OP_EXIT;
+      case 0x00fe:
+        return OP_LOW;
+      case 0x00ff:
+        return OP_HIGH;
+      default: // 0nnn is ignored
+        return OP_NOP;
     }
-    return 0;
 }
 
-// Decodes and executes the instructions 8xy0, ..., 8xy7, 8xyE.
-static int dec_exec8(uint16_t n, uint16_t x, uint16_t y,
-        struct interpreter *chip) {
-    if (chip == NULL)
-        return -1;
+// Returns the operation of the instructions 8xy0, ..., 8xy7, 8xyE.
+static uint8_t decode8(uint8_t n) {
     switch (n) {
       case 0:
-        chip->registers[x] = chip->registers[y];
-        break;
+        return OP_LD_XY;
       case 1:
-        chip->registers[x] |= chip->registers[y];
-        break;
+        return OP_OR;
       case 2:
-        chip->registers[x] &= chip->registers[y];
-        break;
+        return OP_AND;
       case 3:
-        chip->registers[x] ^= chip->registers[y];
-        break;
+        return OP_XOR;
       case 4:
-        chip->registers[x] += chip->registers[y];
-        if (chip->registers[x] < chip->registers[y]) // bigger than 8 bits
-            chip->registers[VF] = 1;
-        else
-            chip->registers[VF] = 0;
-        break;
+        return OP_ADD_XY;
       case 5:
-        if (chip->registers[x] > chip->registers[y])
-            chip->registers[VF] = 1;
-        else
-            chip->registers[VF] = 0;
-        chip->registers[x] = chip->registers[x] - chip->registers[y];
-        break;
+        return OP_SUB;
       case 6:
-        if ((chip->registers[x] & 1) == 1)
-            chip->registers[VF] = 1;
-        else
-            chip->registers[VF] = 0;
-        chip->registers[x] /= 2;
-        break;
+        return OP_SHR;
       case 7:
-        if (chip->registers[y] > chip->registers[x])
-            chip->registers[VF] = 1;
-        else
-            chip->registers[VF] = 0;
-        chip->registers[x] = chip->registers[y] - chip->registers[x];
-        break;
+        return OP_SUBN;
       case 14:
-        if ((chip->registers[x] & 128) == 1)
-            chip->registers[VF] = 1;
-        else
-            chip->registers[VF] = 0;
-        chip->registers[x] *= 2;
-        break;
+        return OP_SHL;
       default:
-        return -1;
+        return OP_INVALID;
     }
-    return 0;
 }
 
-// Decodes and executes the instructions Ex9E, ExA1.
-static int dec_execE(uint16_t x, uint16_t kk, struct interpreter *chip) {
+// Returns the operation of the instructions Ex9E, ExA1.
+static uint8_t decodeE(uint8_t kk) {
     switch (kk) {
       case 0x9e:
-        if (chip->keyboard[x] == KEY_DOWN)
-            chip->pc += 2;
-        break;
+        return OP_SKP;
       case 0xa1:
-        if (chip->keyboard[x] == KEY_UP)
-            chip->pc += 2;
-        break;
+        return OP_SKNP;
       default:
-        return -1;
+        return OP_INVALID;
     }
-    return 0;
 }
 
-// Decodes and executes the instructions Fx07, Fx0A, Fx15, Fx18, Fx1C, Fx29,
+// Returns the operation of the instructions Fx07, Fx0A, Fx15, Fx18, Fx1E, Fx29,
 // Fx33, Fx55, Fx65.
-static int dec_execF(uint16_t x, uint16_t kk, struct interpreter *chip) {
-    uint8_t tmp = 0;
-    uint8_t key_pressed = 0;
+static uint8_t decodeF(uint8_t kk) {
     switch (kk) {
       case 0x07:
-        chip->registers[x] = chip->dt;
-        break;
+        return OP_LD_X_DT;
       case 0x0A:
-        if (!chip->checking_key_press) {
-            for (int i = 0; i < KEYBOARD_SIZE; i++) {
-                if (chip->keyboard[i] == KEY_DOWN)
-                    chip->prev_keyboard[i] == KEY_DOWN;
-                else
-                    chip->prev_keyboard[i] == KEY_UP;
-            }
-            chip->checking_key_press = 1;
-            chip->pc -= 2;
-        } else {
-            for (int i = 0; i < KEYBOARD_SIZE; i++) {
-                if (chip->keyboard[i] == KEY_UP
-                        && chip->prev_keyboard[i] == KEY_DOWN) {
-                    chip->checking_key_press = 0;
-                    chip->registers[x] = i;
-                    key_pressed = 1;
-                    break;
-                }
-            }
-            if (!key_pressed)
-                chip->pc -= 2;
-            for (int i = 0; i < KEYBOARD_SIZE; i++)
-                chip->prev_keyboard[i] = chip->keyboard[i];
-        }
-        break;
+        return OP_LD_KEY;
       case 0x15:
-        chip->dt = chip->registers[x];
-        break;
+        return OP_LD_DT;
       case 0x18:
-        chip->st = chip->registers[x];
-        break;
+        return OP_LD_ST;
       case 0x1e:
-        chip->I += chip->registers[x];
-        break;
+        return OP_ADD_I;
       case 0x29:
-        chip->I = CHAR_SPRITES_ADDR + CHAR_SPRITE_SIZE * chip->registers[x];
-        break;
+        return OP_LD_F;
       case 0x33:
-        tmp = chip->registers[x];
-        chip->ram[chip->I] = tmp / 100;
-        tmp -= chip->ram[chip->I] * 100;
-        chip->ram[chip->I + 1] = tmp / 10;
-        tmp -= chip->ram[chip->I + 1] * 10;
-        chip->ram[chip->I + 2] = tmp;
-        break;
+        return OP_LD_B;
       case 0x55:
-        for (int i = 0; i <= x; i++)
-            chip->ram[chip->I + i] = chip->registers[i];
-        break;
+        return OP_LD_MEM;
       case 0x65:
-        for (int i = 0; i <= x; i++)
-            chip->registers[i] = chip->ram[chip->I + i];
-        break;
+        return OP_LD_REG;
       default:
-        return -1;
+        return OP_INVALID;
     }
-    return 0;
 }
 
-int dec_exec(const uint16_t instr, struct interpreter *chip, int mode) {
-    if (chip == NULL)
-        return -1;
-    int      res    = 0;
-    uint16_t opcode = instr >> 12;
-    uint16_t nnn    = instr & NNN_MASK;
-    uint8_t n       = instr & N_MASK;
-    uint8_t x       = (instr & X_MASK) >> 8;
-    uint8_t y       = (instr & Y_MASK) >> 4;
-    uint8_t kk      = instr & KK_MASK;
-    if (mode) {
-        printf("\nCYCLE:\n");
-        printf("instr:  %#06x n:  %#06x\n", instr, n);
-        printf("opcode: %#06x x:  %#06x\n", opcode, x);
-        printf("nnn:    %#06x y:  %#06x\n", nnn, y);
-        printf("kk:     %#06x pc: %#05x\n", kk, chip->pc);
-        int c = 0;
-        for (int i = 0; i < 15; i++) {
-            printf("reg[%02d]: %03d ", i, chip->registers[i]);
-            if (c++ % 5 == 4)
-                printf("\n");
-        }
-        printf("checking key press: %d\n", chip->checking_key_press);
-    }
-    switch (opcode) {
-      case 0x0: // 0nnn, 00e0, 00ee
-        res = dec_exec0(instr, chip);
+// Mnemonics of the operations, indexed by operation number
+static const char *op_names[OP_COUNT] = {
+    [OP_NOP]     = "NOP",     [OP_INVALID] = "INVALID",
+    [OP_CLS]     = "CLS",     [OP_RET]     = "RET",
+    [OP_JP]      = "JP",      [OP_CALL]    = "CALL",
+    [OP_SE_KK]   = "SE_KK",   [OP_SNE_KK]  = "SNE_KK",
+    [OP_SE_XY]   = "SE_XY",   [OP_LD_KK]   = "LD_KK",
+    [OP_ADD_KK]  = "ADD_KK",  [OP_LD_XY]   = "LD_XY",
+    [OP_OR]      = "OR",      [OP_AND]     = "AND",
+    [OP_XOR]     = "XOR",     [OP_ADD_XY]  = "ADD_XY",
+    [OP_SUB]     = "SUB",     [OP_SHR]     = "SHR",
+    [OP_SUBN]    = "SUBN",    [OP_SHL]     = "SHL",
+    [OP_SNE_XY]  = "SNE_XY",  [OP_LD_I]    = "LD_I",
+    [OP_JP_V0]   = "JP_V0",   [OP_RND]     = "RND",
+    [OP_DRW]     = "DRW",     [OP_SKP]     = "SKP",
+    [OP_SKNP]    = "SKNP",    [OP_LD_X_DT] = "LD_X_DT",
+    [OP_LD_KEY]  = "LD_KEY",  [OP_LD_DT]   = "LD_DT",
+    [OP_LD_ST]   = "LD_ST",   [OP_ADD_I]   = "ADD_I",
+    [OP_LD_F]    = "LD_F",    [OP_LD_B]    = "LD_B",
+    [OP_LD_MEM]  = "LD_MEM",  [OP_LD_REG]  = "LD_REG",
+    [OP_SCD]     = "SCD",     [OP_SCR]     = "SCR",
+    [OP_SCL]     = "SCL",     [OP_EXIT]    = "EXIT",
+    [OP_LOW]     = "LOW",     [OP_HIGH]    = "HIGH"
+};
+
+const char *op_name(int op) {
+    if (op < 0 || op >= OP_COUNT)
+        return "?";
+    return op_names[op];
+}
+
+void decode_instr(uint16_t instr, struct decoded_instr *d) {
+    uint8_t n = instr & N_MASK;
+    d->instr  = instr;
+    d->nnn    = instr & NNN_MASK;
+    d->x      = (instr & X_MASK) >> 8;
+    d->y      = (instr & Y_MASK) >> 4;
+    d->kk     = instr & KK_MASK;
+    switch (instr >> 12) {
+      case 0x0: // 0nnn, 00e0, 00ee, 00cn, 00fb-00ff
+        d->op = decode0(instr);
         break;
       case 0x1: // 1nnn
-        chip->pc = nnn;
+        d->op = OP_JP;
         break;
       case 0x2: // 2nnn
-        chip->sp++;
-        chip->stack[chip->sp] = chip->pc;
-        chip->pc              = nnn;
+        d->op = OP_CALL;
         break;
       case 0x3: // 3xkk
-        if (chip->registers[x] == kk)
-            chip->pc += 2;
+        d->op = OP_SE_KK;
         break;
       case 0x4: // 4xkk
-        if (chip->registers[x] != kk)
-            chip->pc += 2;
+        d->op = OP_SNE_KK;
         break;
       case 0x5: // 5xy0
-        if (n != 0) {
-            res = -1;
-            break;
-        }
-        if (chip->registers[x] == chip->registers[y])
-            chip->pc += 2;
+        d->op = n != 0 ? OP_INVALID : OP_SE_XY;
         break;
       case 0x6: // 6xkk
-        chip->registers[x] = kk;
+        d->op = OP_LD_KK;
         break;
       case 0x7: // 7xkk
-        chip->registers[x] += kk;
+        d->op = OP_ADD_KK;
         break;
       case 0x8: // 8xy0, ..., 8xy7, 8xyE
-        res = dec_exec8(n, x, y, chip);
+        d->op = decode8(n);
         break;
       case 0x9: // 9xy0
-        if (n != 0) {
-            res = -1;
-            break;
-        }
-        if (chip->registers[x] != chip->registers[y])
-            chip->pc += 2;
+        d->op = n != 0 ? OP_INVALID : OP_SNE_XY;
         break;
       case 0xa: // Annn
-        chip->I = nnn;
+        d->op = OP_LD_I;
         break;
       case 0xb: // Bnnn
-        chip->pc = nnn + chip->registers[0];
+        d->op = OP_JP_V0;
         break;
       case 0xc: // Cxkk
-        chip->registers[x] = kk & (random() % 256);
+        d->op = OP_RND;
         break;
       case 0xd: // Dxyn
-        chip->registers[VF] = 0;
-        for (uint8_t i = 0; i < n; i++) {
-            uint8_t byte = chip->ram[chip->I + i];
-            for (uint8_t j = 0; j < 8; j++) {
-                uint8_t bit  = (byte >> (7-j)) & 1;
-                int     line = (chip->registers[y] + i) % VBUF_HEIGHT;
-                int     col  = (chip->registers[x] + j) % VBUF_WIDTH;
-                if (chip->vbuf[line * VBUF_WIDTH + col] == PIXEL_ON && bit == 1)
-                    chip->registers[VF] = 1;
-                uint32_t new_pixel = 0;
-                if (bit == 1)
-                    new_pixel = PIXEL_ON;
-                chip->vbuf[line * VBUF_WIDTH + col] ^= new_pixel;
-            }
-        }
-        chip->update_display = 1;
+        d->op = OP_DRW;
         break;
       case 0xe: // Ex9E, ExA1
-        res = dec_execE(x, kk, chip);
+        d->op = decodeE(d->kk);
         break;
-      case 0xf: // Fx07, Fx0A, Fx15, Fx18, Fx1C, Fx29, Fx33, Fx55, Fx65
-        res = dec_execF(x, kk, chip);
-        break;
-      default:
-        res = -1;
+      default: // Fx07, Fx0A, Fx15, Fx18, Fx1E, Fx29, Fx33, Fx55, Fx65
+        d->op = decodeF(d->kk);
         break;
     }
-    return res;
+    d->handler = handlers[d->op];
+}
+
+// Returns the predecoded instruction at the address PC points to, decoding it
+// if it is not in the cache yet. PC must be lower than RAM_SIZE, the second
+// byte of an instruction at its last address is read from address 0.
+static struct decoded_instr *fetch(struct interpreter *chip) {
+    struct decoded_instr *d = &chip->dcache[chip->pc];
+    if (d->handler == NULL) {
+        uint16_t lb = (uint16_t)chip->ram[chip->pc] << 8;
+        uint16_t rb = (uint16_t)chip->ram[(chip->pc + 1) & ADDR_MASK];
+        decode_instr(lb | rb, d);
+    }
+    return d;
+}
+
+// Executes d, located at pc, recording it to the trace of chip. Returns the
+// value returned by the executer.
+static int exec_traced(struct interpreter *chip, const struct decoded_instr *d,
+        uint16_t pc) {
+    uint8_t before[REGISTERS_SIZE];
+    memcpy(before, chip->registers, sizeof(before));
+    int ret = d->handler(chip, d);
+    trace_add(chip->trace, chip, d, pc, before);
+    return ret;
+}
+
+int dec_exec(const uint16_t instr, struct interpreter *chip, int mode) {
+    if (chip == NULL)
+        return -1;
+    struct decoded_instr d;
+    decode_instr(instr, &d);
+    if (mode)
+        return exec_traced(chip, &d, chip->pc - 2);
+    return d.handler(chip, &d);
 }
 
 // If the timer is null, does nothing. If not and if the timer value is strictly
@@ -392,158 +891,316 @@ static void update_timer(uint8_t *timer) {
         (*timer)--;
 }
 
+int take_fault(struct interpreter *chip) {
+    uint8_t fault = chip->fault;
+    chip->fault = 0;
+    if (fault & FAULT_RAM)
+        return RAM_ERR;
+    if (fault & FAULT_OVERFLOW)
+        return OVERFLOW_ERR;
+    return fault & FAULT_UNDERFLOW ? UNDERFLOW_ERR : 0;
+}
+
 void run_rom_cycle(struct interpreter *chip, struct proc_state *ps, int mode) {
-    // check that pc is still in program
-    if (chip->pc > RAM_SIZE) {
+    // check that pc is still in program, and in strict mode that the whole
+    // instruction is
+    if (chip->pc + chip->strict >= RAM_SIZE) {
         ps->curr_instr = 0;
         ps->pc         = chip->pc;
         ps->err_code   = OUT_OF_RAM_ERR;
         return;
     }
 
-    // read instruction
-    uint16_t lb    = (uint16_t)chip->ram[chip->pc] << 8;
-    uint16_t rb    = (uint16_t)chip->ram[chip->pc + 1];
-    uint16_t instr = lb | rb;
-    ps->curr_instr = instr;
+    // read instruction, decoding it only the first time it is met
+    struct decoded_instr *d = fetch(chip);
+    ps->curr_instr = d->instr;
+    PROFILE_INSTR(chip, d, chip->pc);
 
     // set program counter to next instruction
     chip->pc += 2;
     ps->pc    = chip->pc;
 
-    // decode and execute instruction
-    if (instr == 0)
+    // execute instruction
+    if (d->instr == 0)
         return;
-    int res = dec_exec(instr, chip, mode);
-    if (res < 0) {
-        ps->err_code = EXEC_ERR;
+    // executers that may fault fail on a fault in strict mode
+    int ret = mode ? exec_traced(chip, d, chip->pc - 2) : d->handler(chip, d);
+    if (ret < 0) {
+        ps->err_code = chip->strict && chip->fault ? take_fault(chip)
+            : EXEC_ERR;
         return;
     }
+}
 
-    update_timer(&chip->dt);
-    update_timer(&chip->st);
+int run_rom_cycles(struct interpreter *chip, struct proc_state *ps,
+        int budget) {
+    // labels of the operation executers, indexed by operation number
+    static void *const labels[OP_COUNT] = {
+        [OP_NOP]     = &&op_nop,     [OP_INVALID] = &&op_invalid,
+        [OP_CLS]     = &&op_cls,     [OP_RET]     = &&op_ret,
+        [OP_JP]      = &&op_jp,      [OP_CALL]    = &&op_call,
+        [OP_SE_KK]   = &&op_se_kk,   [OP_SNE_KK]  = &&op_sne_kk,
+        [OP_SE_XY]   = &&op_se_xy,   [OP_LD_KK]   = &&op_ld_kk,
+        [OP_ADD_KK]  = &&op_add_kk,  [OP_LD_XY]   = &&op_ld_xy,
+        [OP_OR]      = &&op_or,      [OP_AND]     = &&op_and,
+        [OP_XOR]     = &&op_xor,     [OP_ADD_XY]  = &&op_add_xy,
+        [OP_SUB]     = &&op_sub,     [OP_SHR]     = &&op_shr,
+        [OP_SUBN]    = &&op_subn,    [OP_SHL]     = &&op_shl,
+        [OP_SNE_XY]  = &&op_sne_xy,  [OP_LD_I]    = &&op_ld_i,
+        [OP_JP_V0]   = &&op_jp_v0,   [OP_RND]     = &&op_rnd,
+        [OP_DRW]     = &&op_drw,     [OP_SKP]     = &&op_skp,
+        [OP_SKNP]    = &&op_sknp,    [OP_LD_X_DT] = &&op_ld_x_dt,
+        [OP_LD_KEY]  = &&op_ld_key,  [OP_LD_DT]   = &&op_ld_dt,
+        [OP_LD_ST]   = &&op_ld_st,   [OP_ADD_I]   = &&op_add_i,
+        [OP_LD_F]    = &&op_ld_f,    [OP_LD_B]    = &&op_ld_b,
+        [OP_LD_MEM]  = &&op_ld_mem,  [OP_LD_REG]  = &&op_ld_reg,
+        [OP_SCD]     = &&op_scd,     [OP_SCR]     = &&op_scr,
+        [OP_SCL]     = &&op_scl,     [OP_EXIT]    = &&op_exit,
+        [OP_LOW]     = &&op_low,     [OP_HIGH]    = &&op_low
+    };
+    struct decoded_instr *d     = NULL;
+    int                   n     = 0;
+    int                   limit = RAM_SIZE - chip->strict;
+    struct idle_watch     watch;
+
+    ps->err_code    = 0;
+    ps->exit_reason = RUN_BUDGET;
+    ps->idle_period = 0;
+    idle_reset(&watch);
+
+// Fetches the next instruction and jumps to its executer, or leaves the loop
+// when the budget is exhausted or PC is out of the RAM (or its instruction, in
+// strict mode).
+#define DISPATCH()                         \
+    do {                                   \
+        if (n >= budget)                   \
+            goto out;                      \
+        if (chip->pc >= limit)             \
+            goto out_of_ram;               \
+        d         = fetch(chip);           \
+        PROFILE_INSTR(chip, d, chip->pc);  \
+        chip->pc += 2;                     \
+        n++;                               \
+        goto *labels[d->op];               \
+    } while (0)
+
+// Runs the executer of the operation op, then dispatches the next instruction.
+#define EXEC(op)                           \
+    op_##op:                               \
+        exec_##op(chip, d);                \
+        DISPATCH()
+
+// Same as EXEC for an operation that writes the RAM, the stack or the RNG,
+// after which no state is repeated. Leaves the loop if it faults in strict
+// mode.
+#define EXEC_EFFECT(op)                    \
+    op_##op:                               \
+        if (exec_##op(chip, d) < 0)        \
+            goto fault;                    \
+        idle_reset(&watch);                \
+        DISPATCH()
+
+    DISPATCH();
+    EXEC(nop);
+    EXEC_EFFECT(ret);
+    EXEC_EFFECT(call);
+    EXEC(se_kk);
+    EXEC(sne_kk);
+    EXEC(se_xy);
+    EXEC(ld_kk);
+    EXEC(add_kk);
+    EXEC(ld_xy);
+    EXEC(or);
+    EXEC(and);
+    EXEC(xor);
+    EXEC(add_xy);
+    EXEC(sub);
+    EXEC(shr);
+    EXEC(subn);
+    EXEC(shl);
+    EXEC(sne_xy);
+    EXEC(ld_i);
+    EXEC(jp_v0);
+    EXEC_EFFECT(rnd);
+    EXEC(skp);
+    EXEC(sknp);
+    EXEC(ld_x_dt);
+    EXEC(ld_dt);
+    EXEC(add_i);
+    EXEC(ld_f);
+    EXEC_EFFECT(ld_b);
+    EXEC_EFFECT(ld_mem);
+
+ op_ld_reg:
+    if (exec_ld_reg(chip, d) < 0)
+        goto fault;
+    DISPATCH();
+
+    // a backward jump closes a loop, idle if its head is reached twice in the
+    // same state
+ op_jp:
+    if (d->nnn < chip->pc) {
+        exec_jp(chip, d);
+        ps->idle_period = idle_pass(&watch, chip, chip->pc, n);
+        if (ps->idle_period > 0) {
+            ps->exit_reason = RUN_IDLE;
+            goto out;
+        }
+        DISPATCH();
+    }
+    exec_jp(chip, d);
+    DISPATCH();
+#undef EXEC_EFFECT
+#undef EXEC
+#undef DISPATCH
+
+ op_cls:
+    exec_cls(chip, d);
+    ps->exit_reason = RUN_DRAW;
+    goto out;
+ op_drw:
+    if (exec_drw(chip, d) < 0)
+        goto fault;
+    ps->exit_reason = RUN_DRAW;
+    goto out;
+ op_scd:
+    exec_scd(chip, d);
+    ps->exit_reason = RUN_DRAW;
+    goto out;
+ op_scr:
+    exec_scr(chip, d);
+    ps->exit_reason = RUN_DRAW;
+    goto out;
+ op_scl:
+    exec_scl(chip, d);
+    ps->exit_reason = RUN_DRAW;
+    goto out;
+ op_low:
+    exec_low(chip, d);
+    ps->exit_reason = RUN_DRAW;
+    goto out;
+ op_exit:
+    exec_exit(chip, d);
+    ps->exit_reason = RUN_EXIT;
+    goto out;
+ op_ld_st:
+    exec_ld_st(chip, d);
+    ps->exit_reason = RUN_SOUND;
+    goto out;
+ op_ld_key:
+    exec_ld_key(chip, d);
+    if (chip->checking_key_press) {
+        ps->exit_reason = RUN_KEY_WAIT;
+        // once the keys were copied, Fx0A repeats until a key edge
+        if (memcmp(chip->prev_keyboard, chip->keyboard, KEYBOARD_SIZE) == 0)
+            ps->idle_period = 1;
+    }
+    goto out;
+ op_invalid:
+    ps->err_code    = EXEC_ERR;
+    ps->exit_reason = RUN_ERR;
+    goto out;
+ fault:
+    ps->err_code    = take_fault(chip);
+    ps->exit_reason = RUN_ERR;
+    goto out;
+ out_of_ram:
+    ps->curr_instr  = 0;
+    ps->pc          = chip->pc;
+    ps->err_code    = OUT_OF_RAM_ERR;
+    ps->exit_reason = RUN_ERR;
+    return n;
+ out:
+    if (d != NULL)
+        ps->curr_instr = d->instr;
+    ps->pc = chip->pc;
+    return n;
+}
+
+int get_pixel(const struct interpreter *chip, int line, int col) {
+    if (chip->hires)
+        return (chip->vbuf[line * VBUF_WORDS + col / 64] >> (63 - col % 64)) & 1;
+    return (chip->vbuf[line] >> (VBUF_WIDTH - 1 - col)) & 1;
+}
+
+int display_width(const struct interpreter *chip) {
+    return chip->hires ? HIRES_WIDTH : VBUF_WIDTH;
+}
+
+int display_height(const struct interpreter *chip) {
+    return chip->hires ? HIRES_HEIGHT : VBUF_HEIGHT;
+}
+
+// Returns the 32 bits of x spread to the even bits of a word, each one
+// followed by a copy of itself: bit i of x is set at bits 2i and 2i + 1.
+static uint64_t double_bits(uint32_t x) {
+    uint64_t v = x;
+    v = (v | v << 16) & 0x0000ffff0000ffff;
+    v = (v | v << 8)  & 0x00ff00ff00ff00ff;
+    v = (v | v << 4)  & 0x0f0f0f0f0f0f0f0f;
+    v = (v | v << 2)  & 0x3333333333333333;
+    v = (v | v << 1)  & 0x5555555555555555;
+    return v | v << 1;
 }
 
-void handle_sdl_events(bool *done, struct interpreter *chip) {
-    if (done == NULL || chip == NULL)
+void vbuf_to_rows(const struct interpreter *chip,
+        uint64_t rows[HIRES_HEIGHT][VBUF_WORDS]) {
+    if (chip->hires) {
+        memcpy(rows, chip->vbuf, sizeof(chip->vbuf));
         return;
+    }
+    for (int i = 0; i < VBUF_HEIGHT; i++) {
+        uint64_t row = chip->vbuf[i];
+        rows[2 * i][0] = rows[2 * i + 1][0] = double_bits(row >> 32);
+        rows[2 * i][1] = rows[2 * i + 1][1] = double_bits((uint32_t)row);
+    }
+}
 
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-          case SDL_EVENT_QUIT: // window
-            *done = true;
-            break;
-          case SDL_EVENT_KEY_DOWN: // keyboard
-            switch (event.key.key) {
-              case SDLK_1: // "1"
-                chip->keyboard[1] = KEY_DOWN;
-                break;
-              case SDLK_2: // "2"
-                chip->keyboard[2] = KEY_DOWN;
-                break;
-              case SDLK_3: // "3"
-                chip->keyboard[3] = KEY_DOWN;
-                break;
-              case SDLK_4: // "C"
-                chip->keyboard[12] = KEY_DOWN;
-                break;
-              case SDLK_Q: // "4"
-                chip->keyboard[4] = KEY_DOWN;
-                break;
-              case SDLK_W: // "5"
-                chip->keyboard[5] = KEY_DOWN;
-                break;
-              case SDLK_E: // "6"
-                chip->keyboard[6] = KEY_DOWN;
-                break;
-              case SDLK_R: // "D"
-                chip->keyboard[13] = KEY_DOWN;
-                break;
-              case SDLK_A: // "7"
-                chip->keyboard[7] = KEY_DOWN;
-                break;
-              case SDLK_S: // "8"
-                chip->keyboard[8] = KEY_DOWN;
-                break;
-              case SDLK_D: // "9"
-                chip->keyboard[9] = KEY_DOWN;
-                break;
-              case SDLK_F: // "E"
-                chip->keyboard[14] = KEY_DOWN;
-                break;
-              case SDLK_Z: // "A"
-                chip->keyboard[10] = KEY_DOWN;
-                break;
-              case SDLK_X: // "0"
-                chip->keyboard[0] = KEY_DOWN;
-                break;
-              case SDLK_C: // "B"
-                chip->keyboard[11] = KEY_DOWN;
-                break;
-              case SDLK_V: // "F"
-                chip->keyboard[15] = KEY_DOWN;
-                break;
-              default: // ignore other keys
-                break;
-            }
-            break;
-          case SDL_EVENT_KEY_UP: // keyboard
-            switch (event.key.key) {
-              case SDLK_1: // "1"
-                chip->keyboard[1] = KEY_UP;
-                break;
-              case SDLK_2: // "2"
-                chip->keyboard[2] = KEY_UP;
-                break;
-              case SDLK_3: // "3"
-                chip->keyboard[3] = KEY_UP;
-                break;
-              case SDLK_4: // "C"
-                chip->keyboard[12] = KEY_UP;
-                break;
-              case SDLK_Q: // "4"
-                chip->keyboard[4] = KEY_UP;
-                break;
-              case SDLK_W: // "5"
-                chip->keyboard[5] = KEY_UP;
-                break;
-              case SDLK_E: // "6"
-                chip->keyboard[6] = KEY_UP;
-                break;
-              case SDLK_R: // "D"
-                chip->keyboard[13] = KEY_UP;
-                break;
-              case SDLK_A: // "7"
-                chip->keyboard[7] = KEY_UP;
-                break;
-              case SDLK_S: // "8"
-                chip->keyboard[8] = KEY_UP;
-                break;
-              case SDLK_D: // "9"
-                chip->keyboard[9] = KEY_UP;
-                break;
-              case SDLK_F: // "E"
-                chip->keyboard[14] = KEY_UP;
-                break;
-              case SDLK_Z: // "A"
-                chip->keyboard[10] = KEY_UP;
-                break;
-              case SDLK_X: // "0"
-                chip->keyboard[0] = KEY_UP;
-                break;
-              case SDLK_C: // "B"
-                chip->keyboard[11] = KEY_UP;
-                break;
-              case SDLK_V: // "F"
-                chip->keyboard[15] = KEY_UP;
-                break;
-              default: // ignore other keys
-                break;
+void vbuf_to_pixels(const uint64_t rows[HIRES_HEIGHT][VBUF_WORDS],
+        void *pixels, int pitch) {
+    for (int i = 0; i < HIRES_HEIGHT; i++) {
+        uint32_t *line = (uint32_t *)((uint8_t *)pixels + i * pitch);
+        for (int w = 0; w < VBUF_WORDS; w++) {
+            uint64_t row = rows[i][w];
+            for (int j = 0; j < 64; j++) {
+                line[64 * w + j] = (row >> 63) ? PIXEL_ON : PIXEL_OFF;
+                row <<= 1;
             }
-            break;
-          default: // ignore other events
-            break;
         }
     }
 }
+
+uint64_t state_hash(const struct interpreter *chip) {
+    uint64_t h = 0xcbf29ce484222325; // FNV-1a offset basis
+    const struct {
+        const void *data;
+        size_t      size;
+    } parts[] = {
+        {chip->ram, sizeof(chip->ram)},
+        {chip->registers, sizeof(chip->registers)},
+        {&chip->I, sizeof(chip->I)},
+        {&chip->pc, sizeof(chip->pc)},
+        {&chip->sp, sizeof(chip->sp)},
+        {&chip->dt, sizeof(chip->dt)},
+        {&chip->st, sizeof(chip->st)},
+        {chip->stack, sizeof(chip->stack)},
+        {chip->vbuf, chip->hires ? sizeof(chip->vbuf)
+            : VBUF_HEIGHT * sizeof(chip->vbuf[0])}
+    };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        const uint8_t *p = parts[i].data;
+        for (size_t j = 0; j < parts[i].size; j++) {
+            h ^= p[j];
+            h *= 0x100000001b3;     // FNV-1a prime
+        }
+    }
+    return h;
+}
+
+void update_timers(struct interpreter *chip) {
+    if (chip == NULL)
+        return;
+    update_timer(&chip->dt);
+    update_timer(&chip->st);
+    PROFILE_FRAME(chip);
+}
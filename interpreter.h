@@ -4,10 +4,12 @@
 #include <stdlib.h>
 #include <time.h>
 #include <strings.h>
-#include <SDL3/SDL.h>
+#include <stddef.h>
 
 #define RAM_SIZE          4096       // The size in bytes of the ram
 #define PC_INIT           0x0200     // The initial address that PC points to
+#define MAX_ROM_SIZE      3584       // The maximal size in bytes of a ROM
+                                     // (the RAM after PC_INIT)
 #define REGISTERS_SIZE    16         // The size of the registers array
 #define VF                15         // The VF register
 #define LEVELS_SIZE       16         // The size of the execution stack
@@ -17,15 +19,74 @@
 #define KEYBOARD_SIZE     16         // The number of keys of the keyboard
 #define KEY_UP            0          // The value of a key if it is up
 #define KEY_DOWN          255        // The value of a key if is down (pressed)
-#define VBUF_WIDTH        64         // The width of the video buffer
+#define VBUF_WIDTH        64         // The width of the video buffer, in bits
+                                     // of a row (must stay 64)
 #define VBUF_HEIGHT       32         // The height of the video buffer
+#define HIRES_WIDTH       128        // The width of the SUPER-CHIP high
+                                     // resolution display
+#define HIRES_HEIGHT      64         // The height of the high resolution
+                                     // display
+#define VBUF_WORDS        2          // Words of a high resolution row
+#define VBUF_SIZE         (HIRES_HEIGHT * VBUF_WORDS) // Words of the video
+                                                      // buffer
+#define SCROLL_STEP       4          // Pixels scrolled by 00FB and 00FC
 #define PIXEL_ON          0xffffffff // The value of a pixel on
 #define PIXEL_OFF         0          // The value of a pixel off
 #define NNN_MASK          0x0fff     // Mask of nnn/addr value in an instruction
+#define ADDR_MASK         0x0fff     // Mask of a RAM address: the accesses
+                                     // through I wrap around the RAM
+#define SP_MASK           (LEVELS_SIZE - 1) // Mask of the stack pointer
 #define N_MASK            0x000f     // Mask of n/nibble value in an instruction
 #define X_MASK            0x0f00     // Mask of x value in an instruction
 #define Y_MASK            0x00f0     // Mask of y value in an instruction
 #define KK_MASK           0x00ff     // Mask of kk/byte value in an instruction
+#define TIMERS_FREQ       60         // The frequency in Hz of dt and st
+#define DEFAULT_IPF       10         // Default instructions per 60 Hz frame
+#define OUT_OF_RAM_ERR    1          // Error code: PC points beyond the RAM
+#define EXEC_ERR          2          // Error code: decoder/executer failed
+#define RAM_ERR           3          // Error code: access through I beyond
+                                     // the RAM (strict mode)
+#define OVERFLOW_ERR      4          // Error code: 2nnn on a full stack
+                                     // (strict mode)
+#define UNDERFLOW_ERR     5          // Error code: 00EE on an empty stack
+                                     // (strict mode)
+#define FAULT_RAM         0x01       // Fault: access through I beyond the RAM
+#define FAULT_OVERFLOW    0x10       // Fault: stack overflow, bit 4 of sp + 1
+#define FAULT_UNDERFLOW   0x20       // Fault: stack underflow, bit 5 of sp - 1
+#define RUN_BUDGET        0          // Exit reason: budget exhausted
+#define RUN_ERR           1          // Exit reason: processor error
+#define RUN_DRAW          2          // Exit reason: display updated
+#define RUN_KEY_WAIT      3          // Exit reason: waiting for a key (Fx0A)
+#define RUN_IDLE          4          // Exit reason: spinning in an idle loop
+#define RUN_SOUND         5          // Exit reason: sound timer set (Fx18)
+#define RUN_EXIT          6          // Exit reason: the ROM exited (00FD)
+
+// Operations of the decoded instructions
+enum {
+    OP_NOP, OP_INVALID, OP_CLS, OP_RET, OP_JP, OP_CALL, OP_SE_KK, OP_SNE_KK,
+    OP_SE_XY, OP_LD_KK, OP_ADD_KK, OP_LD_XY, OP_OR, OP_AND, OP_XOR, OP_ADD_XY,
+    OP_SUB, OP_SHR, OP_SUBN, OP_SHL, OP_SNE_XY, OP_LD_I, OP_JP_V0, OP_RND,
+    OP_DRW, OP_SKP, OP_SKNP, OP_LD_X_DT, OP_LD_KEY, OP_LD_DT, OP_LD_ST,
+    OP_ADD_I, OP_LD_F, OP_LD_B, OP_LD_MEM, OP_LD_REG, OP_SCD, OP_SCR, OP_SCL,
+    OP_EXIT, OP_LOW, OP_HIGH, OP_COUNT
+};
+
+struct interpreter;
+struct decoded_instr;
+
+// Executer of a decoded instruction, returns 0 on success, -1 otherwise
+typedef int (*instr_handler)(struct interpreter *chip,
+        const struct decoded_instr *d);
+
+struct decoded_instr {
+    instr_handler handler;  // executer of the instruction, NULL if not decoded
+    uint16_t      instr;    // raw instruction
+    uint16_t      nnn;      // nnn/addr value
+    uint8_t       op;       // operation number (OP_*)
+    uint8_t       x;        // x value
+    uint8_t       y;        // y value
+    uint8_t       kk;       // kk/byte value
+};
 
 struct interpreter {
     uint8_t  ram[RAM_SIZE];                  // 4Kb memory space
@@ -36,37 +97,107 @@ struct interpreter {
     uint8_t  dt;                             // delay timer
     uint8_t  st;                             // sound timer
     uint16_t stack[LEVELS_SIZE];             // execution stack
-    uint32_t vbuf[VBUF_HEIGHT * VBUF_WIDTH]; // video buffer
+    uint64_t vbuf[VBUF_SIZE];                // video buffer, a bit per pixel,
+                                             // column 0 is the MSB of a row:
+                                             // VBUF_HEIGHT rows of a word in
+                                             // low resolution, HIRES_HEIGHT
+                                             // rows of VBUF_WORDS words in
+                                             // high resolution
+    uint8_t  hires;                          // 1 in high resolution mode
+    uint8_t  exited;                         // 1 once 00FD was executed
     uint8_t  keyboard[KEYBOARD_SIZE];        // current state of keyboard
     uint8_t  prev_keyboard[KEYBOARD_SIZE];   // previous state of keyboard
     uint8_t  checking_key_press;             // flag for key press check
     uint8_t  update_display;                 // update display flag
+    uint8_t  fault;                          // FAULT_* bits of the faulty
+                                             // accesses not reported yet
+    uint8_t  strict;                         // 1 to report the faults as
+                                             // errors, see run_rom_cycle
+    uint64_t rng;                            // random generator state (Cxkk)
+    struct decoded_instr dcache[RAM_SIZE];   // predecoded instructions by addr
+    uint64_t written;                        // a bit per 64 bytes of RAM, set
+                                             // when Fx33 or Fx55 writes them
+                                             // or a ROM is loaded over them
+                                             // (all set by init), cleared by
+                                             // the caller
+    struct trace        *trace;              // trace of the debug mode, or NULL
+#ifdef CHIP8_PROFILE
+    struct profile *prof;                    // execution profile, or NULL
+#endif
 };
 
 struct proc_state {
     uint16_t curr_instr;        // current instruction
     uint16_t pc;                // value of interpreter program counter
     uint8_t  err_code;          // error code
+    uint8_t  exit_reason;       // why run_rom_cycles returned (RUN_*)
+    uint16_t idle_period;       // instructions per iteration of the idle loop
+                                // run_rom_cycles stopped in, 0 if none
 };
 
 /*
  * Initializes chip8 interpreter memory.
  * All registers and ram are zero'ed, PC is set to its initial value and
  * characters sprites are loaded at 0x0050 (up to 0x00A0, 80 bytes in total).
- * A seed is also provided to the random number generator.
+ * The random number generator of chip is seeded with the current time.
  */
 void init(struct interpreter *chip);
 
 /*
- * Loads the ROM file denoted by filename into the given chip. Returns 0 on
- * success, -1 otherwise.
+ * Seeds the random number generator of chip, used by Cxkk. Each interpreter
+ * has its own generator, two interpreters seeded alike draw the same numbers.
+ */
+void seed_rng(struct interpreter *chip, uint64_t seed);
+
+/*
+ * Sets chip in strict mode if strict is non-zero, see run_rom_cycle. The
+ * faults recorded before strict mode is turned on are dropped, so that only
+ * the ones of the instructions run in strict mode are reported.
+ */
+void set_strict(struct interpreter *chip, int strict);
+
+/*
+ * Reads the ROM file denoted by filename into buf, which must hold
+ * MAX_ROM_SIZE bytes, after checking that it is a regular file of a valid
+ * size. Returns the size of the ROM, -1 on failure (an error message is
+ * printed).
+ */
+int read_rom(const char *filename, uint8_t *buf);
+
+/*
+ * Loads the ROM file denoted by filename into the given chip, dropping the
+ * faults recorded before. Returns 0 on success, -1 otherwise.
  */
 int load_rom(char *filename, struct interpreter *chip);
 
+/*
+ * Loads the size bytes of rom into the given chip at PC, as load_rom does
+ * without the file. Returns 0 on success, -1 if size is not between 1 and
+ * MAX_ROM_SIZE.
+ */
+int load_rom_buffer(const uint8_t *rom, size_t size, struct interpreter *chip);
+
+/*
+ * Decodes instr into d: extracts its operands and selects its operation and
+ * executer.
+ */
+void decode_instr(uint16_t instr, struct decoded_instr *d);
+
+/*
+ * Returns the mnemonic of the operation op (OP_*), e.g. "DRW".
+ */
+const char *op_name(int op);
+
+/*
+ * Invalidates all the predecoded instructions of chip. Must be called after
+ * writing to chip->ram from outside of the interpreter.
+ */
+void flush_dcache(struct interpreter *chip);
+
 /*
  * Decodes the given instruction and executes it. On success, returns 0, -1
- * otherwise. If mode is debug (mode != 0), prints to stdout what the
- * decoder/executer is doing.
+ * otherwise. If mode is debug (mode != 0), records the instruction to
+ * chip->trace as located at chip->pc - 2, see trace.h.
  */
 int dec_exec(const uint16_t instr, struct interpreter *chip, int mode);
 
@@ -74,13 +205,89 @@ int dec_exec(const uint16_t instr, struct interpreter *chip, int mode);
  * Runs one cycle of the ROM loaded in chip. Populates ps with appropriate
  * values about the cycle termination state. Chip and ps must be previously
  * initialized. If mode is 0, runs the cycle normally, otherwise runs it in
- * debug mode (prints to standard output information about the cycle).
+ * debug mode (records the executed instruction to chip->trace).
+ * Instructions are decoded the first time they are met and kept decoded in
+ * chip->dcache until the RAM they are read from is written to.
+ * Timers are left untouched, see update_timers. Once the ROM exits (00FD),
+ * chip->exited is set and PC stays on the exit instruction.
+ * Accesses through I wrap around the RAM (ADDR_MASK) and the stack pointer
+ * wraps around the stack (SP_MASK), so that no instruction reads or writes
+ * outside of chip. Such accesses are recorded to chip->fault without
+ * branching. If chip->strict is set, they are reported once the instruction
+ * is executed as RAM_ERR, OVERFLOW_ERR or UNDERFLOW_ERR, and an
+ * instruction whose second byte is beyond the RAM as OUT_OF_RAM_ERR.
  */
 void run_rom_cycle(struct interpreter *chip, struct proc_state *ps, int mode);
 
 /*
- * Handles window and keyboard events, and udpates done and chip accordingly.
+ * Returns the error code of the faults recorded to chip->fault, 0 if there is
+ * none, and clears them. Engines running instructions outside of
+ * run_rom_cycle report the faults with it in strict mode.
+ */
+int take_fault(struct interpreter *chip);
+
+/*
+ * Runs at most budget cycles of the ROM loaded in chip in a single dispatch
+ * loop, without debug mode. The loop is left early after an instruction that
+ * updates the display (00E0, Dxyn, 00Cn, 00FB, 00FC, 00FE, 00FF), after 00FD
+ * (RUN_EXIT), after Fx0A if no key was released, after Fx18 so that the sound
+ * starts on time (RUN_SOUND), on error, or when a loop
+ * closed by a backward jump comes back to the same registers without touching
+ * the rest of the machine (RUN_IDLE). Populates ps with the last instruction,
+ * PC, error code and the exit reason (RUN_*). If the processor spins without
+ * changing state, until the next timer tick or key edge, ps->idle_period is
+ * the number of instructions it takes to come back to the current state: any
+ * multiple of it may be skipped. Returns the number of executed instructions.
+ * Chip and ps must be previously initialized. Timers are left untouched, see
+ * update_timers. Faults are handled as by run_rom_cycle, which remains the
+ * reference implementation.
+ */
+int run_rom_cycles(struct interpreter *chip, struct proc_state *ps,
+        int budget);
+
+/*
+ * Returns 1 if the pixel of chip at the given line and column is on, 0
+ * otherwise. Lines and columns are those of the current resolution, see
+ * display_width and display_height.
+ */
+int get_pixel(const struct interpreter *chip, int line, int col);
+
+/*
+ * Returns the width and height of the current resolution of chip: VBUF_WIDTH
+ * and VBUF_HEIGHT, or HIRES_WIDTH and HIRES_HEIGHT in high resolution.
+ */
+int display_width(const struct interpreter *chip);
+int display_height(const struct interpreter *chip);
+
+/*
+ * Copies the video buffer of chip to rows, HIRES_HEIGHT rows of VBUF_WORDS
+ * words, at the high resolution whatever the mode: in low resolution, every
+ * pixel is doubled in both directions. Presenters and frame streams work on
+ * such rows, so that a change of resolution changes nothing for them.
+ */
+void vbuf_to_rows(const struct interpreter *chip,
+        uint64_t rows[HIRES_HEIGHT][VBUF_WORDS]);
+
+/*
+ * Expands rows, as filled by vbuf_to_rows, to HIRES_HEIGHT rows of
+ * HIRES_WIDTH 32-bit pixels, each being PIXEL_ON or PIXEL_OFF, rows starting
+ * every pitch bytes from pixels. Meant for presentation only.
+ */
+void vbuf_to_pixels(const uint64_t rows[HIRES_HEIGHT][VBUF_WORDS],
+        void *pixels, int pitch);
+
+/*
+ * Returns a 64-bit FNV-1a hash of the machine state of chip: RAM, registers,
+ * timers, stack and video buffer (its VBUF_HEIGHT first words in low
+ * resolution). Two runs ending in the same state have the same hash.
+ */
+uint64_t state_hash(const struct interpreter *chip);
+
+/*
+ * Decrements the delay and sound timers of chip if they are strictly positive.
+ * Must be called at TIMERS_FREQ, independently of the number of instructions
+ * run in between.
  */
-void handle_sdl_events(bool *done, struct interpreter *chip);
+void update_timers(struct interpreter *chip);
 
 #endif
@@ -0,0 +1,658 @@
+#include "jit.h"
+#include "idle.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+#define ARENA_SIZE     (1 << 22) // Size in bytes of the executable arena
+#define MAX_BLOCK_LEN  64        // Maximal number of instructions in a block
+#define MAX_INSTR_CODE 128       // Maximal size in bytes of a translation
+#define MAX_BLOCK_CODE ((MAX_BLOCK_LEN + 1) * MAX_INSTR_CODE)
+#define BLOCK_NONE     0         // No block was compiled at the address yet
+#define BLOCK_CODE     1         // A block was compiled at the address
+#define BLOCK_INTERP   2         // The address starts a run of instructions
+                                 // left to the interpreter
+
+// Machine code of a block, updates chip as the interpreter would do, running
+// at most left instructions. Returns the number of instructions still left
+// shifted by 16, ORed with the last instruction run, in 64 bits so that any
+// budget fits.
+typedef uint64_t (*block_code)(struct interpreter *chip, int left);
+
+struct jit_block {
+    block_code code;       // entry point of the block machine code
+    uint8_t    count;      // number of instructions in the block or run
+    uint8_t    state;      // BLOCK_NONE, BLOCK_CODE or BLOCK_INTERP
+    uint8_t    write_len;  // bytes from I the run may write (Fx33, Fx55)
+    uint8_t    resets;     // 1 if the run resets the idle watch
+    uint8_t    stops;      // 1 if the run ends the batch (draws, key waits,
+                           // sound, exits)
+};
+
+struct jit {
+    uint8_t          *arena;             // executable memory
+    size_t            used;              // bytes of arena in use
+    struct jit_block  blocks[RAM_SIZE];  // blocks by start address
+    uint8_t           covered[RAM_SIZE]; // 1 if the byte was compiled
+};
+
+#if defined(__x86_64__)
+
+// x86-64 registers used by the translations. The interpreter pointer stays in
+// rdi (first argument), the CHIP-8 registers are addressed relative to it. The
+// number of instructions left to run stays in esi (second argument).
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RSI 6
+#define RDI 7
+
+#define OFF_V(x)  ((int32_t)(offsetof(struct interpreter, registers) + (x)))
+#define OFF_I     ((int32_t)offsetof(struct interpreter, I))
+#define OFF_PC    ((int32_t)offsetof(struct interpreter, pc))
+#define OFF_DT    ((int32_t)offsetof(struct interpreter, dt))
+#define OFF_ST    ((int32_t)offsetof(struct interpreter, st))
+#define OFF_SP    ((int32_t)offsetof(struct interpreter, sp))
+#define OFF_STACK ((int32_t)offsetof(struct interpreter, stack))
+#define OFF_KEYS  ((int32_t)offsetof(struct interpreter, keyboard))
+#define OFF_FAULT ((int32_t)offsetof(struct interpreter, fault))
+
+static void emit8(uint8_t **p, uint8_t b) {
+    *(*p)++ = b;
+}
+
+static void emit16(uint8_t **p, uint16_t w) {
+    emit8(p, w & 0xff);
+    emit8(p, w >> 8);
+}
+
+static void emit32(uint8_t **p, uint32_t d) {
+    for (int i = 0; i < 4; i++)
+        emit8(p, (d >> (8 * i)) & 0xff);
+}
+
+// Emits the ModRM byte and displacement of the operand [rdi + disp], with reg
+// as the register (or opcode extension) field.
+static void emit_mem(uint8_t **p, int reg, int32_t disp) {
+    if (disp >= -128 && disp <= 127) {
+        emit8(p, 0x40 | reg << 3 | RDI);
+        emit8(p, (uint8_t)disp);
+    } else {
+        emit8(p, 0x80 | reg << 3 | RDI);
+        emit32(p, (uint32_t)disp);
+    }
+}
+
+// Emits "op [rdi + disp], reg" or "op reg, [rdi + disp]" for the one byte
+// opcode op.
+static void emit_op_mem(uint8_t **p, uint8_t op, int reg, int32_t disp) {
+    emit8(p, op);
+    emit_mem(p, reg, disp);
+}
+
+// Emits "op byte [rdi + disp], imm" for the 0x80 group (ext selects the
+// operation: 0 add, 5 sub, 7 cmp).
+static void emit_grp1_imm8(uint8_t **p, int ext, int32_t disp, uint8_t imm) {
+    emit8(p, 0x80);
+    emit_mem(p, ext, disp);
+    emit8(p, imm);
+}
+
+// Emits "movzx reg, byte [rdi + disp]".
+static void emit_movzx(uint8_t **p, int reg, int32_t disp) {
+    emit8(p, 0x0f);
+    emit8(p, 0xb6);
+    emit_mem(p, reg, disp);
+}
+
+// Emits "setcc cl" then "mov [rdi + disp], cl".
+static void emit_set_flag(uint8_t **p, uint8_t setcc, int32_t disp) {
+    emit8(p, 0x0f);
+    emit8(p, setcc);
+    emit8(p, 0xc0 | RCX);
+    emit_op_mem(p, 0x88, RCX, disp);
+}
+
+// Emits "mov word [rdi + disp], imm".
+static void emit_store_imm16(uint8_t **p, int32_t disp, uint16_t imm) {
+    emit8(p, 0x66);
+    emit8(p, 0xc7);
+    emit_mem(p, 0, disp);
+    emit16(p, imm);
+}
+
+// Emits the return of a block whose last instruction run is last, see
+// block_code.
+static void emit_ret(uint8_t **p, uint16_t last) {
+    emit8(p, 0x89);                       // mov eax, esi
+    emit8(p, 0xc0 | RSI << 3 | RAX);
+    emit8(p, 0x48);                       // shl rax, 16
+    emit8(p, 0xc1);
+    emit8(p, 0xc0 | 4 << 3 | RAX);
+    emit8(p, 16);
+    emit8(p, 0x48);                       // or rax, last
+    emit8(p, 0x0d);
+    emit32(p, last);
+    emit8(p, 0xc3);                       // ret
+}
+
+// Emits the exit of a block that jumps to addr, last being the last
+// instruction run.
+static void emit_exit(uint8_t **p, uint16_t addr, uint16_t last) {
+    emit_store_imm16(p, OFF_PC, addr);
+    emit_ret(p, last);
+}
+
+// Emits the exit taken before the instruction at addr once no instruction is
+// left to run, prev being the instruction run before it.
+static void emit_budget_exit(uint8_t **p, uint16_t addr, uint16_t prev) {
+    emit8(p, 0x85);                       // test esi, esi
+    emit8(p, 0xc0 | RSI << 3 | RSI);
+    emit8(p, 0x75);                       // jnz over the exit
+    uint8_t *rel = (*p)++;
+    emit_store_imm16(p, OFF_PC, addr);
+    emit8(p, 0xb8 | RAX);                 // mov eax, prev
+    emit32(p, prev);
+    emit8(p, 0xc3);                       // ret
+    *rel = *p - rel - 1;
+}
+
+// Emits "dec esi", counting an instruction as run.
+static void emit_count(uint8_t **p) {
+    emit8(p, 0xff);
+    emit8(p, 0xc0 | 1 << 3 | RSI);
+}
+
+// Emits the exit of the skip instruction instr at addr, the flags being set
+// by the preceding comparison: PC is addr + 4 if cmov is taken, addr + 2
+// otherwise. If taken is not NULL, the skip jumps over the next instruction
+// of the block instead: a "jcc" is emitted and *taken is set to its 32-bit
+// displacement, to be patched.
+static void emit_skip(uint8_t **p, uint8_t cmov, uint16_t addr, uint16_t instr,
+        uint8_t **taken) {
+    if (taken != NULL) {
+        emit8(p, 0x0f);                   // jcc rel32, cmovcc + 0x40
+        emit8(p, cmov + 0x40);
+        *taken = *p;
+        emit32(p, 0);
+        return;
+    }
+    emit8(p, 0xb8 | RAX);                 // mov eax, addr + 2
+    emit32(p, addr + 2);
+    emit8(p, 0xb8 | RCX);                 // mov ecx, addr + 4
+    emit32(p, addr + 4);
+    emit8(p, 0x0f);                       // cmovcc eax, ecx
+    emit8(p, cmov);
+    emit8(p, 0xc0 | RAX << 3 | RCX);
+    emit8(p, 0x66);                       // mov [pc], ax
+    emit_op_mem(p, 0x89, RAX, OFF_PC);
+    emit_ret(p, instr);
+}
+
+// Emits the ModRM, SIB and displacement of the operand [rdi + rax * 2 +
+// stack], the stack entry indexed by eax, with reg as the register field.
+static void emit_stack_entry(uint8_t **p, int reg) {
+    emit8(p, 0x80 | reg << 3 | 4);
+    emit8(p, 1 << 6 | RAX << 3 | RDI);
+    emit32(p, (uint32_t)OFF_STACK);
+}
+
+// Emits the update of the stack pointer loaded in eax: "add eax, 1" (ext 0)
+// or "sub eax, 1" (ext 5), the fault bit of the result ORed into the faults,
+// then the result wrapped with SP_MASK stored back to sp and left in eax.
+static void emit_stack_step(uint8_t **p, int ext, uint8_t fault) {
+    emit8(p, 0x83);                       // add/sub eax, 1
+    emit8(p, 0xc0 | ext << 3 | RAX);
+    emit8(p, 1);
+    emit8(p, 0x89);                       // mov edx, eax
+    emit8(p, 0xc0 | RAX << 3 | RDX);
+    emit8(p, 0x83);                       // and edx, fault
+    emit8(p, 0xc0 | 4 << 3 | RDX);
+    emit8(p, fault);
+    emit_op_mem(p, 0x08, RDX, OFF_FAULT); // or [fault], dl
+    emit8(p, 0x83);                       // and eax, SP_MASK
+    emit8(p, 0xc0 | 4 << 3 | RAX);
+    emit8(p, SP_MASK);
+    emit_op_mem(p, 0x88, RAX, OFF_SP);    // mov [sp], al
+}
+
+// Translates the instruction d located at addr. Returns 1 if it ends the
+// block (the exit is emitted), 0 if the block goes on, -1 if it can not be
+// translated (nothing is emitted). A skip jumps over the next instruction if
+// taken is not NULL, see emit_skip.
+static int translate(uint8_t **p, const struct decoded_instr *d,
+        uint16_t addr, uint8_t **taken) {
+    uint8_t x = d->x;
+    uint8_t y = d->y;
+    switch (d->op) {
+      case OP_NOP:
+        return 0;
+      case OP_LD_KK:
+        emit8(p, 0xc6);
+        emit_mem(p, 0, OFF_V(x));
+        emit8(p, d->kk);
+        return 0;
+      case OP_ADD_KK:
+        emit_grp1_imm8(p, 0, OFF_V(x), d->kk);
+        return 0;
+      case OP_LD_XY:
+        emit_op_mem(p, 0x8a, RAX, OFF_V(y));
+        emit_op_mem(p, 0x88, RAX, OFF_V(x));
+        return 0;
+      case OP_OR:
+      case OP_AND:
+      case OP_XOR:
+        emit_op_mem(p, 0x8a, RAX, OFF_V(y));
+        emit_op_mem(p, d->op == OP_OR ? 0x08 : d->op == OP_AND ? 0x20 : 0x30,
+                RAX, OFF_V(x));
+        return 0;
+      case OP_ADD_XY: // Vx += Vy, VF = Vx < Vy
+        emit_op_mem(p, 0x8a, RAX, OFF_V(x));
+        emit_op_mem(p, 0x02, RAX, OFF_V(y));
+        emit_op_mem(p, 0x88, RAX, OFF_V(x));
+        emit_op_mem(p, 0x3a, RAX, OFF_V(y));
+        emit_set_flag(p, 0x92, OFF_V(VF)); // setb
+        return 0;
+      case OP_SUB:    // VF = Vx > Vy, Vx = Vx - Vy
+      case OP_SUBN:   // VF = Vy > Vx, Vx = Vy - Vx
+        if (d->op == OP_SUBN) {
+            uint8_t tmp = x;
+            x = y;
+            y = tmp;
+        }
+        emit_op_mem(p, 0x8a, RAX, OFF_V(x));
+        emit_op_mem(p, 0x3a, RAX, OFF_V(y));
+        emit_set_flag(p, 0x97, OFF_V(VF)); // seta
+        emit_op_mem(p, 0x8a, RAX, OFF_V(x));
+        emit_op_mem(p, 0x2a, RAX, OFF_V(y));
+        emit_op_mem(p, 0x88, RAX, OFF_V(d->x));
+        return 0;
+      case OP_SHR:    // VF = Vx & 1, Vx /= 2
+        emit_op_mem(p, 0x8a, RAX, OFF_V(x));
+        emit8(p, 0x24);                   // and al, 1
+        emit8(p, 1);
+        emit_op_mem(p, 0x88, RAX, OFF_V(VF));
+        emit_op_mem(p, 0xd0, 5, OFF_V(x));
+        return 0;
+      case OP_SHL:    // VF = 0 (see exec_shl), Vx *= 2
+        emit8(p, 0xc6);
+        emit_mem(p, 0, OFF_V(VF));
+        emit8(p, 0);
+        emit_op_mem(p, 0xd0, 4, OFF_V(x));
+        return 0;
+      case OP_LD_I:
+        emit_store_imm16(p, OFF_I, d->nnn);
+        return 0;
+      case OP_ADD_I:
+        emit_movzx(p, RAX, OFF_V(x));
+        emit8(p, 0x66);                   // add [I], ax
+        emit_op_mem(p, 0x01, RAX, OFF_I);
+        return 0;
+      case OP_LD_F:
+        emit_movzx(p, RAX, OFF_V(x));
+        emit8(p, 0x8d);                   // lea eax, [rax + rax * 4 + addr]
+        emit8(p, 0x44);
+        emit8(p, 0x80);
+        emit8(p, CHAR_SPRITES_ADDR);
+        emit8(p, 0x66);                   // mov [I], ax
+        emit_op_mem(p, 0x89, RAX, OFF_I);
+        return 0;
+      case OP_LD_X_DT:
+        emit_op_mem(p, 0x8a, RAX, OFF_DT);
+        emit_op_mem(p, 0x88, RAX, OFF_V(x));
+        return 0;
+      case OP_LD_DT:
+        emit_op_mem(p, 0x8a, RAX, OFF_V(x));
+        emit_op_mem(p, 0x88, RAX, OFF_DT);
+        return 0;
+      case OP_JP:
+        emit_exit(p, d->nnn, d->instr);
+        return 1;
+      case OP_JP_V0:
+        emit_movzx(p, RAX, OFF_V(0));
+        emit8(p, 0x05);                   // add eax, nnn
+        emit32(p, d->nnn);
+        emit8(p, 0x66);                   // mov [pc], ax
+        emit_op_mem(p, 0x89, RAX, OFF_PC);
+        emit_ret(p, d->instr);
+        return 1;
+      case OP_CALL:   // sp++, stack[sp] = addr + 2, pc = nnn, see exec_call
+        emit_movzx(p, RAX, OFF_SP);
+        emit_stack_step(p, 0, FAULT_OVERFLOW);
+        emit8(p, 0x66);                   // mov word [stack + sp * 2], imm
+        emit8(p, 0xc7);
+        emit_stack_entry(p, 0);
+        emit16(p, addr + 2);
+        emit_exit(p, d->nnn, d->instr);
+        return 1;
+      case OP_RET:    // pc = stack[sp], sp--, see exec_ret
+        emit_movzx(p, RAX, OFF_SP);
+        emit8(p, 0x0f);                   // movzx ecx, word [stack + sp * 2]
+        emit8(p, 0xb7);
+        emit_stack_entry(p, RCX);
+        emit8(p, 0x66);                   // mov [pc], cx
+        emit_op_mem(p, 0x89, RCX, OFF_PC);
+        emit_stack_step(p, 5, FAULT_UNDERFLOW);
+        emit_ret(p, d->instr);
+        return 1;
+      case OP_SE_KK:
+      case OP_SNE_KK:
+        emit_grp1_imm8(p, 7, OFF_V(x), d->kk);
+        emit_skip(p, d->op == OP_SE_KK ? 0x44 : 0x45, addr, d->instr, taken);
+        return taken == NULL;
+      case OP_SE_XY:
+      case OP_SNE_XY:
+        emit_op_mem(p, 0x8a, RDX, OFF_V(x));
+        emit_op_mem(p, 0x3a, RDX, OFF_V(y));
+        emit_skip(p, d->op == OP_SE_XY ? 0x44 : 0x45, addr, d->instr, taken);
+        return taken == NULL;
+      case OP_SKP:
+      case OP_SKNP:
+        // the key is selected by x itself, as in exec_skp and exec_sknp
+        emit_grp1_imm8(p, 7, OFF_KEYS + x, d->op == OP_SKP ? KEY_DOWN : KEY_UP);
+        emit_skip(p, 0x44, addr, d->instr, taken);
+        return taken == NULL;
+      default: // draws, key waits, sound, memory and random accesses
+        return -1;
+    }
+}
+
+// Returns 1 if the operation op always ends the batch of run_rom_cycles:
+// draws, scrolls and resolution changes, exits, key waits and sound.
+static int ends_batch(int op) {
+    switch (op) {
+      case OP_CLS:
+      case OP_DRW:
+      case OP_LD_KEY:
+      case OP_LD_ST:
+      case OP_SCD:
+      case OP_SCR:
+      case OP_SCL:
+      case OP_EXIT:
+      case OP_LOW:
+      case OP_HIGH:
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+// Records the instructions from start in the RAM of chip that can not be
+// translated as a run left to the interpreter, up to the first one ending the
+// batch. None of them jumps or changes I, so that the run is straight and
+// writes at most write_len bytes from I.
+static void mark_interp(struct jit *jit, const struct interpreter *chip,
+        uint16_t start) {
+    struct jit_block     *b    = &jit->blocks[start];
+    uint16_t              addr = start;
+    uint8_t               scratch[MAX_INSTR_CODE];
+    struct decoded_instr  d;
+    b->state     = BLOCK_INTERP;
+    b->count     = 0;
+    b->write_len = 0;
+    b->resets    = 0;
+    b->stops     = 0;
+    while (!b->stops && b->count < MAX_BLOCK_LEN && addr + 1 < RAM_SIZE) {
+        uint8_t *p = scratch;
+        decode_instr((uint16_t)chip->ram[addr] << 8 | chip->ram[addr + 1], &d);
+        if (translate(&p, &d, addr, NULL) >= 0)
+            break;
+        if (d.op == OP_LD_B && b->write_len < 3)
+            b->write_len = 3;
+        else if (d.op == OP_LD_MEM && b->write_len < d.x + 1)
+            b->write_len = d.x + 1;
+        if (d.op == OP_LD_B || d.op == OP_LD_MEM || d.op == OP_RND)
+            b->resets = 1;
+        b->stops = ends_batch(d.op);
+        jit->covered[addr]     = 1;
+        jit->covered[addr + 1] = 1;
+        b->count++;
+        addr += 2;
+    }
+}
+
+// Returns 1 if the instruction at addr in the RAM of chip can be translated.
+static int translatable(const struct interpreter *chip, uint16_t addr) {
+    uint8_t              scratch[MAX_INSTR_CODE];
+    uint8_t             *p = scratch;
+    struct decoded_instr d;
+    if (addr + 1 >= RAM_SIZE)
+        return 0;
+    decode_instr((uint16_t)chip->ram[addr] << 8 | chip->ram[addr + 1], &d);
+    return translate(&p, &d, addr, NULL) >= 0;
+}
+
+// Returns 1 if d is a skip.
+static int is_skip(const struct decoded_instr *d) {
+    return d->op == OP_SE_KK || d->op == OP_SNE_KK || d->op == OP_SE_XY
+        || d->op == OP_SNE_XY || d->op == OP_SKP || d->op == OP_SKNP;
+}
+
+// A skip taken over the next instruction of a block, whose landing is
+// emitted after the block
+struct landing {
+    uint8_t *taken; // displacement of the jcc of the skip
+    uint8_t *code;  // code of the instruction the skip lands on
+    uint16_t addr;  // address of that instruction
+    uint16_t skip;  // skip instruction
+};
+
+// Compiles the block starting at start in the RAM of chip. Every instruction
+// but the first one is preceded by a budget check. A skip followed by two
+// translatable instructions jumps over the first one instead of ending the
+// block, its taken path being checked out of line, see struct landing.
+static void compile(struct jit *jit, const struct interpreter *chip,
+        uint16_t start) {
+    if (jit->used + MAX_BLOCK_CODE > ARENA_SIZE)
+        jit_flush(jit);
+
+    struct jit_block     *b         = &jit->blocks[start];
+    uint8_t              *entry     = jit->arena + jit->used;
+    uint8_t              *p         = entry;
+    uint16_t              addr      = start;
+    uint16_t              prev      = 0;
+    int                   ended     = 0;
+    struct landing        landings[MAX_BLOCK_LEN];
+    int                   nlandings = 0;
+    int                   land_addr = -1; // landing of the pending skip
+    struct decoded_instr  d;
+    b->count = 0;
+    while ((!ended || addr == land_addr) && b->count < MAX_BLOCK_LEN
+            && addr + 1 < RAM_SIZE) {
+        decode_instr((uint16_t)chip->ram[addr] << 8 | chip->ram[addr + 1], &d);
+        uint8_t *mark = p;
+        if (b->count > 0)
+            emit_budget_exit(&p, addr, prev);
+        if (addr == land_addr) {
+            landings[nlandings].code = p;
+            landings[nlandings].addr = addr;
+            nlandings++;
+            land_addr = -1;
+        }
+
+        // the instruction skipped over is not a skip jumping itself
+        uint8_t *taken = NULL;
+        int      over  = is_skip(&d) && land_addr < 0
+            && b->count + 3 <= MAX_BLOCK_LEN && translatable(chip, addr + 2)
+            && translatable(chip, addr + 4);
+        emit_count(&p);
+        ended = translate(&p, &d, addr, over ? &taken : NULL);
+        if (ended < 0) {
+            p = mark;
+            break;
+        }
+        if (over) {
+            landings[nlandings].taken = taken;
+            landings[nlandings].skip  = d.instr;
+            land_addr                 = addr + 4;
+        }
+        jit->covered[addr]     = 1;
+        jit->covered[addr + 1] = 1;
+        b->count++;
+        prev = d.instr;
+        addr += 2;
+    }
+
+    if (b->count == 0) {
+        mark_interp(jit, chip, start);
+        return;
+    }
+    if (ended <= 0)
+        emit_exit(&p, addr, prev);
+    // a taken skip lands on its instruction if there is some left to run
+    for (int i = 0; i < nlandings; i++) {
+        struct landing *l   = &landings[i];
+        uint32_t        rel = (uint32_t)(p - (l->taken + 4));
+        memcpy(l->taken, &rel, sizeof(rel));
+        emit8(&p, 0x85);                  // test esi, esi
+        emit8(&p, 0xc0 | RSI << 3 | RSI);
+        emit8(&p, 0x0f);                  // jnz code
+        emit8(&p, 0x85);
+        emit32(&p, (uint32_t)(l->code - (p + 4)));
+        emit_store_imm16(&p, OFF_PC, l->addr);
+        emit8(&p, 0xb8 | RAX);            // mov eax, skip
+        emit32(&p, l->skip);
+        emit8(&p, 0xc3);                  // ret
+    }
+    b->code   = (block_code)entry;
+    b->state  = BLOCK_CODE;
+    jit->used = p - jit->arena;
+}
+
+struct jit *jit_create(void) {
+    struct jit *jit = malloc(sizeof(struct jit));
+    if (jit == NULL)
+        return NULL;
+    jit->arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->arena == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit_flush(jit);
+    return jit;
+}
+
+void jit_destroy(struct jit *jit) {
+    if (jit == NULL)
+        return;
+    munmap(jit->arena, ARENA_SIZE);
+    free(jit);
+}
+
+#else
+
+struct jit *jit_create(void) {
+    return NULL;
+}
+
+void jit_destroy(struct jit *jit) {
+}
+
+static void compile(struct jit *jit, const struct interpreter *chip,
+        uint16_t start) {
+    jit->blocks[start].state     = BLOCK_INTERP;
+    jit->blocks[start].count     = 1;
+    jit->blocks[start].write_len = 0;
+    jit->blocks[start].resets    = 1;
+    jit->blocks[start].stops     = 0;
+}
+
+#endif
+
+void jit_flush(struct jit *jit) {
+    if (jit == NULL)
+        return;
+    jit->used = 0;
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->covered, 0, sizeof(jit->covered));
+}
+
+// Drops every block if one of the len bytes written from addr was compiled.
+static void invalidate(struct jit *jit, uint16_t addr, int len) {
+    for (int i = 0; i < len; i++) {
+        uint16_t a = (addr + i) & ADDR_MASK;
+        if (jit->covered[a]) {
+            jit_flush(jit);
+            return;
+        }
+    }
+}
+
+// Returns 1 if instr is a call or a return, which write the stack.
+static int is_call_ret(uint16_t instr) {
+    return instr >> 12 == 0x2 || instr == 0x00ee;
+}
+
+int jit_run(struct jit *jit, struct interpreter *chip, struct proc_state *ps,
+        int budget) {
+    // a batch starting on a run left to the interpreter that ends it, as one
+    // waiting for a key or drawing does, goes straight to it
+    if (chip->pc + 1 < RAM_SIZE) {
+        const struct jit_block *b = &jit->blocks[chip->pc];
+        if (b->state == BLOCK_INTERP && b->stops && b->write_len == 0)
+            return run_rom_cycles(chip, ps, b->count < budget ? b->count
+                    : budget);
+    }
+
+    struct idle_watch watch;
+    int               n = 0;
+    ps->err_code    = 0;
+    ps->exit_reason = RUN_BUDGET;
+    ps->idle_period = 0;
+    idle_reset(&watch);
+    while (n < budget) {
+        uint16_t pc = chip->pc;
+        if (pc + 1 < RAM_SIZE) {
+            struct jit_block *b = &jit->blocks[pc];
+            if (b->state == BLOCK_NONE)
+                compile(jit, chip, pc);
+            if (b->state == BLOCK_CODE) {
+                uint64_t ret = b->code(chip, budget - n);
+                n              = budget - (int)(ret >> 16);
+                ps->curr_instr = ret & 0xffff;
+                ps->pc         = chip->pc;
+                // calls and returns end blocks, a block ending elsewhere
+                // backward closes a loop, see run_rom_cycles
+                if (is_call_ret(ps->curr_instr)) {
+                    idle_reset(&watch);
+                    if (chip->strict && chip->fault) {
+                        ps->err_code    = take_fault(chip);
+                        ps->exit_reason = RUN_ERR;
+                        break;
+                    }
+                } else if (chip->pc <= pc) {
+                    ps->idle_period = idle_pass(&watch, chip, chip->pc, n);
+                    if (ps->idle_period > 0) {
+                        ps->exit_reason = RUN_IDLE;
+                        break;
+                    }
+                }
+                continue;
+            }
+        }
+
+        // run the whole run left to the interpreter at once, then drop the
+        // blocks it may have written to
+        if (pc + 1 < RAM_SIZE) {
+            struct jit_block *b   = &jit->blocks[pc];
+            int               len = b->count < budget - n ? b->count
+                : budget - n;
+            uint16_t          I         = chip->I;
+            uint8_t           write_len = b->write_len;
+            if (b->resets)
+                idle_reset(&watch);
+            n += run_rom_cycles(chip, ps, len);
+            if (write_len > 0)
+                invalidate(jit, I, write_len);
+        } else {
+            n += run_rom_cycles(chip, ps, 1);
+        }
+        if (ps->exit_reason != RUN_BUDGET)
+            break;
+    }
+    return n;
+}
@@ -0,0 +1,35 @@
+#ifndef JIT_H
+#define JIT_H
+#include "interpreter.h"
+
+struct jit;
+
+/*
+ * Creates a just-in-time compiler translating CHIP-8 basic blocks to x86-64
+ * machine code. Returns NULL if the host is not x86-64 or if the executable
+ * memory could not be mapped, in which case the interpreter must be used.
+ */
+struct jit *jit_create(void);
+
+/*
+ * Releases jit and its executable memory.
+ */
+void jit_destroy(struct jit *jit);
+
+/*
+ * Drops every compiled block. Must be called when the RAM of the interpreter
+ * run by jit is written to from outside of jit_run (e.g. when loading a ROM).
+ */
+void jit_flush(struct jit *jit);
+
+/*
+ * Same as run_rom_cycles, but runs the compiled blocks of jit, compiling them
+ * the first time they are met. A block longer than the remaining budget runs
+ * up to it. The runs of instructions the compiler does not handle are run by
+ * the interpreter, so that the final state of chip is the same as with
+ * run_rom_cycles. Returns the number of executed instructions.
+ */
+int jit_run(struct jit *jit, struct interpreter *chip, struct proc_state *ps,
+        int budget);
+
+#endif
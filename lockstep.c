@@ -0,0 +1,505 @@
+#include "lockstep.h"
+#include "idle.h"
+#include "profile.h"
+#include <stdalign.h>
+#include <string.h>
+
+// Vectors of a value per lane of a block
+typedef uint8_t  u8v  __attribute__((vector_size(LANES)));
+typedef int8_t   i8v  __attribute__((vector_size(LANES)));
+typedef uint16_t u16v __attribute__((vector_size(2 * LANES)));
+typedef int16_t  i16v __attribute__((vector_size(2 * LANES)));
+typedef int32_t  i32v __attribute__((vector_size(4 * LANES)));
+
+#define VECTOR_COST   8    // Cost of a vector step, in scalar instructions
+#define LANE_COST     2    // Cost of a scalar instruction run from a group
+#define SCALAR_FRAMES 60   // Frames a diverged block then runs lane by lane
+#define MAX_SCALAR    3840 // Frames it runs so once diverged again and again
+
+// Vector code, inlined into each clone of run_block so that it is compiled
+// for the instruction set of the clone
+#define KERNEL static inline __attribute__((always_inline))
+#if defined(__x86_64__)
+#define CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define CLONES
+#endif
+
+// Lanes of a where the mask m is set and those of b elsewhere
+#define SELECT(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+// Masks of the unsigned lanes of bits bits, all ones where the condition
+// holds. They use arithmetic only: GCC splits the arithmetic on vectors wider
+// than those of the host into host vectors, but compares them lane by lane.
+#define NONZERO(x, bits) ((((x) | (0 - (x))) >> ((bits) - 1)) & 1)
+#define NE(a, b, bits)   (0 - NONZERO((a) ^ (b), bits))
+#define EQ(a, b, bits)   (~NE(a, b, bits))
+#define LT(a, b, bits)   (0 - ((((~(a) & (b)) | (~((a) ^ (b)) & ((a) - (b)))) \
+                >> ((bits) - 1)) & 1))
+
+// Registers of LANES interpreters, a lane each. They are gathered from the
+// interpreters when a run starts and scattered back when it ends. Aligned for
+// the widest target, the default one aligning the vectors to 16 bytes only.
+struct block {
+    alignas(64) u8v V[REGISTERS_SIZE];
+    u16v  I;
+    u16v  pc;
+    u8v   dt;
+    u8v   st;
+    i32v  left;  // instructions left in the current frame
+    i16v  alive; // all ones while the lane runs, 0 once stopped or missing
+    struct interpreter *chips[LANES];  // interpreters, NULL if missing
+    struct proc_state  *states;        // state of their last cycle
+    int                 scalar;        // frames left to run lane by lane
+    int                 backoff;       // frames to run so if it diverges
+};
+
+struct lockstep {
+    int                   count;
+    int                   nblocks;
+    struct block         *blocks;
+    struct interpreter   *chips;
+    struct proc_state    *states;
+    // RAM of the first interpreter, and a bit per byte set if another one may
+    // differ there: the instructions of the common bytes are decoded once
+    uint8_t               code[RAM_SIZE];
+    uint64_t              dirty[RAM_SIZE / 64];
+    struct decoded_instr  dec[RAM_SIZE]; // handler NULL if not decoded yet
+};
+
+// Operations run by the vector kernels, the others run lane by lane
+static const uint8_t vector_ops[OP_COUNT] = {
+    [OP_NOP]     = 1, [OP_JP]      = 1, [OP_JP_V0]   = 1, [OP_SE_KK]   = 1,
+    [OP_SNE_KK]  = 1, [OP_SE_XY]   = 1, [OP_SNE_XY]  = 1, [OP_LD_KK]   = 1,
+    [OP_ADD_KK]  = 1, [OP_LD_XY]   = 1, [OP_OR]      = 1, [OP_AND]     = 1,
+    [OP_XOR]     = 1, [OP_ADD_XY]  = 1, [OP_SUB]     = 1, [OP_SHR]     = 1,
+    [OP_SUBN]    = 1, [OP_SHL]     = 1, [OP_LD_I]    = 1, [OP_LD_X_DT] = 1,
+    [OP_LD_DT]   = 1, [OP_LD_ST]   = 1, [OP_ADD_I]   = 1, [OP_LD_F]    = 1
+};
+
+struct lockstep *lockstep_create(int count) {
+    if (count <= 0)
+        return NULL;
+    struct lockstep *ls = calloc(1, sizeof(struct lockstep));
+    if (ls == NULL)
+        return NULL;
+    ls->count   = count;
+    ls->nblocks = (count + LANES - 1) / LANES;
+    size_t size = ls->nblocks * sizeof(struct block);
+    ls->blocks  = aligned_alloc(alignof(struct block), size);
+    ls->chips   = malloc(count * sizeof(struct interpreter));
+    ls->states  = calloc(ls->nblocks * LANES, sizeof(struct proc_state));
+    if (ls->blocks == NULL || ls->chips == NULL || ls->states == NULL) {
+        lockstep_destroy(ls);
+        return NULL;
+    }
+    memset(ls->blocks, 0, size);
+    for (int i = 0; i < count; i++)
+        init(&ls->chips[i]);
+    for (int k = 0; k < ls->nblocks; k++) {
+        struct block *b = &ls->blocks[k];
+        b->states = &ls->states[k * LANES];
+        for (int l = 0; l < LANES && k * LANES + l < count; l++)
+            b->chips[l] = &ls->chips[k * LANES + l];
+    }
+    lockstep_start(ls);
+    return ls;
+}
+
+void lockstep_destroy(struct lockstep *ls) {
+    if (ls == NULL)
+        return;
+    free(ls->blocks);
+    free(ls->chips);
+    free(ls->states);
+    free(ls);
+}
+
+struct interpreter *lockstep_lane(struct lockstep *ls, int i) {
+    if (ls == NULL || i < 0 || i >= ls->count)
+        return NULL;
+    return &ls->chips[i];
+}
+
+const struct proc_state *lockstep_state(const struct lockstep *ls, int i) {
+    if (ls == NULL || i < 0 || i >= ls->count)
+        return NULL;
+    return &ls->states[i];
+}
+
+// Marks the len bytes from addr, wrapped around the RAM, as possibly
+// different between interpreters.
+static void mark_dirty(struct lockstep *ls, unsigned addr, int len) {
+    for (int i = 0; i < len; i++) {
+        unsigned a = (addr + i) & ADDR_MASK;
+        ls->dirty[a / 64] |= (uint64_t)1 << (a % 64);
+    }
+}
+
+// Returns 1 if the byte at addr may differ between interpreters.
+static int is_dirty(const struct lockstep *ls, unsigned addr) {
+    return ls->dirty[addr / 64] >> (addr % 64) & 1;
+}
+
+// Marks the bytes of the RAM of chip that differ from the common code as
+// possibly different between interpreters, after chip ran on its own. Only
+// the ranges it wrote since its written bits were cleared are compared.
+static void mark_changed(struct lockstep *ls, struct interpreter *chip) {
+    for (uint64_t w = chip->written; w != 0; w &= w - 1) {
+        int a = __builtin_ctzll(w) * 64;
+        if (ls->dirty[a / 64] == UINT64_MAX
+                || memcmp(chip->ram + a, ls->code + a, 64) == 0)
+            continue;
+        for (int i = a; i < a + 64; i++) {
+            if (chip->ram[i] != ls->code[i])
+                mark_dirty(ls, i, 1);
+        }
+    }
+    chip->written = 0;
+}
+
+void lockstep_start(struct lockstep *ls) {
+    if (ls == NULL)
+        return;
+    memset(ls->states, 0, ls->nblocks * LANES * sizeof(struct proc_state));
+    memcpy(ls->code, ls->chips[0].ram, RAM_SIZE);
+    memset(ls->dirty, 0, sizeof(ls->dirty));
+    for (int i = 1; i < ls->count; i++) {
+        const uint8_t *ram = ls->chips[i].ram;
+        if (memcmp(ram, ls->code, RAM_SIZE) == 0)
+            continue;
+        for (int a = 0; a < RAM_SIZE; a++) {
+            if (ram[a] != ls->code[a])
+                mark_dirty(ls, a, 1);
+        }
+    }
+    for (int a = 0; a < RAM_SIZE; a++)
+        ls->dec[a].handler = NULL;
+    for (int i = 0; i < ls->count; i++)
+        ls->chips[i].written = 0;
+    for (int k = 0; k < ls->nblocks; k++) {
+        ls->blocks[k].scalar  = 0;
+        ls->blocks[k].backoff = SCALAR_FRAMES;
+    }
+}
+
+// Returns 1 if any lane of *v is not 0.
+KERNEL int any16(const i16v *v) {
+    uint64_t w[sizeof(*v) / 8];
+    uint64_t r = 0;
+    memcpy(w, v, sizeof(*v));
+    for (size_t i = 0; i < sizeof(*v) / 8; i++)
+        r |= w[i];
+    return r != 0;
+}
+
+// Runs the instruction d, whose operation is one of vector_ops, on the lanes
+// of b selected by *m16. Their PC was already moved to the next instruction.
+KERNEL void run_vector(struct block *b, const struct decoded_instr *d,
+        const i16v *m16) {
+    u8v  m  = (u8v)__builtin_convertvector(*m16, i8v);
+    u16v mw = (u16v)*m16;
+    u8v *V  = b->V;
+    u8v  c;
+    switch (d->op) {
+      case OP_NOP:
+        break;
+      case OP_JP:
+        b->pc = SELECT(mw, (u16v){} + d->nnn, b->pc);
+        break;
+      case OP_JP_V0:
+        b->pc = SELECT(mw, __builtin_convertvector(V[0], u16v) + d->nnn,
+                b->pc);
+        break;
+      case OP_SE_KK:
+        b->pc += mw & __builtin_convertvector(EQ(V[d->x], d->kk, 8), u16v) & 2;
+        break;
+      case OP_SNE_KK:
+        b->pc += mw & __builtin_convertvector(NE(V[d->x], d->kk, 8), u16v) & 2;
+        break;
+      case OP_SE_XY:
+        b->pc += mw & __builtin_convertvector(EQ(V[d->x], V[d->y], 8),
+                u16v) & 2;
+        break;
+      case OP_SNE_XY:
+        b->pc += mw & __builtin_convertvector(NE(V[d->x], V[d->y], 8),
+                u16v) & 2;
+        break;
+      case OP_LD_KK:
+        V[d->x] = SELECT(m, (u8v){} + d->kk, V[d->x]);
+        break;
+      case OP_ADD_KK:
+        V[d->x] += m & d->kk;
+        break;
+      case OP_LD_XY:
+        V[d->x] = SELECT(m, V[d->y], V[d->x]);
+        break;
+      case OP_OR:
+        V[d->x] = SELECT(m, V[d->x] | V[d->y], V[d->x]);
+        break;
+      case OP_AND:
+        V[d->x] = SELECT(m, V[d->x] & V[d->y], V[d->x]);
+        break;
+      case OP_XOR:
+        V[d->x] = SELECT(m, V[d->x] ^ V[d->y], V[d->x]);
+        break;
+      // the flags are computed in the order of the executers, so that the
+      // same registers win when x or y is VF
+      case OP_ADD_XY:
+        V[d->x] = SELECT(m, V[d->x] + V[d->y], V[d->x]);
+        c       = LT(V[d->x], V[d->y], 8) & 1;
+        V[VF]   = SELECT(m, c, V[VF]);
+        break;
+      case OP_SUB:
+        c       = LT(V[d->y], V[d->x], 8) & 1;
+        V[VF]   = SELECT(m, c, V[VF]);
+        V[d->x] = SELECT(m, V[d->x] - V[d->y], V[d->x]);
+        break;
+      case OP_SHR:
+        V[VF]   = SELECT(m, V[d->x] & 1, V[VF]);
+        V[d->x] = SELECT(m, V[d->x] >> 1, V[d->x]);
+        break;
+      case OP_SUBN:
+        c       = LT(V[d->x], V[d->y], 8) & 1;
+        V[VF]   = SELECT(m, c, V[VF]);
+        V[d->x] = SELECT(m, V[d->y] - V[d->x], V[d->x]);
+        break;
+      case OP_SHL: // VF = 0, see exec_shl
+        V[VF]  &= ~m;
+        V[d->x] = SELECT(m, V[d->x] << 1, V[d->x]);
+        break;
+      case OP_LD_I:
+        b->I = SELECT(mw, (u16v){} + d->nnn, b->I);
+        break;
+      case OP_LD_X_DT:
+        V[d->x] = SELECT(m, b->dt, V[d->x]);
+        break;
+      case OP_LD_DT:
+        b->dt = SELECT(m, V[d->x], b->dt);
+        break;
+      case OP_LD_ST:
+        b->st = SELECT(m, V[d->x], b->st);
+        break;
+      case OP_ADD_I:
+        b->I = SELECT(mw, b->I + __builtin_convertvector(V[d->x], u16v),
+                b->I);
+        break;
+      case OP_LD_F:
+        b->I = SELECT(mw, __builtin_convertvector(V[d->x], u16v)
+                * CHAR_SPRITE_SIZE + CHAR_SPRITES_ADDR, b->I);
+        break;
+      default:
+        break;
+    }
+}
+
+// Copies the registers of lane l of b from its interpreter.
+static void load_lane(struct block *b, int l) {
+    const struct interpreter *chip = b->chips[l];
+    for (int r = 0; r < REGISTERS_SIZE; r++)
+        b->V[r][l] = chip->registers[r];
+    b->I[l]  = chip->I;
+    b->pc[l] = chip->pc;
+    b->dt[l] = chip->dt;
+    b->st[l] = chip->st;
+}
+
+// Copies the registers of lane l of b to its interpreter.
+static void store_lane(struct block *b, int l) {
+    struct interpreter *chip = b->chips[l];
+    for (int r = 0; r < REGISTERS_SIZE; r++)
+        chip->registers[r] = b->V[r][l];
+    chip->I  = b->I[l];
+    chip->pc = b->pc[l];
+    chip->dt = b->dt[l];
+    chip->st = b->st[l];
+}
+
+// Runs a cycle of chip through run_rom_cycle, marking the bytes it changes as
+// possibly different between interpreters.
+static void step_chip(struct lockstep *ls, struct interpreter *chip,
+        struct proc_state *ps) {
+    run_rom_cycle(chip, ps, 0);
+    if (chip->written != 0)
+        mark_changed(ls, chip);
+}
+
+// Runs a cycle of lane l of b, its registers being copied to its interpreter
+// and back. The lane stops on error.
+static void run_lane(struct lockstep *ls, struct block *b, int l) {
+    store_lane(b, l);
+    step_chip(ls, b->chips[l], &b->states[l]);
+    load_lane(b, l);
+    if (b->states[l].err_code > 0)
+        b->alive[l] = 0;
+}
+
+// Runs frames frames of ipf instructions on every lane of b, one lane after
+// the other through run_rom_cycles, so that a lane stays in the caches for all
+// of them. The rest of a frame spent in an idle loop is skipped, as no key
+// changes until the end of the run. Returns the number of executed
+// instructions.
+static uint64_t run_lanes(struct lockstep *ls, struct block *b, int frames,
+        int ipf) {
+    uint64_t n = 0;
+    for (int l = 0; l < LANES; l++) {
+        if (!b->alive[l])
+            continue;
+        struct interpreter *chip = b->chips[l];
+        struct proc_state  *ps   = &b->states[l];
+        store_lane(b, l);
+        for (int f = 0; f < frames && ps->err_code == 0; f++) {
+            int left = ipf;
+            while (left > 0 && ps->err_code == 0) {
+                int done = run_rom_cycles(chip, ps, left);
+                if (ps->idle_period > 0)
+                    done += idle_skip_len(chip, left - done, UINT64_MAX,
+                            ps->idle_period);
+                n    += done;
+                left -= done;
+            }
+            if (ps->err_code == 0)
+                update_timers(chip);
+        }
+        load_lane(b, l);
+        mark_changed(ls, chip);
+        if (ps->err_code > 0)
+            b->alive[l] = 0;
+    }
+    return n;
+}
+
+// Returns the active lane of b with the lowest PC, -1 if there is none.
+static int lowest_lane(const struct block *b) {
+    int lead = -1;
+    for (int l = 0; l < LANES; l++) {
+        if (b->alive[l] && b->left[l] > 0
+                && (lead < 0 || b->pc[l] < b->pc[lead]))
+            lead = l;
+    }
+    return lead;
+}
+
+// Runs a frame of ipf instructions on the lanes of b, then updates their
+// timers. The lanes at the PC of a leading lane run together for as long as
+// they stay together; once lanes leave or join the group, the lane with the
+// lowest PC leads, so that the lanes behind catch up and reconverge. A block
+// whose groups were too small or too often scalar for the vectors to pay off
+// runs its next SCALAR_FRAMES frames or more lane by lane, see run_lanes.
+// Returns the number of executed instructions.
+CLONES
+static uint64_t run_block(struct lockstep *ls, struct block *b, int ipf) {
+    i16v running = b->alive;
+    i16v group   = {};
+    int  lead    = -1;
+    int  vsteps  = 0; // vector steps
+    int  slanes  = 0; // instructions run from the groups lane by lane
+    b->left = __builtin_convertvector(running, i32v) & ipf;
+    for (;;) {
+        i16v active = __builtin_convertvector((0 - b->left) >> 31, i16v)
+            & b->alive;
+        i16v cand   = {};
+        if (lead >= 0 && b->left[lead] > 0 && b->alive[lead])
+            cand = active & (i16v)EQ(b->pc, b->pc[lead], 16);
+        i16v diff = cand ^ group;
+        if (lead < 0 || any16(&diff)) {
+            lead = lowest_lane(b);
+            if (lead < 0)
+                break;
+            cand = active & (i16v)EQ(b->pc, b->pc[lead], 16);
+        }
+        group = cand;
+
+        // the instruction is the common one unless the code differs, then
+        // the group narrows to the lanes with the instruction of the leader
+        uint16_t             pc = b->pc[lead];
+        struct decoded_instr local;
+        const struct decoded_instr *d = &local;
+        if (pc + 1 >= RAM_SIZE) {
+            local.op = OP_INVALID; // out of RAM, run_rom_cycle reports it
+        } else if (!is_dirty(ls, pc) && !is_dirty(ls, pc + 1)) {
+            if (ls->dec[pc].handler == NULL)
+                decode_instr(ls->code[pc] << 8 | ls->code[pc + 1],
+                        &ls->dec[pc]);
+            d = &ls->dec[pc];
+        } else {
+            const uint8_t *ram   = b->chips[lead]->ram;
+            uint16_t       instr = ram[pc] << 8 | ram[pc + 1];
+            for (int l = 0; l < LANES; l++) {
+                if (group[l] && (b->chips[l]->ram[pc] << 8
+                            | b->chips[l]->ram[pc + 1]) != instr)
+                    group[l] = 0;
+            }
+            decode_instr(instr, &local);
+        }
+
+        if (vector_ops[d->op]) {
+            b->pc += (u16v)group & 2;
+            run_vector(b, d, &group);
+            vsteps++;
+        } else {
+            for (int l = 0; l < LANES; l++) {
+                if (group[l]) {
+                    run_lane(ls, b, l);
+                    slanes++;
+                }
+            }
+        }
+        b->left += __builtin_convertvector(group, i32v); // -1 in the group
+    }
+
+    // timers of the lanes still running, see update_timers
+    u8v live = (u8v)__builtin_convertvector(b->alive, i8v);
+    b->dt -= NONZERO(b->dt, 8) & live;
+    b->st -= NONZERO(b->st, 8) & live;
+    uint64_t n = 0;
+    for (int l = 0; l < LANES; l++) {
+        if (running[l])
+            n += ipf - b->left[l];
+        if (b->alive[l])
+            PROFILE_FRAME(b->chips[l]);
+    }
+    // each divergence right after the previous one doubles the frames run
+    // lane by lane
+    if ((uint64_t)vsteps * VECTOR_COST + (uint64_t)slanes * LANE_COST > n) {
+        b->scalar  = b->backoff;
+        b->backoff = b->backoff < MAX_SCALAR ? 2 * b->backoff : MAX_SCALAR;
+    } else {
+        b->backoff = SCALAR_FRAMES;
+    }
+    return n;
+}
+
+uint64_t lockstep_run(struct lockstep *ls, int frames, int ipf) {
+    if (ls == NULL || frames <= 0 || ipf <= 0)
+        return 0;
+    uint64_t n = 0;
+    for (int k = 0; k < ls->nblocks; k++) {
+        struct block *b = &ls->blocks[k];
+        for (int l = 0; l < LANES; l++) {
+            b->alive[l] = b->chips[l] != NULL && b->states[l].err_code == 0
+                ? -1 : 0;
+            // a ROM reloaded since the last run differs from the code
+            if (b->chips[l] != NULL && b->chips[l]->written != 0)
+                mark_changed(ls, b->chips[l]);
+            if (b->chips[l] != NULL)
+                load_lane(b, l);
+        }
+        for (int f = 0; f < frames;) {
+            if (b->scalar == 0) {
+                n += run_block(ls, b, ipf);
+                f++;
+                continue;
+            }
+            int run = b->scalar < frames - f ? b->scalar : frames - f;
+            n += run_lanes(ls, b, run, ipf);
+            b->scalar -= run;
+            f         += run;
+        }
+        for (int l = 0; l < LANES; l++) {
+            if (b->chips[l] != NULL)
+                store_lane(b, l);
+        }
+    }
+    return n;
+}
@@ -0,0 +1,56 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+#include "interpreter.h"
+
+#define LANES 32 // Instances of a block, run by the same vector instructions
+
+struct lockstep;
+
+/*
+ * Creates an engine running count interpreters in lockstep, by blocks of
+ * LANES. The registers, I, PC and timers of a block are stored as arrays of
+ * LANES values, so that the instances of a block whose PCs agree run an
+ * instruction that only touches them with a few vector instructions (AVX2 when
+ * the host has it, SSE2 otherwise). The other instructions, and the instances
+ * whose PCs diverge, run one by one through run_rom_cycle. Returns NULL on
+ * failure.
+ */
+struct lockstep *lockstep_create(int count);
+
+/*
+ * Releases ls and its interpreters.
+ */
+void lockstep_destroy(struct lockstep *ls);
+
+/*
+ * Returns the i-th interpreter of ls, initialized by lockstep_create. It is
+ * loaded, seeded and given its keys before lockstep_start, then read between
+ * the runs. Its keypad and registers may be changed between two runs, its RAM
+ * before lockstep_start or, between two runs, by init, load_rom and
+ * load_rom_buffer, which record what they write.
+ */
+struct interpreter *lockstep_lane(struct lockstep *ls, int i);
+
+/*
+ * Compares the RAMs of the interpreters of ls, whose common bytes are then
+ * fetched and decoded once for a whole block, and clears their errors. Must
+ * be called before the first run and after any other change of their RAM
+ * than by init, load_rom and load_rom_buffer outside of lockstep_run.
+ */
+void lockstep_start(struct lockstep *ls);
+
+/*
+ * Runs frames frames on every interpreter of ls: ipf instructions followed by
+ * a timers update, as a loop of run_rom_cycle and update_timers would do. An
+ * interpreter whose processor reports an error stops there for good, see
+ * lockstep_state. Returns the number of executed instructions.
+ */
+uint64_t lockstep_run(struct lockstep *ls, int frames, int ipf);
+
+/*
+ * Returns the processor state of the i-th interpreter of ls, whose err_code
+ * is not 0 once it stopped on error, curr_instr and pc then locating it.
+ */
+const struct proc_state *lockstep_state(const struct lockstep *ls, int i);
+
+#endif
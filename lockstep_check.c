@@ -0,0 +1,183 @@
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "lockstep.h"
+
+#define CHECK_LANES   256  // Default number of instances
+#define CHECK_FRAMES  3000 // Default frames per run
+#define KEY_PERIOD    30   // Frames between two changes of the keys
+#define REPEATS       3    // Runs per engine, the fastest is kept
+#define NAME_SIZE     256  // Maximal length of a ROM name
+
+#define ENGINE_STEP     0 // run_rom_cycle, instance by instance
+#define ENGINE_BATCH    1 // run_rom_cycles, instance by instance
+#define ENGINE_LOCKSTEP 2 // lockstep_run, every instance at once
+#define ENGINE_COUNT    3
+
+static const char *engine_names[ENGINE_COUNT] = {
+    "step", "batch", "lockstep"
+};
+
+// Returns the current value of the monotonic clock in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sets the keypad of chip, the instance lane, for the period-th KEY_PERIOD
+// frames: a single key down, or none, which differs between the instances.
+static void set_keys(struct interpreter *chip, int lane, int period) {
+    int down = (lane + 3 * period) % (KEYBOARD_SIZE + 1);
+    for (int k = 0; k < KEYBOARD_SIZE; k++)
+        chip->keyboard[k] = k == down ? KEY_DOWN : KEY_UP;
+}
+
+// Runs frames frames of chip, ipf instructions each followed by a timers
+// update, one instruction per call if batch is 0 and with run_rom_cycles
+// otherwise. Stops for good once ps reports an error. Returns the number of
+// executed instructions.
+static uint64_t run_frames(struct interpreter *chip, struct proc_state *ps,
+        int frames, int ipf, int batch) {
+    uint64_t n = 0;
+    for (int f = 0; f < frames && ps->err_code == 0; f++) {
+        int left = ipf;
+        while (left > 0 && ps->err_code == 0) {
+            int done = 1;
+            if (batch)
+                done = run_rom_cycles(chip, ps, left);
+            else
+                run_rom_cycle(chip, ps, 0);
+            n    += done;
+            left -= done;
+        }
+        if (ps->err_code == 0)
+            update_timers(chip);
+    }
+    return n;
+}
+
+// Loads the ROM filename into count instances seeded with their number,
+// runs them with every engine and prints the results as chip8-bench does.
+// Returns 0 if every engine ends every instance in the same state, -1
+// otherwise.
+static int check(const char *filename, int count, int frames, int ipf) {
+    uint8_t rom[MAX_ROM_SIZE];
+    int     size = read_rom(filename, rom);
+    if (size < 0)
+        return -1;
+    struct interpreter *chips  = malloc(count * sizeof(struct interpreter));
+    struct proc_state  *states = malloc(count * sizeof(struct proc_state));
+    struct lockstep    *ls     = lockstep_create(count);
+    if (chips == NULL || states == NULL || ls == NULL) {
+        perror("Could not allocate the instances");
+        free(chips);
+        free(states);
+        lockstep_destroy(ls);
+        return -1;
+    }
+
+    char path[NAME_SIZE];
+    snprintf(path, sizeof(path), "%s", filename);
+    const char *name = basename(path);
+    uint64_t    hashes[ENGINE_COUNT];
+    for (int e = 0; e < ENGINE_COUNT; e++) {
+        double   best = 0;
+        uint64_t n    = 0;
+        for (int r = 0; r < REPEATS; r++) {
+            for (int i = 0; i < count; i++) {
+                struct interpreter *chip = e == ENGINE_LOCKSTEP
+                    ? lockstep_lane(ls, i) : &chips[i];
+                init(chip);
+                seed_rng(chip, i);
+                states[i].err_code = 0;
+            }
+            // the last run loads the ROM after lockstep_start, which the
+            // lockstep must notice on its own
+            int late = e == ENGINE_LOCKSTEP && r == REPEATS - 1;
+            if (late)
+                lockstep_start(ls);
+            for (int i = 0; i < count; i++)
+                load_rom_buffer(rom, size, e == ENGINE_LOCKSTEP
+                        ? lockstep_lane(ls, i) : &chips[i]);
+            if (e == ENGINE_LOCKSTEP && !late)
+                lockstep_start(ls);
+
+            n = 0;
+            double start = now();
+            for (int f = 0; f < frames; f += KEY_PERIOD) {
+                int run = frames - f < KEY_PERIOD ? frames - f : KEY_PERIOD;
+                for (int i = 0; i < count; i++) {
+                    if (e == ENGINE_LOCKSTEP) {
+                        set_keys(lockstep_lane(ls, i), i, f / KEY_PERIOD);
+                        continue;
+                    }
+                    set_keys(&chips[i], i, f / KEY_PERIOD);
+                    n += run_frames(&chips[i], &states[i], run, ipf,
+                            e == ENGINE_BATCH);
+                }
+                if (e == ENGINE_LOCKSTEP)
+                    n += lockstep_run(ls, run, ipf);
+            }
+            double t = now() - start;
+            if (r == 0 || t < best)
+                best = t;
+        }
+
+        // FNV-1a of the state hashes of the instances
+        uint64_t hash = 0xcbf29ce484222325;
+        for (int i = 0; i < count; i++) {
+            uint64_t h = state_hash(e == ENGINE_LOCKSTEP
+                    ? lockstep_lane(ls, i) : &chips[i]);
+            for (int b = 0; b < 64; b += 8)
+                hash = (hash ^ (h >> b & 0xff)) * 0x100000001b3;
+        }
+        hashes[e] = hash;
+        printf("lockstep\t%s\t%s\t%llu\t%.3f\t%.0f\t%016llx\n", name,
+                engine_names[e], (unsigned long long)n, best * 1e9 / n,
+                n / best, (unsigned long long)hash);
+    }
+    free(chips);
+    free(states);
+    lockstep_destroy(ls);
+
+    for (int e = 1; e < ENGINE_COUNT; e++) {
+        if (hashes[e] != hashes[ENGINE_STEP]) {
+            dprintf(STDERR_FILENO, "%s: %s state differs\n", name,
+                    engine_names[e]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int count  = CHECK_LANES;
+    int frames = CHECK_FRAMES;
+    int ipf    = DEFAULT_IPF;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:i:")) != -1) {
+        switch (opt) {
+          case 'n':
+            count = atoi(optarg);
+            break;
+          case 'f':
+            frames = atoi(optarg);
+            break;
+          case 'i':
+            ipf = atoi(optarg);
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (count <= 0 || frames <= 0 || ipf <= 0 || argc - optind != 1) {
+        dprintf(STDERR_FILENO, "Usage: %s [-n <instances>] [-f <frames>] "
+                "[-i <count>] <rom>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    return check(argv[optind], count, frames, ipf) < 0 ? EXIT_FAILURE
+        : EXIT_SUCCESS;
+}
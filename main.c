@@ -1,46 +1,416 @@
+#include <ctype.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include "interpreter.h"
+#include "headless.h"
+#include "input.h"
+#include "snapshot.h"
+#include "profile.h"
+#include "trace.h"
+#include "frames.h"
+#include "audio.h"
+#include "triple.h"
+#include "spsc.h"
 
 #define INVAL_ARG_ERR "Invalid number of arguments\n"
-#define CYCLE_DELAY      16 // Delay in ms between two processor cycles
+#define FRAME_NS      (SDL_NS_PER_SECOND / TIMERS_FREQ) // Duration of a frame
+#define MAX_LAG       4  // Maximal number of late frames caught up at once
+#define REWIND_KEY    SDL_SCANCODE_BACKSPACE // Key held to rewind
+#define KEYPAD_LAYOUT  "123C456D789EA0BF" // Keys of the keypad, row by row
+#define DEFAULT_KEYMAP "1234qwerasdfzxcv" // Host keys of KEYPAD_LAYOUT
+#ifdef CHIP8_PROFILE
+#define OPTSTRING     "HSJFEXmi:f:n:t:p:s:r:R:l:o:w:T:V:k:P:"
+#else
+#define OPTSTRING     "HSJFEXmi:f:n:t:p:s:r:R:l:o:w:T:V:k:"
+#endif
 
-int main(int argc, char **argv) {
-    if (argc != 3 && argc != 4) {
-        dprintf(STDERR_FILENO, INVAL_ARG_ERR);
-        return EXIT_FAILURE;
+static struct trace *trace;      // trace of the debug mode, or NULL
+static const char   *trace_file; // file the trace is dumped to
+
+// Writes the trace of the debug mode when the program exits, so that the last
+// instructions before an error are kept.
+static void write_trace(void) {
+    trace_write(trace, trace_file);
+    trace_destroy(trace);
+}
+
+static struct frame_stream *frames; // stream of the shown frames, or NULL
+
+// Flushes the frame stream when the program exits, so that it holds every
+// frame up to an error.
+static void close_frames(void) {
+    frames_close(frames);
+}
+
+#ifdef CHIP8_PROFILE
+static struct profile           *profile;      // profile of profiled
+static const struct interpreter *profiled;     // profiled interpreter
+static const char               *profile_file; // file of the JSON report
+
+// Writes the profile report when the program exits, whatever the reason: JSON
+// to profile_file and a summary to the standard error.
+static void write_profile(void) {
+    FILE *out = fopen(profile_file, "w");
+    if (out == NULL) {
+        perror("Could not write profile");
+    } else {
+        profile_write_json(out, profile, profiled);
+        fclose(out);
     }
+    profile_write_text(stderr, profile, profiled);
+    profile_destroy(profile);
+}
+#endif
 
-    // debug mode is enabled if 4 arguments are given
-    int debug = 0;
-    if (argc == 4)
-        debug = 1;
+// Host keys of the CHIP-8 keypad: keys[i] is the SDL keycode of key i.
+struct keymap {
+    SDL_Keycode keys[KEYBOARD_SIZE];
+};
 
-    // Interpreter initialization
-    struct interpreter chip;
-    init(&chip);
-    if (load_rom(argv[1], &chip) < 0) {
-        return EXIT_FAILURE;
+// Returns the CHIP-8 key of the host key k in map, -1 if it has none.
+static int map_key(const struct keymap *map, SDL_Keycode k) {
+    for (int i = 0; i < KEYBOARD_SIZE; i++) {
+        if (map->keys[i] == k)
+            return i;
     }
+    return -1;
+}
 
-    // Get scale from arguments
-    int scale = atoi(argv[2]);
-    if (scale <= 0) {
-        dprintf(STDERR_FILENO, "Invalid scale value: %d\n", scale);
-        return EXIT_FAILURE;
+// Sets map from spec, the KEYBOARD_SIZE host keys of the keypad in the order
+// of its layout (KEYPAD_LAYOUT), each as a single character. Returns 0 on
+// success, -1 if spec is not made of KEYBOARD_SIZE distinct printable
+// characters.
+static int parse_keymap(const char *spec, struct keymap *map) {
+    if (strlen(spec) != KEYBOARD_SIZE)
+        return -1;
+    memset(map, 0, sizeof(*map));
+    for (int i = 0; i < KEYBOARD_SIZE; i++) {
+        char l   = KEYPAD_LAYOUT[i];
+        int  key = l <= '9' ? l - '0' : l - 'A' + 10;
+        // the keycodes of printable keys are their lowercase characters
+        int  c   = tolower((unsigned char)spec[i]);
+        if (!isgraph(c) || map_key(map, c) >= 0)
+            return -1;
+        map->keys[key] = c;
+    }
+    return 0;
+}
+
+// Handles window and keyboard events: sets done if the window is closed,
+// redraw if its content was lost, and pushes the presses and releases of the
+// keys of map to edges, timestamped by the host clock. Key repeats are
+// ignored, and so are the edges left once edges is full.
+static void handle_sdl_events(bool *done, bool *redraw,
+        const struct keymap *map, struct key_queue *edges) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+          case SDL_EVENT_QUIT: // window
+            *done = true;
+            break;
+          case SDL_EVENT_WINDOW_EXPOSED: // window content lost, redraw it
+            *redraw = true;
+            break;
+          case SDL_EVENT_KEY_DOWN: // keyboard
+          case SDL_EVENT_KEY_UP:
+            if (event.key.repeat)
+                break;
+            int key = map_key(map, event.key.key);
+            if (key >= 0) {
+                struct key_event e;
+                e.time  = event.key.timestamp;
+                e.cycle = 0;
+                e.key   = key;
+                e.down  = event.type == SDL_EVENT_KEY_DOWN;
+                key_queue_push(edges, e);
+            }
+            break;
+          default: // ignore other events
+            break;
+        }
     }
+}
+
+// Uploads the frame f to texture and presents it scaled to the whole window.
+// Returns 0 on success, -1 otherwise.
+static int present(SDL_Renderer *renderer, SDL_Texture *texture,
+        const struct tb_frame *f) {
+    void *pixels;
+    int   pitch;
+    if (!SDL_LockTexture(texture, NULL, &pixels, &pitch))
+        return -1;
+    vbuf_to_pixels(f->vbuf, pixels, pitch);
+    SDL_UnlockTexture(texture);
+    if (!SDL_RenderTexture(renderer, texture, NULL, NULL))
+        return -1;
+    if (!SDL_RenderPresent(renderer))
+        return -1;
+    return 0;
+}
+
+// State shared by the emulation thread and the SDL thread of a windowed
+// session. The atomics and queues are written by one thread and read by the
+// other, the rest is only touched by the emulation thread until it is joined.
+struct session {
+    struct interpreter   *chip;
+    int                   ipf;       // instructions per 60 Hz frame
+    int                   debug;     // debug mode, see run_frame
+    int                   skip_idle; // idle loops are skipped
+    FILE                 *rec;       // recording of the key edges, or NULL
+    struct rewind        *rw;        // rewind buffer, or NULL
+    struct beeper        *bp;        // beeper, or NULL
+    struct triple_buffer  frames;    // completed frames, to the SDL thread
+    struct key_queue      edges;     // key edges, to the emulation thread
+    struct key_queue      applied;   // applied key edges, back to the SDL
+                                     // thread to measure their latency
+    Uint32                wake_type; // event waking the SDL thread up
+    _Atomic int           rewinding; // 1 while the rewind key is held
+    _Atomic int           quit;      // 1 once the SDL thread wants to stop
+    _Atomic int           stopped;   // 1 once the emulation thread stopped
+    _Atomic int           wake_sent; // 1 if a wake event is pending
+    uint64_t              cycles;    // instructions executed so far
+    int                   ret;       // exit status of the emulation
+};
+
+// Input-to-present latency of the key edges, measured by the SDL thread.
+struct latency {
+    uint64_t count; // edges presented
+    uint64_t total; // sum of their latencies, in ns
+    uint64_t max;   // largest latency, in ns
+};
+
+// Wakes the SDL thread of s up, unless a wake event is already pending.
+static void wake_sdl(struct session *s) {
+    if (atomic_exchange(&s->wake_sent, 1))
+        return;
+    SDL_Event e;
+    SDL_zero(e);
+    e.type = s->wake_type;
+    SDL_PushEvent(&e);
+}
+
+// Takes from s->edges the key edges that happened before end, the end of the
+// frame about to run, to edges, and sets the instruction each one applies at:
+// the one matching its time in the frame, so that a tap shorter than a frame
+// is still seen by the ROM. Edges are at least an instruction apart, the
+// ones that no longer fit in the frame are left to the next one. Returns the
+// number of edges taken.
+static int take_edges(struct session *s, Uint64 end, struct key_event *edges) {
+    Uint64   start = end > FRAME_NS ? end - FRAME_NS : 0;
+    uint64_t next  = s->cycles;
+    int      n     = 0;
+    while (n < SPSC_SIZE && key_queue_peek(&s->edges, &edges[n])) {
+        struct key_event *e = &edges[n];
+        if (e->time >= end)
+            break;
+        uint64_t pos = e->time > start
+            ? (e->time - start) * s->ipf / FRAME_NS : 0;
+        e->cycle = s->cycles + pos > next ? s->cycles + pos : next;
+        if (e->cycle >= s->cycles + s->ipf)
+            break;
+        key_queue_pop(&s->edges);
+        next = e->cycle + 1;
+        n++;
+    }
+    return n;
+}
+
+// Applies the key edge e to the chip of s and records it if the session is
+// recorded, then hands it back to the SDL thread. Returns 0 on success, -1
+// otherwise.
+static int apply_edge(struct session *s, const struct key_event *e) {
+    struct input_event ie;
+    ie.cycle = e->cycle;
+    ie.key   = e->key;
+    ie.down  = e->down;
+    apply_input_event(s->chip, &ie);
+    key_queue_push(&s->applied, *e); // dropped if full, only a measure
+    if (s->rec != NULL && record_input_event(s->rec, &ie) < 0)
+        return -1;
+    return 0;
+}
 
+// Runs one 60 Hz frame of s: s->ipf processor cycles, then a timers update.
+// The count key edges of edges are applied right before the instruction their
+// cycle designates, see take_edges. The cycles are run in batches that stop at
+// the edges, or one by one with run_rom_cycle in debug mode. If s->skip_idle
+// is not 0, the iterations of an idle loop left before the next edge or the
+// end of the frame are not run, see run_rom_cycles. The sound timer is passed
+// on to the beeper, if any, after each batch and after the timers update. The
+// frame ends early once the ROM exits (00FD). Returns 1 if the frame ended in
+// an idle loop, 0 otherwise, -1 if the processor reported an error or an edge
+// could not be recorded.
+static int run_frame(struct session *s, struct proc_state *ps,
+        const struct key_event *edges, int count) {
+    struct interpreter *chip = s->chip;
+    int                 left = s->ipf;
+    int                 idle = 0;
+    int                 next = 0;
+    while (left > 0) {
+        uint64_t cycle = s->cycles + s->ipf - left;
+        while (next < count && edges[next].cycle <= cycle) {
+            if (apply_edge(s, &edges[next++]) < 0)
+                return -1;
+        }
+        int budget = left;
+        if (next < count && edges[next].cycle - cycle < (uint64_t)budget)
+            budget = edges[next].cycle - cycle;
+        if (s->debug) {
+            run_rom_cycle(chip, ps, s->debug);
+            left--;
+        } else {
+            int n = run_rom_cycles(chip, ps, budget);
+            left   -= n;
+            budget -= n;
+            idle    = ps->idle_period > 0;
+            if (s->skip_idle && idle)
+                left -= budget - budget % ps->idle_period;
+        }
+        if (ps->err_code > 0)
+            return -1;
+        beeper_set(s->bp, chip->st > 0, s->cycles + s->ipf - left);
+        if (chip->exited)
+            break;
+    }
+    update_timers(chip);
+    beeper_set(s->bp, chip->st > 0, s->cycles + s->ipf);
+    return idle;
+}
+
+// Publishes the framebuffer of the chip of s to the SDL thread.
+static void publish_frame(struct session *s) {
+    struct tb_frame *f = tb_back(&s->frames);
+    vbuf_to_rows(s->chip, f->vbuf);
+    f->cycle = s->cycles;
+    tb_publish(&s->frames);
+    wake_sdl(s);
+}
+
+// Emulation thread of a windowed session: runs the frames of s on absolute
+// deadlines, so that the emulation speed depends neither on the time spent
+// presenting nor on vsync, and publishes the frames that changed the display
+// or applied key edges. Stops once the SDL thread asks for it, the ROM exits
+// or on error, then wakes the SDL thread up.
+static int SDLCALL emulate(void *data) {
+    struct session     *s    = data;
+    struct interpreter *chip = s->chip;
+    struct proc_state   ps;
+    struct key_event    edges[SPSC_SIZE];
+    ps.curr_instr  = 0;
+    ps.pc          = 0;
+    ps.err_code    = 0;
+    ps.exit_reason = RUN_BUDGET;
+    ps.idle_period = 0;
+
+    Uint64 next_frame = SDL_GetTicksNS();
+    publish_frame(s); // a loaded state is shown before its first draw
+    s->ret = EXIT_SUCCESS;
+    while (s->ret == EXIT_SUCCESS && !chip->exited
+            && !atomic_load(&s->quit)) {
+        // run every frame that is due, dropping the backlog after a stall
+        Uint64 now = SDL_GetTicksNS();
+        if (now > next_frame + MAX_LAG * FRAME_NS)
+            next_frame = now;
+        while (next_frame <= now && !chip->exited) {
+            // the frame emulates the last FRAME_NS up to its deadline
+            int count = take_edges(s, next_frame, edges);
+            next_frame += FRAME_NS;
+            if (s->rw != NULL && atomic_load(&s->rewinding)) {
+                for (int i = 0; i < count; i++) {
+                    edges[i].cycle = s->cycles;
+                    apply_edge(s, &edges[i]);
+                }
+                if (rewind_pop(s->rw, chip) == 0)
+                    chip->update_display = 1;
+                beeper_set(s->bp, 0, s->cycles);
+            } else {
+                int idle = run_frame(s, &ps, edges, count);
+                s->cycles += s->ipf; // so that a replay reaches an error too
+                if (idle < 0) {
+                    dprintf(STDERR_FILENO,
+                            "Error while running ROM, quitting...\n");
+                    dprintf(
+                      STDERR_FILENO,
+                      "[Proc state] instr=%#06x, PC=%#06x, err=%d\n",
+                      ps.curr_instr, ps.pc, ps.err_code
+                    );
+                    s->ret = EXIT_FAILURE;
+                    break;
+                }
+                if (s->rw != NULL)
+                    rewind_push(s->rw, chip);
+            }
+            // a frame that applied edges is presented even if the display
+            // did not change, so that their latency is measured
+            if (chip->update_display || count > 0)
+                publish_frame(s);
+            if (chip->update_display) {
+                chip->update_display = 0;
+                if (frames != NULL && frames_write(frames, chip, s->cycles,
+                            s->cycles / s->ipf) < 0) {
+                    s->ret = EXIT_FAILURE;
+                    break;
+                }
+            }
+        }
+
+        // an idle ROM costs little per frame, see run_frame, so the thread
+        // just sleeps until the next frame is due
+        now = SDL_GetTicksNS();
+        if (s->ret == EXIT_SUCCESS && next_frame > now)
+            SDL_DelayPrecise(next_frame - now);
+    }
+    atomic_store(&s->stopped, 1);
+    wake_sdl(s);
+    return s->ret;
+}
+
+// Adds to lat the latency of the edges of s applied before the instructions
+// of the frame f, which was just presented.
+static void measure_latency(struct session *s, const struct tb_frame *f,
+        struct latency *lat) {
+    struct key_event e;
+    Uint64           now = SDL_GetTicksNS();
+    while (key_queue_peek(&s->applied, &e) && e.cycle < f->cycle) {
+        key_queue_pop(&s->applied);
+        uint64_t t = now > e.time ? now - e.time : 0;
+        lat->count++;
+        lat->total += t;
+        if (t > lat->max)
+            lat->max = t;
+    }
+}
+
+// Runs the ROM loaded in chip in a window scaled by scale, executing ipf
+// instructions per frame. The emulation runs on a thread of its own, see
+// emulate, while the calling thread handles the events, passes the edges of
+// the keys of map on through s->edges and presents the latest completed frame.
+// Once the window is closed, the input-to-present latency of the edges is
+// printed to the standard error. If rec is not NULL, the key edges are
+// recorded to it along with the number of instructions run so far. If rw is not NULL, the state of every frame is pushed to it, and
+// popped back while the rewind key is held. The changed frames are written to
+// the frame stream if there is one. Unless mute is not 0, the sound timer
+// drives a beeper. Returns the exit status of the program.
+static int run_window(struct interpreter *chip, int scale, int ipf,
+        int debug, int skip_idle, int mute, const struct keymap *map,
+        FILE *rec, struct rewind *rw) {
     // Window and renderer initialization
     SDL_Window      *window;
     SDL_Renderer    *renderer;
-    int              width  = VBUF_WIDTH * scale;
-    int              height = VBUF_HEIGHT * scale;
-    int              ret    = EXIT_SUCCESS;
-    SDL_WindowFlags  flags  = SDL_WINDOW_OPENGL;
+    SDL_Texture     *texture = NULL;
+    SDL_Thread      *thread  = NULL;
+    struct session  *s       = NULL;
+    struct latency   lat     = {0, 0, 0};
+    int              width   = VBUF_WIDTH * scale;
+    int              height  = VBUF_HEIGHT * scale;
+    int              ret     = EXIT_SUCCESS;
+    SDL_WindowFlags  flags   = SDL_WINDOW_OPENGL;
     SDL_Init(SDL_INIT_VIDEO);
     if (!SDL_CreateWindowAndRenderer("CHIP-8 interpreter", width, height, flags,
                     &window, &renderer)) {
@@ -53,61 +423,379 @@ int main(int argc, char **argv) {
         goto clean_up;
     }
 
-    // Processor state initialization
-    struct proc_state ps;
-    ps.curr_instr = 0;
-    ps.pc         = 0;
-    ps.err_code   = 0;
+    // The framebuffer is uploaded to a texture of its own size, then scaled to
+    // the window by the renderer
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888,
+            SDL_TEXTUREACCESS_STREAMING, HIRES_WIDTH, HIRES_HEIGHT);
+    if (texture == NULL) {
+        SDL_LogError(
+          SDL_LOG_CATEGORY_APPLICATION,
+          "Could not create texture: %s\n",
+          SDL_GetError()
+        );
+        ret = EXIT_FAILURE;
+        goto clean_up;
+    }
+    SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+
+    // Session initialization, the keypad of chip is kept until the first
+    // edges
+    s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        perror("Could not allocate session");
+        ret = EXIT_FAILURE;
+        goto clean_up;
+    }
+    s->chip      = chip;
+    s->ipf       = ipf;
+    s->debug     = debug;
+    s->skip_idle = skip_idle;
+    s->rec       = rec;
+    s->rw        = rw;
+    s->wake_type = SDL_RegisterEvents(1);
+    if (s->wake_type == 0)
+        s->wake_type = SDL_EVENT_USER;
+    tb_init(&s->frames);
+    key_queue_init(&s->edges);
+    key_queue_init(&s->applied);
+    atomic_init(&s->rewinding, 0);
+    atomic_init(&s->quit, 0);
+    atomic_init(&s->stopped, 0);
+    atomic_init(&s->wake_sent, 0);
+
+    // The session goes on without sound if there is no audio device
+    if (!mute && SDL_InitSubSystem(SDL_INIT_AUDIO))
+        s->bp = beeper_open(ipf);
+
+    thread = SDL_CreateThread(emulate, "emulation", s);
+    if (thread == NULL) {
+        SDL_LogError(
+          SDL_LOG_CATEGORY_APPLICATION,
+          "Could not create emulation thread: %s\n",
+          SDL_GetError()
+        );
+        ret = EXIT_FAILURE;
+        goto clean_up;
+    }
 
-    // Processor loop
+    // Event loop, the thread sleeps until an event or a new frame comes
     bool done = false;
-    while (!done) {
-        SDL_Delay(CYCLE_DELAY);
-        handle_sdl_events(&done, &chip);
-        if (done)
-            break;
-
-        run_rom_cycle(&chip, &ps, debug);
-        if (ps.err_code > 0) {
-            dprintf(STDERR_FILENO, "Error while running ROM, quitting...\n");
-            dprintf(
-              STDERR_FILENO,
-              "[Proc state] instr=%#06x, PC=%#06x, err=%d\n",
-              ps.curr_instr, ps.pc, ps.err_code
-            );
-            ret  = EXIT_FAILURE;
-            goto clean_up;
-        }
+    while (!done && !atomic_load(&s->stopped)) {
+        bool redraw = false;
+        handle_sdl_events(&done, &redraw, map, &s->edges);
+        if (rw != NULL)
+            atomic_store(&s->rewinding,
+                    SDL_GetKeyboardState(NULL)[REWIND_KEY]);
 
-        // set background to black and clear screen
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-        SDL_RenderClear(renderer);
-
-        // draw pixels
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);
-        SDL_FRect rect = {.x = 0, .y = 0, .w = scale, .h = scale};
-        for (int i = 0; i < VBUF_HEIGHT * VBUF_WIDTH; i++) {
-            if (chip.vbuf[i] == PIXEL_ON) {
-                rect.x = (i % VBUF_WIDTH) * scale;
-                rect.y = (i / VBUF_WIDTH) * scale;
-                if (!SDL_RenderFillRect(renderer, &rect)) {
-                    SDL_LogError(
-                      SDL_LOG_CATEGORY_APPLICATION,
-                      "Could not draw pixel: %s\n",
-                      SDL_GetError()
-                    );
-                    ret = EXIT_FAILURE;
-                    goto clean_up;
-                }
+        // present the latest frame, or the last one again if the window
+        // content was lost; the wake flag is cleared first so that a frame
+        // published from now on sends another wake event
+        atomic_exchange(&s->wake_sent, 0);
+        if (tb_take(&s->frames) || redraw) {
+            if (present(renderer, texture, tb_front(&s->frames)) < 0) {
+                SDL_LogError(
+                  SDL_LOG_CATEGORY_APPLICATION,
+                  "Could not present frame: %s\n",
+                  SDL_GetError()
+                );
+                ret = EXIT_FAILURE;
+                break;
             }
+            measure_latency(s, tb_front(&s->frames), &lat);
         }
-        SDL_RenderPresent(renderer);
+        if (!done && !atomic_load(&s->stopped))
+            SDL_WaitEvent(NULL);
     }
 
     // Destroy and cleanup
  clean_up:
+    if (thread != NULL) {
+        atomic_store(&s->quit, 1);
+        SDL_WaitThread(thread, NULL);
+        if (s->ret != EXIT_SUCCESS)
+            ret = s->ret;
+        if (rec != NULL)
+            record_end(rec, s->cycles);
+        if (lat.count > 0)
+            dprintf(STDERR_FILENO, "Input latency: %llu edges, mean %.2f ms, "
+                    "max %.2f ms\n", (unsigned long long)lat.count,
+                    lat.total / 1e6 / lat.count, lat.max / 1e6);
+    }
+    if (s != NULL)
+        beeper_close(s->bp);
+    free(s);
+    if (texture != NULL)
+        SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     return ret;
 }
+
+int main(int argc, char **argv) {
+    struct headless_opts opts;
+    headless_opts_init(&opts);
+    int   headless    = 0;
+    char *record_file = NULL;
+    char *replay_file = NULL;
+    char *load_file   = NULL;
+    char *save_file   = NULL;
+    char *prof_file   = NULL;
+    char *frames_file = NULL;
+    char *keymap      = DEFAULT_KEYMAP;
+    int   frames_fmt  = FRAMES_DELTA;
+    int   rewind_secs = 0;
+    int   full_trace  = 0;
+    int   mute        = 0;
+    int   strict      = 0;
+    long  trace_len   = DEFAULT_TRACE_LEN;
+    int   opt;
+    while ((opt = getopt(argc, argv, OPTSTRING)) != -1) {
+        switch (opt) {
+          case 'H':
+            headless = 1;
+            break;
+          case 'S':
+            opts.single_step = 1;
+            break;
+          case 'J':
+            opts.jit = 1;
+            break;
+          case 'i':
+            opts.ipf = atoi(optarg);
+            break;
+          case 'f':
+            opts.ipf = (atoi(optarg) + TIMERS_FREQ / 2) / TIMERS_FREQ;
+            break;
+          case 'n':
+            opts.max_cycles = strtoull(optarg, NULL, 0);
+            break;
+          case 't':
+            opts.max_seconds = atof(optarg);
+            break;
+          case 'p':
+            opts.stop_pc = strtol(optarg, NULL, 0);
+            break;
+          case 's':
+            opts.stable_cycles = strtoull(optarg, NULL, 0);
+            break;
+          case 'r':
+            record_file = optarg;
+            break;
+          case 'R':
+            replay_file = optarg;
+            headless    = 1;
+            break;
+          case 'l':
+            load_file = optarg;
+            break;
+          case 'o':
+            save_file = optarg;
+            break;
+          case 'w':
+            rewind_secs = atoi(optarg);
+            break;
+          case 'T':
+            trace_len = atol(optarg);
+            break;
+          case 'F':
+            full_trace = 1;
+            break;
+          case 'V':
+            frames_file = optarg;
+            break;
+          case 'E':
+            frames_fmt = FRAMES_PBM;
+            break;
+          case 'm':
+            mute = 1;
+            break;
+          case 'X':
+            strict = 1;
+            break;
+          case 'k':
+            keymap = optarg;
+            break;
+          case 'P':
+            prof_file = optarg;
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (opts.ipf <= 0) {
+        dprintf(STDERR_FILENO, "Invalid instructions per frame: %d\n",
+                opts.ipf);
+        return EXIT_FAILURE;
+    }
+    if (record_file != NULL && headless) {
+        dprintf(STDERR_FILENO, "Only windowed sessions can be recorded\n");
+        return EXIT_FAILURE;
+    }
+    if (rewind_secs < 0 || (rewind_secs > 0 && (headless || record_file))) {
+        dprintf(STDERR_FILENO, "Rewind needs a windowed session that is not "
+                "recorded\n");
+        return EXIT_FAILURE;
+    }
+    if (save_file != NULL && !headless) {
+        dprintf(STDERR_FILENO, "Only headless runs can save their state\n");
+        return EXIT_FAILURE;
+    }
+    struct keymap map;
+    if (parse_keymap(keymap, &map) < 0) {
+        dprintf(STDERR_FILENO, "Invalid key map: %s\n", keymap);
+        return EXIT_FAILURE;
+    }
+    if (trace_len <= 0) {
+        dprintf(STDERR_FILENO, "Invalid trace length: %ld\n", trace_len);
+        return EXIT_FAILURE;
+    }
+
+    // headless mode takes no scale factor
+    int nargs = headless ? 1 : 2;
+    if (argc != nargs && argc != nargs + 1) {
+        dprintf(STDERR_FILENO, INVAL_ARG_ERR);
+        return EXIT_FAILURE;
+    }
+
+    // debug mode is enabled if an extra argument is given, the file the
+    // executed instructions are traced to
+    int debug = 0;
+    if (argc == nargs + 1) {
+        debug      = 1;
+        trace_file = argv[nargs];
+    }
+
+    // Interpreter initialization, static as it outlives main when profiled
+    static struct interpreter chip;
+    init(&chip);
+    if (load_rom(argv[0], &chip) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (load_file != NULL) {
+        struct snapshot s;
+        if (load_snapshot(load_file, &s) < 0)
+            return EXIT_FAILURE;
+        restore_snapshot(&chip, &s);
+    }
+    // faults recorded by a state saved out of strict mode are not reported
+    chip.strict = 0;
+    set_strict(&chip, strict);
+    if (debug) {
+        FILE *stream = NULL;
+        if (full_trace) {
+            stream = fopen(trace_file, "wb");
+            if (stream == NULL || trace_write_header(stream) < 0) {
+                perror("Could not open trace");
+                return EXIT_FAILURE;
+            }
+        }
+        trace = trace_create(trace_len, stream);
+        if (trace == NULL) {
+            dprintf(STDERR_FILENO, "Could not allocate trace\n");
+            return EXIT_FAILURE;
+        }
+        chip.trace = trace;
+        atexit(write_trace);
+    }
+    if (frames_file != NULL) {
+        frames = frames_open(frames_file, frames_fmt);
+        if (frames == NULL)
+            return EXIT_FAILURE;
+        opts.frames = frames;
+        atexit(close_frames);
+    }
+#ifdef CHIP8_PROFILE
+    // compiled blocks and skipped idle loops would escape the counters, the
+    // JIT and idle skipping are left out
+    if (prof_file != NULL) {
+        profile      = profile_create();
+        profile_file = prof_file;
+        if (profile == NULL) {
+            dprintf(STDERR_FILENO, "Could not allocate profile\n");
+            return EXIT_FAILURE;
+        }
+        chip.prof      = profile;
+        profiled       = &chip;
+        opts.jit       = 0;
+        opts.skip_idle = 0;
+        atexit(write_profile);
+    }
+#endif
+
+    if (headless) {
+        // a replay runs with the seed, speed and key edges of the recorded
+        // session, up to the instruction it ended at unless another budget
+        // is given
+        struct input_script    script = {NULL, 0};
+        struct headless_result res;
+        if (replay_file != NULL) {
+            if (load_input_script(replay_file, &script) < 0)
+                return EXIT_FAILURE;
+            if (script.has_seed)
+                seed_rng(&chip, script.seed);
+            if (script.ipf > 0)
+                opts.ipf = script.ipf;
+            if (opts.max_cycles == 0)
+                opts.max_cycles = script.end;
+            opts.input = &script;
+        }
+        opts.debug = debug;
+        int ret = run_headless(&chip, &opts, &res);
+        free_input_script(&script);
+        if (ret < 0)
+            return EXIT_FAILURE;
+        if (save_file != NULL) {
+            struct snapshot s;
+            take_snapshot(&chip, &s);
+            if (save_snapshot(save_file, &s) < 0)
+                return EXIT_FAILURE;
+        }
+        // the state goes to the standard error if the frames are piped
+        dump_state(frames_file != NULL && strcmp(frames_file, "-") == 0
+                ? stderr : stdout, &chip, &res);
+        return res.reason == STOP_ERR ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // Get scale from arguments
+    int scale = atoi(argv[1]);
+    if (scale <= 0) {
+        dprintf(STDERR_FILENO, "Invalid scale value: %d\n", scale);
+        return EXIT_FAILURE;
+    }
+    if (record_file == NULL) {
+        struct rewind *rw = NULL;
+        if (rewind_secs > 0) {
+            rw = rewind_create((size_t)rewind_secs * TIMERS_FREQ);
+            if (rw == NULL) {
+                dprintf(STDERR_FILENO, "Could not allocate rewind buffer\n");
+                return EXIT_FAILURE;
+            }
+        }
+        int ret = run_window(&chip, scale, opts.ipf, debug, opts.skip_idle,
+                mute, &map, NULL, rw);
+        rewind_destroy(rw);
+        return ret;
+    }
+
+    // the session is recorded with an explicit seed, so that its random
+    // numbers can be drawn again by a replay
+    FILE *rec = fopen(record_file, "w");
+    if (rec == NULL) {
+        perror("Could not open recording");
+        return EXIT_FAILURE;
+    }
+    uint64_t seed = time(NULL);
+    seed_rng(&chip, seed);
+    int ret = EXIT_FAILURE;
+    if (record_header(rec, seed, opts.ipf) == 0)
+        ret = run_window(&chip, scale, opts.ipf, debug, opts.skip_idle,
+                mute, &map, rec, NULL);
+    if (fclose(rec) == EOF) {
+        perror("Could not close recording");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
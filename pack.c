@@ -0,0 +1,281 @@
+#include "pack.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct rom_pack {
+    uint8_t                 *map;     // mapped pack file
+    size_t                   size;    // size of the mapping
+    const struct pack_entry *entries; // index, in name order
+    int                      count;   // number of entries
+};
+
+uint64_t rom_hash(const uint8_t *data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325; // FNV-1a offset basis
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3;          // FNV-1a prime
+    }
+    return h;
+}
+
+// Orders pack entries by name, for qsort.
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const struct pack_entry *)a)->name,
+            ((const struct pack_entry *)b)->name);
+}
+
+// Reads the nroms ROM files roms into entries and *data, one after the other,
+// each entry having the offset of its contents in *data. Returns 0 on success,
+// -1 otherwise.
+static int read_roms(char **roms, int nroms, struct pack_entry *entries,
+        uint8_t **data) {
+    size_t used = 0;
+    size_t cap  = 0;
+    *data = NULL;
+    for (int i = 0; i < nroms; i++) {
+        const char *name = strrchr(roms[i], '/');
+        name = name != NULL ? name + 1 : roms[i];
+        if (strlen(name) >= PACK_NAME_SIZE) {
+            dprintf(STDERR_FILENO, "%s: name too long\n", roms[i]);
+            return -1;
+        }
+        if (cap - used < MAX_ROM_SIZE) {
+            cap = cap == 0 ? 16 * MAX_ROM_SIZE : cap * 2;
+            uint8_t *grown = realloc(*data, cap);
+            if (grown == NULL) {
+                perror("Could not allocate ROM pack");
+                return -1;
+            }
+            *data = grown;
+        }
+        int size = read_rom(roms[i], *data + used);
+        if (size < 0) {
+            dprintf(STDERR_FILENO, "%s: not packed\n", roms[i]);
+            return -1;
+        }
+        memset(&entries[i], 0, sizeof(entries[i]));
+        strcpy(entries[i].name, name);
+        entries[i].hash   = rom_hash(*data + used, size);
+        entries[i].offset = used;
+        entries[i].size   = size;
+        used             += size;
+    }
+    return 0;
+}
+
+// Moves the offsets of the count entries from src, the offsets of their
+// contents in data, to where the contents go in the pack, after the index, in
+// entry order. The contents of equal ROMs are stored once, at the offset of
+// the first one. Returns 0 on success, -1 otherwise.
+static int share_contents(struct pack_entry *entries, int count,
+        const uint8_t *data, const uint32_t *src) {
+    // open addressing table of the stored contents by hash, holding entry
+    // indices plus one, 0 for an empty slot
+    size_t slots = 1;
+    while (slots < 2 * (size_t)count)
+        slots *= 2;
+    int *table = calloc(slots, sizeof(int));
+    if (table == NULL) {
+        perror("Could not allocate ROM pack");
+        return -1;
+    }
+
+    uint32_t end = sizeof(struct pack_header)
+        + count * sizeof(struct pack_entry);
+    for (int i = 0; i < count; i++) {
+        struct pack_entry *e = &entries[i];
+        size_t             s = e->hash & (slots - 1);
+        while (table[s] != 0) {
+            int o = table[s] - 1;
+            if (entries[o].hash == e->hash && entries[o].size == e->size
+                    && memcmp(data + src[o], data + src[i], e->size) == 0)
+                break;
+            s = (s + 1) & (slots - 1);
+        }
+        if (table[s] != 0) {
+            e->offset = entries[table[s] - 1].offset;
+        } else {
+            table[s]   = i + 1;
+            e->offset  = end;
+            end       += e->size;
+        }
+    }
+    free(table);
+    return 0;
+}
+
+int pack_build(const char *filename, char **roms, int nroms) {
+    if (filename == NULL || roms == NULL || nroms <= 0)
+        return -1;
+    struct pack_entry *entries = calloc(nroms, sizeof(struct pack_entry));
+    uint32_t          *src     = calloc(nroms, sizeof(uint32_t));
+    uint8_t           *data    = NULL;
+    FILE              *out     = NULL;
+    int                ret     = -1;
+    if (entries == NULL || src == NULL) {
+        perror("Could not allocate ROM pack");
+        goto clean_up;
+    }
+    if (read_roms(roms, nroms, entries, &data) < 0)
+        goto clean_up;
+
+    qsort(entries, nroms, sizeof(struct pack_entry), compare_names);
+    for (int i = 0; i < nroms; i++) {
+        if (i > 0 && strcmp(entries[i - 1].name, entries[i].name) == 0) {
+            dprintf(STDERR_FILENO, "%s: packed twice\n", entries[i].name);
+            goto clean_up;
+        }
+        src[i] = entries[i].offset;
+    }
+    if (share_contents(entries, nroms, data, src) < 0)
+        goto clean_up;
+
+    out = fopen(filename, "wb");
+    if (out == NULL) {
+        perror("Could not open ROM pack");
+        goto clean_up;
+    }
+    struct pack_header h;
+    memcpy(h.magic, PACK_MAGIC, sizeof(h.magic));
+    h.version    = PACK_VERSION;
+    h.count      = nroms;
+    h.entry_size = sizeof(struct pack_entry);
+    int ok = fwrite(&h, sizeof(h), 1, out) == 1
+        && fwrite(entries, sizeof(struct pack_entry), nroms, out)
+            == (size_t)nroms;
+    // an entry whose contents are not stored yet has them at the end
+    uint32_t end = sizeof(h) + nroms * sizeof(struct pack_entry);
+    for (int i = 0; ok && i < nroms; i++) {
+        if (entries[i].offset != end)
+            continue;
+        ok   = fwrite(data + src[i], entries[i].size, 1, out) == 1;
+        end += entries[i].size;
+    }
+    if (fclose(out) == EOF)
+        ok = 0;
+    if (!ok)
+        perror("Could not write ROM pack");
+    ret = ok ? 0 : -1;
+
+ clean_up:
+    free(entries);
+    free(src);
+    free(data);
+    return ret;
+}
+
+struct rom_pack *pack_open(const char *filename) {
+    if (filename == NULL)
+        return NULL;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Could not open ROM pack");
+        return NULL;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        perror("fstat()");
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)sb.st_size < sizeof(struct pack_header)) {
+        dprintf(STDERR_FILENO, "%s: not a ROM pack\n", filename);
+        close(fd);
+        return NULL;
+    }
+    uint8_t *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap()");
+        return NULL;
+    }
+
+    struct rom_pack *p = malloc(sizeof(struct rom_pack));
+    if (p == NULL) {
+        perror("Could not allocate ROM pack");
+        munmap(map, sb.st_size);
+        return NULL;
+    }
+    const struct pack_header *h = (const struct pack_header *)map;
+    p->map     = map;
+    p->size    = sb.st_size;
+    p->entries = (const struct pack_entry *)(h + 1);
+    p->count   = h->count;
+
+    // the ROMs are checked here once, so that loading them is a mere copy
+    int valid = memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) == 0
+        && h->version == PACK_VERSION
+        && h->entry_size == sizeof(struct pack_entry)
+        && h->count <= (p->size - sizeof(*h)) / sizeof(struct pack_entry);
+    for (int i = 0; valid && i < p->count; i++) {
+        const struct pack_entry *e = &p->entries[i];
+        valid = memchr(e->name, '\0', PACK_NAME_SIZE) != NULL
+            && (i == 0 || strcmp(p->entries[i - 1].name, e->name) < 0)
+            && e->size > 0 && e->size <= MAX_ROM_SIZE
+            && e->offset <= p->size && e->size <= p->size - e->offset;
+    }
+    if (!valid) {
+        dprintf(STDERR_FILENO, "%s: not a ROM pack of this interpreter\n",
+                filename);
+        pack_close(p);
+        return NULL;
+    }
+    return p;
+}
+
+void pack_close(struct rom_pack *p) {
+    if (p == NULL)
+        return;
+    munmap(p->map, p->size);
+    free(p);
+}
+
+int pack_count(const struct rom_pack *p) {
+    return p != NULL ? p->count : 0;
+}
+
+const struct pack_entry *pack_entry(const struct rom_pack *p, int index) {
+    if (p == NULL || index < 0 || index >= p->count)
+        return NULL;
+    return &p->entries[index];
+}
+
+int pack_find(const struct rom_pack *p, const char *name) {
+    if (p == NULL || name == NULL)
+        return PACK_NONE;
+    int lo = 0;
+    int hi = p->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(p->entries[mid].name, name);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return PACK_NONE;
+}
+
+int pack_find_hash(const struct rom_pack *p, uint64_t hash) {
+    if (p == NULL)
+        return PACK_NONE;
+    for (int i = 0; i < p->count; i++) {
+        if (p->entries[i].hash == hash)
+            return i;
+    }
+    return PACK_NONE;
+}
+
+int pack_load(const struct rom_pack *p, int index, struct interpreter *chip) {
+    if (p == NULL || chip == NULL || index < 0 || index >= p->count)
+        return -1;
+    const struct pack_entry *e = &p->entries[index];
+    return load_rom_buffer(p->map + e->offset, e->size, chip);
+}
@@ -0,0 +1,84 @@
+#ifndef PACK_H
+#define PACK_H
+#include <stddef.h>
+#include <stdint.h>
+#include "interpreter.h"
+
+#define PACK_MAGIC     "CH8P" // First bytes of a ROM pack
+#define PACK_VERSION   1      // Format of the ROM packs
+#define PACK_NAME_SIZE 112    // Size of a ROM name, with its final '\0'
+#define PACK_NONE      (-1)   // Index of a ROM that is not in a pack
+
+/*
+ * Header of a ROM pack, in the byte order of the host. It is followed by
+ * count entries sorted by name, then by the contents of the ROMs. ROMs with
+ * the same contents share them.
+ */
+struct pack_header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t count;      // number of entries
+    uint32_t entry_size; // size of an entry, sizeof(struct pack_entry)
+};
+
+struct pack_entry {
+    char     name[PACK_NAME_SIZE]; // file name of the ROM, without directory
+    uint64_t hash;                 // rom_hash of the contents
+    uint32_t offset;               // offset of the contents in the pack
+    uint32_t size;                 // size of the contents, in bytes
+};
+
+struct rom_pack;
+
+/*
+ * Builds the ROM pack filename from the nroms ROM files roms, which are
+ * checked as load_rom does. ROMs are named after their file name, which must
+ * be unique and shorter than PACK_NAME_SIZE. Returns 0 on success, -1
+ * otherwise (an error message is printed).
+ */
+int pack_build(const char *filename, char **roms, int nroms);
+
+/*
+ * Maps the ROM pack filename in memory and checks its index. Returns NULL on
+ * failure (an error message is printed).
+ */
+struct rom_pack *pack_open(const char *filename);
+
+/*
+ * Unmaps p.
+ */
+void pack_close(struct rom_pack *p);
+
+/*
+ * Returns the number of ROMs of p.
+ */
+int pack_count(const struct rom_pack *p);
+
+/*
+ * Returns the entry of the index-th ROM of p, in name order.
+ */
+const struct pack_entry *pack_entry(const struct rom_pack *p, int index);
+
+/*
+ * Returns the index of the ROM named name in p, PACK_NONE if there is none.
+ */
+int pack_find(const struct rom_pack *p, const char *name);
+
+/*
+ * Returns the index of the first ROM of p whose contents hash to hash,
+ * PACK_NONE if there is none.
+ */
+int pack_find_hash(const struct rom_pack *p, uint64_t hash);
+
+/*
+ * Loads the index-th ROM of p into chip, as load_rom does, with a single copy
+ * from the mapped pack. Returns 0 on success, -1 otherwise.
+ */
+int pack_load(const struct rom_pack *p, int index, struct interpreter *chip);
+
+/*
+ * Returns the FNV-1a hash of the size bytes of data.
+ */
+uint64_t rom_hash(const uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pack.h"
+
+// Prints the index of the ROM pack filename, a ROM per line: content hash,
+// size, offset and name. Returns 0 on success, -1 otherwise.
+static int list_pack(const char *filename) {
+    struct rom_pack *p = pack_open(filename);
+    if (p == NULL)
+        return -1;
+    for (int i = 0; i < pack_count(p); i++) {
+        const struct pack_entry *e = pack_entry(p, i);
+        printf("%016llx %5u %8u %s\n", (unsigned long long)e->hash, e->size,
+                e->offset, e->name);
+    }
+    pack_close(p);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int list = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "l")) != -1) {
+        switch (opt) {
+          case 'l':
+            list = 1;
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (list ? argc - optind != 1 : argc - optind < 2) {
+        dprintf(STDERR_FILENO, "Usage: %s <pack> <rom>...\n"
+                "       %s -l <pack>\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (list)
+        return list_pack(argv[optind]) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (pack_build(argv[optind], argv + optind + 1, argc - optind - 1) < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+#include "profile.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define TOP_SIZE 10 // Entries of the text report top lists
+
+struct profile *profile_create(void) {
+    return calloc(1, sizeof(struct profile));
+}
+
+void profile_destroy(struct profile *p) {
+    free(p);
+}
+
+// Returns the current value of the monotonic clock in nanoseconds.
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t profile_draw_begin(struct profile *p) {
+    if (p == NULL)
+        return 0;
+    p->frame_draws++;
+    if (p->draws++ % DRAW_SAMPLE != 0)
+        return 0;
+    return now_ns();
+}
+
+void profile_draw_end(struct profile *p, uint64_t start) {
+    if (p == NULL || start == 0)
+        return;
+    p->draw_ns += now_ns() - start;
+    p->timed_draws++;
+}
+
+void profile_frame(struct profile *p) {
+    if (p == NULL)
+        return;
+    p->frames++;
+    if (p->frame_draws > p->max_frame_draws)
+        p->max_frame_draws = p->frame_draws;
+    p->draw_hist[p->frame_draws < DRAW_HIST_SIZE ? p->frame_draws
+        : DRAW_HIST_SIZE - 1]++;
+    p->frame_draws = 0;
+}
+
+// Returns the number of instructions counted by p.
+static uint64_t count_instrs(const struct profile *p) {
+    uint64_t n = 0;
+    for (int op = 0; op < OP_COUNT; op++)
+        n += p->ops[op];
+    return n;
+}
+
+// Returns the target of the backward jump at addr in the RAM of chip, or -1
+// if there is none.
+static int loop_start(const struct interpreter *chip, int addr) {
+    if (addr + 1 >= RAM_SIZE)
+        return -1;
+    uint16_t instr = chip->ram[addr] << 8 | chip->ram[addr + 1];
+    if ((instr & 0xf000) != 0x1000 || (instr & 0x0fff) > addr)
+        return -1;
+    return instr & 0x0fff;
+}
+
+// Returns the estimated time in ns spent in all the draws of p.
+static double draw_time(const struct profile *p) {
+    if (p->timed_draws == 0)
+        return 0;
+    return (double)p->draw_ns * p->draws / p->timed_draws;
+}
+
+// Fills top with the (at most n) addresses of the largest counts, in
+// decreasing order, only keeping the backward jumps of chip if it is not NULL.
+// Returns the number of addresses found.
+static int top_addresses(const uint64_t *counts, uint16_t *top, int n,
+        const struct interpreter *chip) {
+    int found = 0;
+    for (int a = 0; a < RAM_SIZE; a++) {
+        if (counts[a] == 0 || (found == n && counts[a] <= counts[top[n - 1]]))
+            continue;
+        if (chip != NULL && loop_start(chip, a) < 0)
+            continue;
+        int i = found < n ? found++ : n - 1;
+        while (i > 0 && counts[top[i - 1]] < counts[a]) {
+            top[i] = top[i - 1];
+            i--;
+        }
+        top[i] = a;
+    }
+    return found;
+}
+
+void profile_write_json(FILE *out, const struct profile *p,
+        const struct interpreter *chip) {
+    if (out == NULL || p == NULL || chip == NULL)
+        return;
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"frames\": %llu,\n",
+            (unsigned long long)count_instrs(p),
+            (unsigned long long)p->frames);
+
+    fprintf(out, "  \"opcodes\": {");
+    const char *sep = "";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (p->ops[op] == 0)
+            continue;
+        fprintf(out, "%s\n    \"%s\": %llu", sep, op_name(op),
+                (unsigned long long)p->ops[op]);
+        sep = ",";
+    }
+    fprintf(out, "\n  },\n");
+
+    fprintf(out, "  \"pcs\": {");
+    sep = "";
+    for (int a = 0; a < RAM_SIZE; a++) {
+        if (p->pcs[a] == 0)
+            continue;
+        fprintf(out, "%s\n    \"0x%03x\": %llu", sep, a,
+                (unsigned long long)p->pcs[a]);
+        sep = ",";
+    }
+    fprintf(out, "\n  },\n");
+
+    // loops by jump address, with the instructions executed in their body
+    fprintf(out, "  \"loops\": [");
+    sep = "";
+    for (int a = 0; a < RAM_SIZE; a++) {
+        int start = loop_start(chip, a);
+        if (start < 0 || p->pcs[a] == 0)
+            continue;
+        uint64_t body = 0;
+        for (int i = start; i <= a; i++)
+            body += p->pcs[i];
+        fprintf(out, "%s\n    {\"from\": \"0x%03x\", \"to\": \"0x%03x\", "
+                "\"iterations\": %llu, \"instructions\": %llu}", sep, a,
+                start, (unsigned long long)p->pcs[a],
+                (unsigned long long)body);
+        sep = ",";
+    }
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"draws\": {\n    \"count\": %llu,\n"
+            "    \"max_per_frame\": %llu,\n"
+            "    \"avg_per_frame\": %.3f,\n    \"per_frame_histogram\": [",
+            (unsigned long long)p->draws,
+            (unsigned long long)p->max_frame_draws,
+            p->frames > 0 ? (double)p->draws / p->frames : 0);
+    for (int i = 0; i < DRAW_HIST_SIZE; i++) {
+        fprintf(out, "%s%llu", i > 0 ? ", " : "",
+                (unsigned long long)p->draw_hist[i]);
+    }
+    fprintf(out, "],\n    \"estimated_ns\": %.0f,\n    \"ns_per_draw\": %.1f\n"
+            "  }\n}\n", draw_time(p),
+            p->timed_draws > 0 ? (double)p->draw_ns / p->timed_draws : 0);
+}
+
+void profile_write_text(FILE *out, const struct profile *p,
+        const struct interpreter *chip) {
+    if (out == NULL || p == NULL || chip == NULL)
+        return;
+    uint64_t instrs = count_instrs(p);
+    double   total  = instrs > 0 ? instrs : 1;
+    fprintf(out, "%llu instructions, %llu frames\n",
+            (unsigned long long)instrs, (unsigned long long)p->frames);
+    fprintf(out, "opcodes:\n");
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (p->ops[op] > 0) {
+            fprintf(out, "  %-8s %12llu %6.2f%%\n", op_name(op),
+                    (unsigned long long)p->ops[op], 100 * p->ops[op] / total);
+        }
+    }
+
+    uint16_t top[TOP_SIZE];
+    int      n = top_addresses(p->pcs, top, TOP_SIZE, NULL);
+    fprintf(out, "hottest addresses:\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "  0x%03x %12llu %6.2f%%\n", top[i],
+                (unsigned long long)p->pcs[top[i]],
+                100 * p->pcs[top[i]] / total);
+    }
+    n = top_addresses(p->pcs, top, TOP_SIZE, chip);
+    fprintf(out, "hottest loops:\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "  0x%03x-0x%03x %12llu iterations\n",
+                loop_start(chip, top[i]), top[i],
+                (unsigned long long)p->pcs[top[i]]);
+    }
+    fprintf(out, "draws: %llu, %.2f per frame (max %llu), %.0f ns each\n",
+            (unsigned long long)p->draws,
+            p->frames > 0 ? (double)p->draws / p->frames : 0,
+            (unsigned long long)p->max_frame_draws,
+            p->timed_draws > 0 ? (double)p->draw_ns / p->timed_draws : 0);
+}
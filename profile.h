@@ -0,0 +1,78 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <stdint.h>
+#include <stdio.h>
+#include "interpreter.h"
+
+#define DRAW_HIST_SIZE 16  // Draws per frame histogram buckets, the last one
+                           // counts the frames with more draws
+#define DRAW_SAMPLE    256 // One draw out of DRAW_SAMPLE is timed
+
+/*
+ * Execution profile of an interpreter, filled by the hooks below when the
+ * interpreter is built with CHIP8_PROFILE and chip->prof points to it.
+ * Instructions run by compiled JIT blocks are not counted.
+ */
+struct profile {
+    uint64_t ops[OP_COUNT];               // executions by operation
+    uint64_t pcs[RAM_SIZE];               // executions by address
+    uint64_t frames;                      // timer updates
+    uint64_t draws;                       // executed Dxyn
+    uint64_t frame_draws;                 // Dxyn of the current frame
+    uint64_t max_frame_draws;             // most Dxyn in a frame
+    uint64_t draw_hist[DRAW_HIST_SIZE];   // frames by number of Dxyn
+    uint64_t timed_draws;                 // Dxyn that were timed
+    uint64_t draw_ns;                     // time spent in the timed Dxyn
+};
+
+/*
+ * Allocates a zeroed profile. Returns NULL on failure.
+ */
+struct profile *profile_create(void);
+
+/*
+ * Releases p.
+ */
+void profile_destroy(struct profile *p);
+
+/*
+ * Writes the report of p, the profile of chip, to out, as JSON or as text for
+ * a terminal. Loops are the backward jumps (1nnn) found in the RAM of chip,
+ * their iterations being the executions of the jump address. The text report
+ * only holds the hottest addresses and loops.
+ */
+void profile_write_json(FILE *out, const struct profile *p,
+        const struct interpreter *chip);
+void profile_write_text(FILE *out, const struct profile *p,
+        const struct interpreter *chip);
+
+// Counts the instruction d fetched at pc.
+static inline void profile_instr(struct profile *p,
+        const struct decoded_instr *d, uint16_t pc) {
+    if (p == NULL)
+        return;
+    p->ops[d->op]++;
+    p->pcs[pc]++;
+}
+
+// Counts a draw, returns its start time in ns if it is to be timed, else 0.
+uint64_t profile_draw_begin(struct profile *p);
+void profile_draw_end(struct profile *p, uint64_t start);
+
+// Closes the current frame of p.
+void profile_frame(struct profile *p);
+
+#ifdef CHIP8_PROFILE
+#define PROFILE_INSTR(chip, d, pc) profile_instr((chip)->prof, d, pc)
+#define PROFILE_DRAW_BEGIN(chip) \
+    uint64_t profile_start_ = profile_draw_begin((chip)->prof)
+#define PROFILE_DRAW_END(chip)   profile_draw_end((chip)->prof, profile_start_)
+#define PROFILE_FRAME(chip)      profile_frame((chip)->prof)
+#else
+#define PROFILE_INSTR(chip, d, pc)
+#define PROFILE_DRAW_BEGIN(chip)
+#define PROFILE_DRAW_END(chip)
+#define PROFILE_FRAME(chip)
+#endif
+
+#endif
@@ -0,0 +1,510 @@
+#define _GNU_SOURCE // memfd_create
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+
+#define MAX_CLIENTS   64   // Maximal number of connected clients
+#define MAX_THREADS   256  // Maximal number of worker threads
+#define SERVER_LANES  64   // Default number of instances
+#define STEP_CHUNK    4    // Instances a worker takes at once
+#define SLOT_ALIGN    64   // Alignment of the slots, a cache line
+
+// ROM of an instance, kept out of the shared memory for the resets
+struct slot_rom {
+    uint8_t  data[MAX_ROM_SIZE];
+    size_t   size;
+    uint64_t seed;
+};
+
+// Instance of the server, out of the shared memory, so that the clients only
+// see the copy of its state in its slot
+struct instance {
+    struct interpreter chip;
+    struct proc_state  ps;     // state of the error if status is SLOT_ERROR
+    uint64_t           cycles; // instructions executed since the load
+    uint64_t           frames; // frames run since the load
+    uint32_t           status; // SLOT_RUNNING, SLOT_EXITED or SLOT_ERROR
+    struct slot_rom    rom;
+};
+
+struct server {
+    uint8_t              *mem;    // shared memory
+    size_t                size;   // size of the shared memory
+    int                   memfd;  // shared memory file, sent to the clients
+    struct server_header *header;
+    struct instance      *insts;  // instances, their slots in the same order
+};
+
+// Workers running the instances of a step request. The main thread runs its
+// share too, then waits for the others.
+struct pool {
+    pthread_mutex_t        lock;
+    pthread_cond_t         wake;    // a request is ready, or the pool stops
+    pthread_cond_t         done;    // a worker is done with the request
+    uint64_t               round;   // number of the current request
+    int                    busy;    // workers still running the request
+    int                    stop;    // 1 once the workers must exit
+    int                    nthreads;
+    pthread_t              threads[MAX_THREADS];
+    struct server         *srv;
+    const struct server_request *req;
+    atomic_uint            next;    // next instance of the request to run
+    atomic_uint_least64_t  cycles;  // instructions executed for the request
+};
+
+static volatile sig_atomic_t stopped = 0;
+
+// Stops the server on SIGINT and SIGTERM.
+static void handle_stop(int sig) {
+    stopped = 1;
+}
+
+// Returns the i-th instance of srv.
+static struct server_slot *slot(struct server *srv, uint32_t i) {
+    return (struct server_slot *)(srv->mem + srv->header->slot_offset
+            + i * srv->header->slot_size);
+}
+
+// Copies the state of the instance in to its slot s, the keypad too if keys.
+static void publish(const struct instance *in, struct server_slot *s,
+        int keys) {
+    const struct interpreter *chip = &in->chip;
+    memcpy(s->vbuf, chip->vbuf, sizeof(s->vbuf));
+    memcpy(s->registers, chip->registers, sizeof(s->registers));
+    if (keys)
+        memcpy(s->keyboard, chip->keyboard, sizeof(s->keyboard));
+    s->cycles    = in->cycles;
+    s->frames    = in->frames;
+    s->status    = in->status;
+    s->I         = chip->I;
+    s->pc        = chip->pc;
+    s->err_instr = in->ps.curr_instr;
+    s->err_pc    = in->ps.pc;
+    s->err_code  = in->ps.err_code;
+    s->dt        = chip->dt;
+    s->st        = chip->st;
+    s->hires     = chip->hires;
+}
+
+// Puts the i-th instance of srv back in the state that followed the load of
+// its ROM, its keys up.
+static void reset_slot(struct server *srv, uint32_t i) {
+    struct instance *in = &srv->insts[i];
+    init(&in->chip);
+    seed_rng(&in->chip, in->rom.seed);
+    load_rom_buffer(in->rom.data, in->rom.size, &in->chip);
+    memset(&in->ps, 0, sizeof(in->ps));
+    in->cycles = 0;
+    in->frames = 0;
+    in->status = SLOT_RUNNING;
+    publish(in, slot(srv, i), 1);
+}
+
+// Copies the registers, I, PC, timers and keypad of the slot s to the
+// instance in, the only fields of a slot its clients may change.
+static void fetch_slot(struct instance *in, const struct server_slot *s) {
+    struct interpreter *chip = &in->chip;
+    memcpy(chip->registers, s->registers, sizeof(chip->registers));
+    for (int k = 0; k < KEYBOARD_SIZE; k++)
+        chip->keyboard[k] = s->keyboard[k] != KEY_UP ? KEY_DOWN : KEY_UP;
+    chip->I  = s->I;
+    chip->pc = s->pc;
+    chip->dt = s->dt;
+    chip->st = s->st;
+}
+
+// Runs frames frames of ipf instructions followed by a timers update on the
+// i-th instance of srv, with the registers, I, PC, timers and keypad of its
+// slot, until its ROM exits or its processor reports an error. The keys do not change during a request,
+// so that an idle loop is skipped up to the end of the frame. Returns the
+// number of executed instructions.
+static uint64_t step_slot(struct server *srv, uint32_t i, uint32_t frames,
+        int ipf) {
+    struct instance    *s   = &srv->insts[i];
+    struct server_slot *out = slot(srv, i);
+    fetch_slot(s, out);
+    uint64_t n = 0;
+    for (uint32_t f = 0; f < frames && s->status == SLOT_RUNNING; f++) {
+        int left = ipf;
+        while (left > 0) {
+            struct proc_state ps;
+            int done = run_rom_cycles(&s->chip, &ps, left);
+            n    += done;
+            left -= done;
+            if (ps.err_code > 0) {
+                s->ps     = ps;
+                s->status = SLOT_ERROR;
+                break;
+            }
+            if (s->chip.exited) {
+                s->status = SLOT_EXITED;
+                break;
+            }
+            if (ps.idle_period > 0) {
+                int skip = left - left % ps.idle_period;
+                n    += skip;
+                left -= skip;
+            }
+        }
+        if (s->status != SLOT_RUNNING)
+            break;
+        update_timers(&s->chip);
+        s->frames++;
+    }
+    s->cycles += n;
+    publish(s, out, 0);
+    return n;
+}
+
+// Runs the instances of the current request of p until none is left.
+static void run_share(struct pool *p) {
+    const struct server_request *req = p->req;
+    uint64_t n = 0;
+    for (;;) {
+        uint32_t i = atomic_fetch_add(&p->next, STEP_CHUNK);
+        if (i >= req->count)
+            break;
+        uint32_t end = i + STEP_CHUNK < req->count ? i + STEP_CHUNK
+            : req->count;
+        for (; i < end; i++)
+            n += step_slot(p->srv, req->first + i, req->frames,
+                    p->srv->header->ipf);
+    }
+    atomic_fetch_add(&p->cycles, n);
+}
+
+// Worker thread of the pool arg.
+static void *work(void *arg) {
+    struct pool *p     = arg;
+    uint64_t     round = 0;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->stop && p->round == round)
+            pthread_cond_wait(&p->wake, &p->lock);
+        if (p->stop)
+            break;
+        round = p->round;
+        pthread_mutex_unlock(&p->lock);
+        run_share(p);
+        pthread_mutex_lock(&p->lock);
+        if (--p->busy == 0)
+            pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Runs the step request req on the workers of p. Returns the number of
+// executed instructions.
+static uint64_t run_step(struct pool *p, const struct server_request *req) {
+    p->req = req;
+    atomic_store(&p->next, 0);
+    atomic_store(&p->cycles, 0);
+    pthread_mutex_lock(&p->lock);
+    p->round++;
+    p->busy = p->nthreads;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    run_share(p);
+    pthread_mutex_lock(&p->lock);
+    while (p->busy > 0)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+    return atomic_load(&p->cycles);
+}
+
+// Starts nthreads workers besides the main thread, which alone takes the
+// signals. Returns 0 on success, -1 otherwise.
+static int pool_start(struct pool *p, struct server *srv, int nthreads) {
+    sigset_t set, old;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->round    = 0;
+    p->busy     = 0;
+    p->stop     = 0;
+    p->nthreads = 0;
+    p->srv      = srv;
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&p->threads[i], NULL, work, p) != 0) {
+            perror("pthread_create()");
+            break;
+        }
+        p->nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return p->nthreads == nthreads ? 0 : -1;
+}
+
+// Stops the workers of p.
+static void pool_stop(struct pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->nthreads; i++)
+        pthread_join(p->threads[i], NULL);
+}
+
+// Serves req, storing the result to *res.
+static void serve(struct server *srv, struct pool *p,
+        const struct server_request *req, struct server_response *res) {
+    memset(res, 0, sizeof(*res));
+    uint32_t count = srv->header->count;
+    if (req->first >= count || req->count > count - req->first) {
+        res->status = -1;
+        return;
+    }
+    switch (req->type) {
+      case SERVER_STEP:
+        res->cycles = run_step(p, req);
+        break;
+      case SERVER_LOAD: {
+        // the path comes from the client, which may not have ended it
+        if (memchr(req->path, '\0', SERVER_PATH_SIZE) == NULL) {
+            res->status = -1;
+            return;
+        }
+        struct slot_rom rom;
+        int size = read_rom(req->path, rom.data);
+        if (size < 0) {
+            res->status = -1;
+            return;
+        }
+        for (uint32_t i = req->first; i < req->first + req->count; i++) {
+            memcpy(srv->insts[i].rom.data, rom.data, size);
+            srv->insts[i].rom.size = size;
+        }
+      } // fall through
+      case SERVER_RESET:
+        for (uint32_t i = 0; i < req->count; i++) {
+            srv->insts[req->first + i].rom.seed = req->seed + i;
+            reset_slot(srv, req->first + i);
+        }
+        break;
+      default:
+        res->status = -1;
+        return;
+    }
+    for (uint32_t i = req->first; i < req->first + req->count; i++) {
+        res->exited += srv->insts[i].status == SLOT_EXITED;
+        res->errors += srv->insts[i].status == SLOT_ERROR;
+    }
+}
+
+// Sends the shared memory of srv to the new client fd. Returns 0 on success,
+// -1 otherwise.
+static int send_memory(struct server *srv, int fd) {
+    char          byte = 0;
+    struct iovec  iov  = {&byte, 1};
+    union {
+        struct cmsghdr hdr;
+        char           buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = {0};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type  = SCM_RIGHTS;
+    c->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &srv->memfd, sizeof(int));
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+        perror("Could not send the shared memory");
+        return -1;
+    }
+    return 0;
+}
+
+// Creates the shared memory of srv for count instances of the ROM file rom,
+// the i-th one being seeded with i. Returns 0 on success, -1 otherwise.
+static int create_memory(struct server *srv, const char *rom, uint32_t count,
+        int ipf) {
+    struct slot_rom first;
+    int             size = read_rom(rom, first.data);
+    if (size < 0)
+        return -1;
+    size_t slot_size   = (sizeof(struct server_slot) + SLOT_ALIGN - 1)
+        / SLOT_ALIGN * SLOT_ALIGN;
+    size_t slot_offset = (sizeof(struct server_header) + SLOT_ALIGN - 1)
+        / SLOT_ALIGN * SLOT_ALIGN;
+    srv->size  = slot_offset + count * slot_size;
+    srv->insts = malloc(count * sizeof(struct instance));
+    srv->memfd = memfd_create("chip8-server", MFD_CLOEXEC);
+    if (srv->insts == NULL || srv->memfd < 0
+            || ftruncate(srv->memfd, srv->size) < 0) {
+        perror("Could not create the shared memory");
+        return -1;
+    }
+    srv->mem = mmap(NULL, srv->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            srv->memfd, 0);
+    if (srv->mem == MAP_FAILED) {
+        perror("mmap()");
+        return -1;
+    }
+
+    srv->header = (struct server_header *)srv->mem;
+    memcpy(srv->header->magic, SERVER_MAGIC, 4);
+    srv->header->version     = SERVER_VERSION;
+    srv->header->count       = count;
+    srv->header->ipf         = ipf;
+    srv->header->slot_offset = slot_offset;
+    srv->header->slot_size   = slot_size;
+    srv->header->size        = srv->size;
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(srv->insts[i].rom.data, first.data, size);
+        srv->insts[i].rom.size = size;
+        srv->insts[i].rom.seed = i;
+        reset_slot(srv, i);
+    }
+    return 0;
+}
+
+// Returns a socket listening on path, -1 on failure. The socket is bound to
+// a temporary name first, so that path only appears once it accepts clients.
+static int listen_on(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    char               tmp[sizeof(addr.sun_path)];
+    if (snprintf(tmp, sizeof(tmp), "%s.new", path) >= (int)sizeof(tmp)) {
+        dprintf(STDERR_FILENO, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, tmp);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(tmp);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(fd, MAX_CLIENTS) < 0 || rename(tmp, path) < 0) {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    return fd;
+}
+
+// Serves the clients of the socket listener until SIGINT or SIGTERM.
+static void serve_clients(struct server *srv, struct pool *p, int listener) {
+    struct pollfd fds[MAX_CLIENTS + 1];
+    int           nfds = 1;
+    fds[0].fd     = listener;
+    fds[0].events = POLLIN;
+    while (!stopped) {
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno != EINTR)
+                perror("poll()");
+            continue;
+        }
+        for (int i = nfds - 1; i >= 1; i--) {
+            if (fds[i].revents == 0)
+                continue;
+            struct server_request  req;
+            struct server_response res;
+            ssize_t len = recv(fds[i].fd, &req, sizeof(req), 0);
+            if (len == sizeof(req)) {
+                serve(srv, p, &req, &res);
+                if (send(fds[i].fd, &res, sizeof(res), MSG_NOSIGNAL)
+                        == sizeof(res))
+                    continue;
+            } else if (len > 0) {
+                memset(&res, 0, sizeof(res));
+                res.status = -1;
+                if (send(fds[i].fd, &res, sizeof(res), MSG_NOSIGNAL)
+                        == sizeof(res))
+                    continue;
+            }
+            // the client left, or is not following the protocol
+            close(fds[i].fd);
+            fds[i] = fds[--nfds];
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0)
+                continue;
+            if (nfds == MAX_CLIENTS + 1 || send_memory(srv, fd) < 0) {
+                close(fd);
+                continue;
+            }
+            fds[nfds].fd     = fd;
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+    }
+    for (int i = 1; i < nfds; i++)
+        close(fds[i].fd);
+}
+
+int main(int argc, char **argv) {
+    int         count    = SERVER_LANES;
+    int         ipf      = DEFAULT_IPF;
+    int         nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *path     = SERVER_SOCKET;
+    int         opt;
+    while ((opt = getopt(argc, argv, "n:i:j:s:")) != -1) {
+        switch (opt) {
+          case 'n':
+            count = atoi(optarg);
+            break;
+          case 'i':
+            ipf = atoi(optarg);
+            break;
+          case 'j':
+            nthreads = atoi(optarg);
+            break;
+          case 's':
+            path = optarg;
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (count <= 0 || ipf <= 0 || argc - optind != 1) {
+        dprintf(STDERR_FILENO, "Usage: %s [-n <instances>] [-i <count>] "
+                "[-j <threads>] [-s <socket>] <rom>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (nthreads <= 0)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    struct server srv;
+    if (create_memory(&srv, argv[optind], count, ipf) < 0)
+        return EXIT_FAILURE;
+    int listener = listen_on(path);
+    if (listener < 0)
+        return EXIT_FAILURE;
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // the main thread is a worker too
+    static struct pool pool;
+    int ret = EXIT_SUCCESS;
+    if (pool_start(&pool, &srv, nthreads - 1) < 0)
+        ret = EXIT_FAILURE;
+    else
+        serve_clients(&srv, &pool, listener);
+    pool_stop(&pool);
+    close(listener);
+    unlink(path);
+    return ret;
+}
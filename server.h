@@ -0,0 +1,126 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdint.h>
+#include "interpreter.h"
+
+#define SERVER_MAGIC     "CH8M"       // First bytes of the shared memory
+#define SERVER_VERSION   2            // Format of the shared memory and
+                                      // of the requests
+#define SERVER_SOCKET    "chip8.sock" // Default path of the server socket
+#define SERVER_PATH_SIZE 256          // Size of a ROM path, with its '\0'
+
+#define SERVER_STEP      0 // Request: runs frames frames on the instances
+#define SERVER_RESET     1 // Request: reloads the ROM of the instances
+#define SERVER_LOAD      2 // Request: loads the ROM path into the instances
+
+#define SLOT_RUNNING     0 // Status: the instance runs
+#define SLOT_EXITED      1 // Status: the ROM exited (00FD)
+#define SLOT_ERROR       2 // Status: the processor reported an error
+
+/*
+ * Header of the shared memory of a server, in the byte order of the host. It
+ * is followed by count slots of slot_size bytes, the first one at slot_offset.
+ */
+struct server_header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t count;       // number of instances
+    uint32_t ipf;         // instructions per frame
+    uint64_t slot_offset; // offset of the first slot
+    uint64_t slot_size;   // size of a slot, sizeof(struct server_slot) or more
+    uint64_t size;        // size of the shared memory
+};
+
+/*
+ * Instance of a server as seen by its clients. The instance itself stays in
+ * the server, which copies the registers, I, PC, timers and keypad from the
+ * slot before running it, and its state to the slot after every request that
+ * covers it. Between two such requests, a client reads the display (vbuf and
+ * hires, laid out as interpreter.vbuf) and may change the registers, I, PC,
+ * timers and keypad (keyboard, a key being down unless it is KEY_UP) in
+ * place; writes to the display, counts, status and error are overwritten by
+ * the next request. All the fields have a fixed size and offset, whatever
+ * the build options of the server.
+ */
+struct server_slot {
+    uint64_t vbuf[VBUF_SIZE];           // video buffer
+    uint64_t cycles;                    // instructions executed since the load
+    uint64_t frames;                    // frames run since the load
+    uint32_t status;                    // SLOT_RUNNING, SLOT_EXITED or
+                                        // SLOT_ERROR
+    uint16_t I;                         // addr storage register
+    uint16_t pc;                        // program counter
+    uint16_t err_instr;                 // instruction and address of the
+    uint16_t err_pc;                    // error if status is SLOT_ERROR
+    uint8_t  err_code;                  // error code if status is SLOT_ERROR
+    uint8_t  dt;                        // delay timer
+    uint8_t  st;                        // sound timer
+    uint8_t  hires;                     // 1 in high resolution mode
+    uint8_t  registers[REGISTERS_SIZE]; // general purpose registers
+    uint8_t  keyboard[KEYBOARD_SIZE];   // keypad, set by the client
+};
+
+/*
+ * Request to a server, about the count instances from first. SERVER_STEP runs
+ * frames frames of ipf instructions followed by a timers update on every
+ * running instance; keys do not change meanwhile. SERVER_RESET reloads their
+ * ROM and SERVER_LOAD loads the ROM file path, read by the server, the i-th
+ * instance being seeded with seed + i for both.
+ */
+struct server_request {
+    uint32_t type;   // SERVER_STEP, SERVER_RESET or SERVER_LOAD
+    uint32_t first;  // first instance
+    uint32_t count;  // number of instances
+    uint32_t frames; // frames to run
+    uint64_t seed;   // seed of the first instance
+    char     path[SERVER_PATH_SIZE]; // ROM file
+};
+
+struct server_response {
+    int32_t  status;  // 0 on success, -1 if the request was rejected
+    uint32_t exited;  // instances of the request whose ROM exited
+    uint32_t errors;  // instances of the request stopped on error
+    uint32_t unused;
+    uint64_t cycles;  // instructions executed for the request
+};
+
+struct server_client;
+
+/*
+ * Connects to the server listening on the Unix socket path and maps its
+ * shared memory, which the server hands over on connection. Returns NULL on
+ * failure (an error message is printed).
+ */
+struct server_client *server_connect(const char *path);
+
+/*
+ * Unmaps the shared memory of c and closes its connection.
+ */
+void server_disconnect(struct server_client *c);
+
+/*
+ * Returns the header of the shared memory of c.
+ */
+const struct server_header *server_header(const struct server_client *c);
+
+/*
+ * Returns the i-th instance of the server of c, NULL if there is none.
+ */
+struct server_slot *server_slot(struct server_client *c, uint32_t i);
+
+/*
+ * Sends req to the server of c and waits for its response, stored to *res.
+ * Returns 0 on success, -1 if the request failed or was rejected (an error
+ * message is printed if it failed).
+ */
+int server_call(struct server_client *c, const struct server_request *req,
+        struct server_response *res);
+
+/*
+ * Runs frames frames on the count instances of c from first, see
+ * server_call.
+ */
+int server_step(struct server_client *c, uint32_t first, uint32_t count,
+        uint32_t frames, struct server_response *res);
+
+#endif
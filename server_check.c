@@ -0,0 +1,257 @@
+#include <libgen.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "server.h"
+
+#define CHECK_LANES    64   // Default number of instances
+#define CHECK_REQUESTS 300  // Default number of step requests
+#define CHECK_FRAMES   10   // Default frames per step request
+#define CONNECT_TRIES  200  // Connections tried while the server starts
+#define CONNECT_DELAY  10   // Delay between two tries, in ms
+#define NAME_SIZE      256  // Maximal length of a ROM name
+#define TIMER_PERIOD   50   // Requests between two writes of the delay timers
+#define TIMER_MAX      60   // Bound of the delay timers written
+
+extern char **environ;
+
+// Returns the current value of the monotonic clock in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sets the keypad keyboard of the instance lane for the request-th request:
+// a single key down, or none, which differs between the instances.
+static void set_keys(uint8_t keyboard[KEYBOARD_SIZE], int lane, int request) {
+    int down = (lane + request / 3) % (KEYBOARD_SIZE + 1);
+    for (int k = 0; k < KEYBOARD_SIZE; k++)
+        keyboard[k] = k == down ? KEY_DOWN : KEY_UP;
+}
+
+// Returns the FNV-1a hash of the state of the instance s, as published by the
+// server: display, registers, timers and status.
+static uint64_t slot_hash(const struct server_slot *s) {
+    uint64_t h = 0xcbf29ce484222325;
+    const struct {
+        const void *data;
+        size_t      size;
+    } parts[] = {
+        {s->vbuf, sizeof(s->vbuf)},
+        {s->registers, sizeof(s->registers)},
+        {&s->I, sizeof(s->I)},
+        {&s->pc, sizeof(s->pc)},
+        {&s->dt, sizeof(s->dt)},
+        {&s->st, sizeof(s->st)},
+        {&s->hires, sizeof(s->hires)},
+        {&s->status, sizeof(s->status)},
+    };
+    for (size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); p++) {
+        const uint8_t *b = parts[p].data;
+        for (size_t i = 0; i < parts[p].size; i++)
+            h = (h ^ b[i]) * 0x100000001b3;
+    }
+    return h;
+}
+
+// Returns the hash of chip, left in the state ps, as slot_hash would hash its
+// slot in the server.
+static uint64_t chip_hash(const struct interpreter *chip,
+        const struct proc_state *ps) {
+    struct server_slot s = {0};
+    memcpy(s.vbuf, chip->vbuf, sizeof(s.vbuf));
+    memcpy(s.registers, chip->registers, sizeof(s.registers));
+    s.I      = chip->I;
+    s.pc     = chip->pc;
+    s.dt     = chip->dt;
+    s.st     = chip->st;
+    s.hires  = chip->hires;
+    s.status = ps->err_code > 0 ? SLOT_ERROR
+        : chip->exited ? SLOT_EXITED : SLOT_RUNNING;
+    return slot_hash(&s);
+}
+
+// Runs frames frames of chip, ipf instructions each followed by a timers
+// update, one instruction at a time, until its ROM exits or ps reports an
+// error. Returns the number of executed instructions.
+static uint64_t run_frames(struct interpreter *chip, struct proc_state *ps,
+        int frames, int ipf) {
+    uint64_t n = 0;
+    for (int f = 0; f < frames; f++) {
+        for (int i = 0; i < ipf; i++, n++) {
+            if (ps->err_code > 0 || chip->exited)
+                return n;
+            run_rom_cycle(chip, ps, 0);
+        }
+        if (ps->err_code > 0 || chip->exited)
+            return n;
+        update_timers(chip);
+    }
+    return n;
+}
+
+// Starts the server executable server on the socket path for count instances
+// of rom and connects to it. Returns the connection, NULL on failure, and
+// stores the process of the server to *pid.
+static struct server_client *start_server(char *server, char *path,
+        char *rom, int count, int ipf, pid_t *pid) {
+    char  n[16], i[16];
+    char *argv[] = {server, "-n", n, "-i", i, "-s", path, rom, NULL};
+    snprintf(n, sizeof(n), "%d", count);
+    snprintf(i, sizeof(i), "%d", ipf);
+    if (posix_spawn(pid, server, NULL, NULL, argv, environ) != 0) {
+        perror(server);
+        return NULL;
+    }
+    // the server listens once its instances are loaded
+    for (int t = 0; t < CONNECT_TRIES; t++) {
+        if (access(path, F_OK) == 0)
+            return server_connect(path);
+        usleep(CONNECT_DELAY * 1000);
+    }
+    dprintf(STDERR_FILENO, "%s: the server did not start\n", path);
+    return NULL;
+}
+
+// Runs count instances of the ROM filename through the server, and locally
+// with run_rom_cycle, for requests requests of frames frames, with keys
+// changing between them and delay timers written now and then. Prints the
+// results as chip8-bench does, the server time including the round trips.
+// Returns 0 if every instance ends with the same published state and the
+// server rejects a ROM path without its '\0', -1 otherwise.
+static int check(char *server, char *filename, int count, int requests,
+        int frames, int ipf) {
+    char path[64];
+    snprintf(path, sizeof(path), "chip8-check-%d.sock", (int)getpid());
+    pid_t                 pid;
+    struct server_client *c = start_server(server, path, filename, count, ipf,
+            &pid);
+    if (c == NULL)
+        return -1;
+
+    struct interpreter *chips  = malloc(count * sizeof(struct interpreter));
+    struct proc_state  *states = calloc(count, sizeof(struct proc_state));
+    int                 ret    = -1;
+    if (chips == NULL || states == NULL) {
+        perror("Could not allocate the instances");
+        goto clean_up;
+    }
+    for (int i = 0; i < count; i++) {
+        init(&chips[i]);
+        seed_rng(&chips[i], i);
+        if (load_rom(filename, &chips[i]) < 0)
+            goto clean_up;
+    }
+
+    // the instances are driven through the shared memory only
+    uint64_t n[2]       = {0, 0};
+    double   seconds[2] = {0, 0};
+    for (int r = 0; r < requests; r++) {
+        double start = now();
+        for (int i = 0; i < count; i++) {
+            set_keys(chips[i].keyboard, i, r);
+            if (r % TIMER_PERIOD == TIMER_PERIOD - 1)
+                chips[i].dt = (i + r) % TIMER_MAX;
+            n[0] += run_frames(&chips[i], &states[i], frames, ipf);
+        }
+        seconds[0] += now() - start;
+
+        struct server_response res;
+        start = now();
+        for (int i = 0; i < count; i++) {
+            set_keys(server_slot(c, i)->keyboard, i, r);
+            if (r % TIMER_PERIOD == TIMER_PERIOD - 1)
+                server_slot(c, i)->dt = (i + r) % TIMER_MAX;
+        }
+        if (server_step(c, 0, count, frames, &res) < 0)
+            goto clean_up;
+        seconds[1] += now() - start;
+        n[1] += res.cycles;
+    }
+
+    char name_buf[NAME_SIZE];
+    snprintf(name_buf, sizeof(name_buf), "%s", filename);
+    const char *name = basename(name_buf);
+    uint64_t    hash[2];
+    for (int e = 0; e <= 1; e++) {
+        // FNV-1a of the state hashes of the instances
+        hash[e] = 0xcbf29ce484222325;
+        for (int i = 0; i < count; i++) {
+            uint64_t h = e == 0 ? chip_hash(&chips[i], &states[i])
+                : slot_hash(server_slot(c, i));
+            for (int b = 0; b < 64; b += 8)
+                hash[e] = (hash[e] ^ (h >> b & 0xff)) * 0x100000001b3;
+        }
+        printf("server\t%s\t%s\t%llu\t%.3f\t%.0f\t%016llx\n", name,
+                e == 0 ? "step" : "server", (unsigned long long)n[e],
+                seconds[e] * 1e9 / n[e], n[e] / seconds[e],
+                (unsigned long long)hash[e]);
+    }
+    if (hash[0] != hash[1]) {
+        dprintf(STDERR_FILENO, "%s: server state differs\n", name);
+        goto clean_up;
+    }
+
+    // a path filling the request is rejected, not read past its end
+    struct server_request  load = {0};
+    struct server_response res;
+    load.type  = SERVER_LOAD;
+    load.count = count;
+    memset(load.path, 'a', sizeof(load.path));
+    if (server_call(c, &load, &res) == 0 || res.status == 0)
+        dprintf(STDERR_FILENO, "%s: unterminated path accepted\n", name);
+    else
+        ret = 0;
+
+clean_up:
+    free(chips);
+    free(states);
+    server_disconnect(c);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    char *server   = "./chip8-server";
+    int   count    = CHECK_LANES;
+    int   requests = CHECK_REQUESTS;
+    int   frames   = CHECK_FRAMES;
+    int   ipf      = DEFAULT_IPF;
+    int   opt;
+    while ((opt = getopt(argc, argv, "S:n:r:f:i:")) != -1) {
+        switch (opt) {
+          case 'S':
+            server = optarg;
+            break;
+          case 'n':
+            count = atoi(optarg);
+            break;
+          case 'r':
+            requests = atoi(optarg);
+            break;
+          case 'f':
+            frames = atoi(optarg);
+            break;
+          case 'i':
+            ipf = atoi(optarg);
+            break;
+          default:
+            return EXIT_FAILURE;
+        }
+    }
+    if (count <= 0 || requests <= 0 || frames <= 0 || ipf <= 0
+            || argc - optind != 1) {
+        dprintf(STDERR_FILENO, "Usage: %s [-S <server>] [-n <instances>] "
+                "[-r <requests>] [-f <frames>] [-i <count>] <rom>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    return check(server, argv[optind], count, requests, frames, ipf) < 0
+        ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+
+struct server_client {
+    int                   fd;   // connection to the server
+    uint8_t              *mem;  // shared memory
+    size_t                size; // size of the shared memory
+    struct server_header *header;
+};
+
+// Receives the shared memory file descriptor sent by the server on fd.
+// Returns it, -1 on failure.
+static int receive_memory(int fd) {
+    char          byte;
+    struct iovec  iov = {&byte, 1};
+    union {
+        struct cmsghdr hdr;
+        char           buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = {0};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    if (recvmsg(fd, &msg, 0) <= 0) {
+        perror("Could not receive the shared memory");
+        return -1;
+    }
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c == NULL || c->cmsg_level != SOL_SOCKET
+            || c->cmsg_type != SCM_RIGHTS) {
+        dprintf(STDERR_FILENO, "No shared memory from the server\n");
+        return -1;
+    }
+    int mem;
+    memcpy(&mem, CMSG_DATA(c), sizeof(int));
+    return mem;
+}
+
+struct server_client *server_connect(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        dprintf(STDERR_FILENO, "%s: socket path too long\n", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    struct server_client *c = calloc(1, sizeof(struct server_client));
+    if (c == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&addr,
+                sizeof(addr)) < 0) {
+        perror(path);
+        goto fail;
+    }
+
+    int         mem = receive_memory(c->fd);
+    struct stat sb;
+    if (mem < 0)
+        goto fail;
+    if (fstat(mem, &sb) < 0 || (size_t)sb.st_size < sizeof(*c->header)) {
+        dprintf(STDERR_FILENO, "Invalid shared memory\n");
+        close(mem);
+        goto fail;
+    }
+    c->size = sb.st_size;
+    c->mem  = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, mem, 0);
+    close(mem);
+    if (c->mem == MAP_FAILED) {
+        perror("mmap()");
+        c->mem = NULL;
+        goto fail;
+    }
+    c->header = (struct server_header *)c->mem;
+    if (memcmp(c->header->magic, SERVER_MAGIC, 4) != 0
+            || c->header->version != SERVER_VERSION
+            || c->header->slot_size < sizeof(struct server_slot)
+            || c->header->size != c->size
+            || c->header->slot_offset + c->header->count
+                * c->header->slot_size > c->size) {
+        dprintf(STDERR_FILENO, "Unsupported server version\n");
+        goto fail;
+    }
+    return c;
+
+fail:
+    server_disconnect(c);
+    return NULL;
+}
+
+void server_disconnect(struct server_client *c) {
+    if (c == NULL)
+        return;
+    if (c->mem != NULL)
+        munmap(c->mem, c->size);
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+}
+
+const struct server_header *server_header(const struct server_client *c) {
+    return c->header;
+}
+
+struct server_slot *server_slot(struct server_client *c, uint32_t i) {
+    if (i >= c->header->count)
+        return NULL;
+    return (struct server_slot *)(c->mem + c->header->slot_offset
+            + i * c->header->slot_size);
+}
+
+int server_call(struct server_client *c, const struct server_request *req,
+        struct server_response *res) {
+    if (send(c->fd, req, sizeof(*req), MSG_NOSIGNAL) != sizeof(*req)) {
+        perror("Could not send the request");
+        return -1;
+    }
+    if (recv(c->fd, res, sizeof(*res), 0) != sizeof(*res)) {
+        dprintf(STDERR_FILENO, "No response from the server\n");
+        return -1;
+    }
+    return res->status;
+}
+
+int server_step(struct server_client *c, uint32_t first, uint32_t count,
+        uint32_t frames, struct server_response *res) {
+    struct server_request req = {0};
+    req.type   = SERVER_STEP;
+    req.first  = first;
+    req.count  = count;
+    req.frames = frames;
+    return server_call(c, &req, res);
+}
@@ -0,0 +1,185 @@
+#include "snapshot.h"
+#include "delta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC   "CH8S"  // First bytes of a snapshot file
+#define SNAPSHOT_VERSION 3       // Format of the snapshot files
+
+struct delta {
+    uint8_t *data; // run-length encoded XOR with the keyframe
+    size_t   size; // bytes of data in use
+    size_t   cap;  // bytes allocated for data
+};
+
+struct rewind {
+    struct snapshot *keys;     // keyframes, one per group of frames
+    struct delta    *deltas;   // frames, the first of a group is unused
+    size_t           nframes;  // capacity in frames
+    size_t           head;     // slot of the next pushed frame
+    size_t           count;    // number of frames held
+    // delta being encoded
+    uint8_t          scratch[DELTA_MAX_SIZE(SNAPSHOT_SIZE)];
+};
+
+struct snapshot_header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t size;
+};
+
+void take_snapshot(const struct interpreter *chip, struct snapshot *s) {
+    if (chip == NULL || s == NULL)
+        return;
+    memcpy(s->data, chip, SNAPSHOT_SIZE);
+}
+
+void restore_snapshot(struct interpreter *chip, const struct snapshot *s) {
+    if (chip == NULL || s == NULL)
+        return;
+    memcpy(chip, s->data, SNAPSHOT_SIZE);
+    flush_dcache(chip);
+}
+
+void fork_interpreter(struct interpreter *dst, const struct interpreter *src) {
+    if (dst == NULL || src == NULL || dst == src)
+        return;
+    memcpy(dst, src, sizeof(struct interpreter));
+    // the trace and the profile stay with src, they are not thread-safe
+    dst->trace = NULL;
+#ifdef CHIP8_PROFILE
+    dst->prof = NULL;
+#endif
+}
+
+int save_snapshot(const char *filename, const struct snapshot *s) {
+    if (filename == NULL || s == NULL)
+        return -1;
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        perror("Could not open snapshot");
+        return -1;
+    }
+    struct snapshot_header h;
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.size    = SNAPSHOT_SIZE;
+    if (fwrite(&h, sizeof(h), 1, f) != 1
+            || fwrite(s->data, SNAPSHOT_SIZE, 1, f) != 1) {
+        perror("Could not write snapshot");
+        fclose(f);
+        return -1;
+    }
+    if (fclose(f) == EOF) {
+        perror("Could not write snapshot");
+        return -1;
+    }
+    return 0;
+}
+
+int load_snapshot(const char *filename, struct snapshot *s) {
+    if (filename == NULL || s == NULL)
+        return -1;
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        perror("Could not open snapshot");
+        return -1;
+    }
+    struct snapshot_header h;
+    int ok = fread(&h, sizeof(h), 1, f) == 1
+        && memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) == 0
+        && h.version == SNAPSHOT_VERSION && h.size == SNAPSHOT_SIZE
+        && fread(s->data, SNAPSHOT_SIZE, 1, f) == 1;
+    fclose(f);
+    if (!ok) {
+        dprintf(STDERR_FILENO, "%s: not a snapshot of this interpreter\n",
+                filename);
+        return -1;
+    }
+    return 0;
+}
+
+struct rewind *rewind_create(size_t frames) {
+    if (frames == 0)
+        return NULL;
+    size_t         groups = (frames + KEYFRAME_INTERVAL - 1) / KEYFRAME_INTERVAL;
+    struct rewind *r      = malloc(sizeof(struct rewind));
+    if (r == NULL)
+        return NULL;
+    r->nframes = groups * KEYFRAME_INTERVAL;
+    r->head    = 0;
+    r->count   = 0;
+    r->keys    = malloc(groups * sizeof(struct snapshot));
+    r->deltas  = calloc(r->nframes, sizeof(struct delta));
+    if (r->keys == NULL || r->deltas == NULL) {
+        rewind_destroy(r);
+        return NULL;
+    }
+    return r;
+}
+
+void rewind_destroy(struct rewind *r) {
+    if (r == NULL)
+        return;
+    if (r->deltas != NULL) {
+        for (size_t i = 0; i < r->nframes; i++)
+            free(r->deltas[i].data);
+    }
+    free(r->deltas);
+    free(r->keys);
+    free(r);
+}
+
+int rewind_push(struct rewind *r, const struct interpreter *chip) {
+    if (r == NULL || chip == NULL)
+        return -1;
+    size_t group  = r->head / KEYFRAME_INTERVAL;
+    size_t offset = r->head % KEYFRAME_INTERVAL;
+    if (offset == 0) {
+        take_snapshot(chip, &r->keys[group]);
+    } else {
+        struct delta *d    = &r->deltas[r->head];
+        size_t        size = delta_encode(r->keys[group].data,
+                (const uint8_t *)chip, SNAPSHOT_SIZE, r->scratch);
+        if (size > d->cap) {
+            uint8_t *data = realloc(d->data, size);
+            if (data == NULL)
+                return -1;
+            d->data = data;
+            d->cap  = size;
+        }
+        memcpy(d->data, r->scratch, size);
+        d->size = size;
+    }
+
+    // a new keyframe drops the frames encoded against the one it replaces
+    r->head  = (r->head + 1) % r->nframes;
+    r->count++;
+    if (r->count > r->nframes - (KEYFRAME_INTERVAL - 1 - offset))
+        r->count = r->nframes - (KEYFRAME_INTERVAL - 1 - offset);
+    return 0;
+}
+
+int rewind_pop(struct rewind *r, struct interpreter *chip) {
+    if (r == NULL || chip == NULL || r->count == 0)
+        return -1;
+    r->head = (r->head + r->nframes - 1) % r->nframes;
+    r->count--;
+    size_t group  = r->head / KEYFRAME_INTERVAL;
+    size_t offset = r->head % KEYFRAME_INTERVAL;
+    if (offset == 0) {
+        restore_snapshot(chip, &r->keys[group]);
+    } else {
+        const struct delta *d = &r->deltas[r->head];
+        delta_decode(r->keys[group].data, d->data, d->size, (uint8_t *)chip,
+                SNAPSHOT_SIZE);
+        flush_dcache(chip);
+    }
+    return 0;
+}
+
+size_t rewind_count(const struct rewind *r) {
+    return r != NULL ? r->count : 0;
+}
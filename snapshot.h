@@ -0,0 +1,77 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "interpreter.h"
+
+// The machine state is everything in struct interpreter up to the predecoded
+// instructions, which are rebuilt from RAM on restore
+#define SNAPSHOT_SIZE      offsetof(struct interpreter, dcache)
+#define KEYFRAME_INTERVAL  30 // Frames between two full copies in a rewind
+
+struct snapshot {
+    uint8_t data[SNAPSHOT_SIZE]; // RAM, registers, stack, timers, framebuffer,
+                                 // keypad, Fx0A wait flags, faults, strict
+                                 // mode and RNG state
+};
+
+struct rewind;
+
+/*
+ * Copies the machine state of chip to s.
+ */
+void take_snapshot(const struct interpreter *chip, struct snapshot *s);
+
+/*
+ * Sets the machine state of chip to s and invalidates its predecoded
+ * instructions. A JIT running chip must also be flushed with jit_flush.
+ */
+void restore_snapshot(struct interpreter *chip, const struct snapshot *s);
+
+/*
+ * Makes dst an independent copy of the running instance src, predecoded
+ * instructions included, so that both can go on from the same state. The
+ * trace and profile of src are not shared: dst has none, the caller may
+ * attach its own.
+ */
+void fork_interpreter(struct interpreter *dst, const struct interpreter *src);
+
+/*
+ * Writes s to the file filename, or reads it back. Snapshot files are only
+ * portable between builds of the same interpreter. Return 0 on success, -1
+ * otherwise (an error message is printed).
+ */
+int save_snapshot(const char *filename, const struct snapshot *s);
+int load_snapshot(const char *filename, struct snapshot *s);
+
+/*
+ * Creates a rewind buffer keeping the last frames states pushed to it. Every
+ * KEYFRAME_INTERVAL states, a full copy is kept, the others are stored as
+ * run-length encoded differences with the previous full copy. Returns NULL if
+ * the memory could not be allocated.
+ */
+struct rewind *rewind_create(size_t frames);
+
+/*
+ * Releases r and the states it holds.
+ */
+void rewind_destroy(struct rewind *r);
+
+/*
+ * Pushes the machine state of chip to r, dropping the oldest states if r is
+ * full. Returns 0 on success, -1 otherwise.
+ */
+int rewind_push(struct rewind *r, const struct interpreter *chip);
+
+/*
+ * Restores chip to the last state pushed to r and drops it from r, as
+ * restore_snapshot does. Returns 0 on success, -1 if r is empty.
+ */
+int rewind_pop(struct rewind *r, struct interpreter *chip);
+
+/*
+ * Returns the number of states held by r.
+ */
+size_t rewind_count(const struct rewind *r);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SPSC_H
+#define SPSC_H
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SPSC_SIZE  256 // Capacity of a queue, a power of two
+#ifndef CACHE_LINE
+#define CACHE_LINE 64  // Size in bytes of a cache line
+#endif
+
+/*
+ * Sound on/off event, timestamped by the emulated time in audio samples.
+ */
+struct sound_event {
+    uint64_t time; // emulated sample the event applies at
+    uint8_t  on;   // 1 if the tone starts, 0 if it stops
+};
+
+/*
+ * Keypad edge, timestamped by the host time at which it happened.
+ */
+struct key_event {
+    uint64_t time;  // host time of the edge in ns, see SDL_GetTicksNS
+    uint64_t cycle; // instructions executed when the edge was applied, once
+                    // it was
+    uint8_t  key;   // CHIP-8 key, from 0x0 to 0xF
+    uint8_t  down;  // 1 if the key is pressed, 0 if it is released
+};
+
+/*
+ * Defines struct queue, a lock-free queue of SPSC_SIZE values of type type
+ * between one producer thread and one consumer thread, and its functions
+ * prefix_init, prefix_push, prefix_peek and prefix_pop. The producer only
+ * writes head and the consumer only writes tail, each on a cache line of its
+ * own, so that neither ever waits for the other.
+ *
+ * prefix_init empties the queue, and must not be called while it is in use.
+ * prefix_push appends a value, from the producer thread, and returns 1 on
+ * success, 0 if the queue is full. prefix_peek copies the oldest value without
+ * removing it, from the consumer thread, and returns 1 on success, 0 if the
+ * queue is empty. prefix_pop removes the oldest value, which must exist, from
+ * the consumer thread.
+ */
+#define SPSC_DEFINE(queue, prefix, type)                                     \
+struct queue {                                                               \
+    alignas(CACHE_LINE) _Atomic uint32_t head; /* next slot to write */      \
+    alignas(CACHE_LINE) _Atomic uint32_t tail; /* next slot to read */       \
+    type events[SPSC_SIZE];                                                  \
+};                                                                           \
+                                                                             \
+static inline void prefix##_init(struct queue *q) {                          \
+    atomic_init(&q->head, 0);                                                \
+    atomic_init(&q->tail, 0);                                                \
+}                                                                            \
+                                                                             \
+static inline int prefix##_push(struct queue *q, type e) {                   \
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);    \
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);    \
+    if (head - tail == SPSC_SIZE)                                            \
+        return 0;                                                            \
+    q->events[head & (SPSC_SIZE - 1)] = e;                                   \
+    /* the event is visible before the new head */                           \
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);         \
+    return 1;                                                                \
+}                                                                            \
+                                                                             \
+static inline int prefix##_peek(struct queue *q, type *e) {                  \
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);    \
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_acquire);    \
+    if (head == tail)                                                        \
+        return 0;                                                            \
+    *e = q->events[tail & (SPSC_SIZE - 1)];                                  \
+    return 1;                                                                \
+}                                                                            \
+                                                                             \
+static inline void prefix##_pop(struct queue *q) {                           \
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);    \
+    /* the slot is read before the producer may reuse it */                  \
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);         \
+}
+
+// Queue of sound events, from the emulation thread to the audio thread
+SPSC_DEFINE(spsc_queue, spsc, struct sound_event)
+
+// Queue of keypad edges, between the SDL thread and the emulation thread
+SPSC_DEFINE(key_queue, key_queue, struct key_event)
+
+#endif
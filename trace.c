@@ -0,0 +1,149 @@
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct trace {
+    struct trace_record *records;  // ring buffer
+    size_t               capacity; // records of the buffer
+    size_t               next;     // slot of the next record
+    size_t               count;    // records held
+    FILE                *stream;   // output of a full trace, or NULL
+};
+
+struct trace *trace_create(size_t capacity, FILE *stream) {
+    if (capacity == 0)
+        return NULL;
+    struct trace *t = malloc(sizeof(struct trace));
+    if (t == NULL)
+        return NULL;
+    t->records = malloc(capacity * sizeof(struct trace_record));
+    if (t->records == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->capacity = capacity;
+    t->next     = 0;
+    t->count    = 0;
+    t->stream   = stream;
+    return t;
+}
+
+void trace_destroy(struct trace *t) {
+    if (t == NULL)
+        return;
+    free(t->records);
+    free(t);
+}
+
+// Writes the records held by t to out, oldest first. Returns 0 on success, -1
+// otherwise.
+static int write_records(const struct trace *t, FILE *out) {
+    size_t first = (t->next + t->capacity - t->count) % t->capacity;
+    size_t head  = t->count < t->capacity - first ? t->count
+        : t->capacity - first;
+    if (fwrite(t->records + first, sizeof(struct trace_record), head, out)
+            != head)
+        return -1;
+    if (fwrite(t->records, sizeof(struct trace_record), t->count - head, out)
+            != t->count - head)
+        return -1;
+    return 0;
+}
+
+// Returns the next record of t to fill.
+static struct trace_record *next_record(struct trace *t) {
+    return &t->records[t->next];
+}
+
+// Adds the record filled by next_record to t.
+static void push_record(struct trace *t) {
+    t->next = (t->next + 1) % t->capacity;
+    if (t->count < t->capacity)
+        t->count++;
+
+    // a full buffer is sent in one write when streaming
+    if (t->stream != NULL && t->count == t->capacity) {
+        if (write_records(t, t->stream) < 0)
+            perror("Could not write trace");
+        t->next  = 0;
+        t->count = 0;
+    }
+}
+
+void trace_add(struct trace *t, const struct interpreter *chip,
+        const struct decoded_instr *d, uint16_t pc, const uint8_t *before) {
+    if (t == NULL)
+        return;
+    struct trace_record *r = next_record(t);
+    uint16_t             changed = 0;
+    for (int i = 0; i < REGISTERS_SIZE; i++) {
+        if (chip->registers[i] != before[i])
+            changed |= 1 << i;
+    }
+    r->pc      = pc;
+    r->instr   = d->instr;
+    r->I       = chip->I;
+    r->changed = changed;
+    r->vx      = chip->registers[d->x];
+    r->vf      = chip->registers[VF];
+    r->dt      = chip->dt;
+    r->st      = chip->st;
+    push_record(t);
+
+    // the other changed registers follow, only Fx65 changes them
+    changed &= ~(1 << d->x | 1 << VF);
+    int n = 0;
+    for (int i = 0; changed != 0; i++, changed >>= 1) {
+        if (!(changed & 1))
+            continue;
+        if (n == 0) {
+            r     = next_record(t);
+            r->pc = TRACE_EXTRA;
+            memset(r->v, 0, sizeof(r->v));
+        }
+        r->v[n++] = chip->registers[i];
+        if (n == TRACE_EXTRA_REGS || changed == 1) {
+            push_record(t);
+            n = 0;
+        }
+    }
+}
+
+int trace_write_header(FILE *out) {
+    struct trace_header h;
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.version     = TRACE_VERSION;
+    h.record_size = sizeof(struct trace_record);
+    return fwrite(&h, sizeof(h), 1, out) == 1 ? 0 : -1;
+}
+
+int trace_write(struct trace *t, const char *filename) {
+    if (t == NULL)
+        return -1;
+    if (t->stream != NULL) {
+        int ret = write_records(t, t->stream);
+        t->next  = 0;
+        t->count = 0;
+        if (ret < 0 || fflush(t->stream) == EOF) {
+            perror("Could not write trace");
+            return -1;
+        }
+        return 0;
+    }
+
+    FILE *out = fopen(filename, "wb");
+    if (out == NULL) {
+        perror("Could not open trace");
+        return -1;
+    }
+    if (trace_write_header(out) < 0 || write_records(t, out) < 0) {
+        perror("Could not write trace");
+        fclose(out);
+        return -1;
+    }
+    if (fclose(out) == EOF) {
+        perror("Could not write trace");
+        return -1;
+    }
+    return 0;
+}
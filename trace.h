@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "interpreter.h"
+
+#define TRACE_MAGIC       "CH8T" // First bytes of a trace file
+#define TRACE_VERSION     2      // Format of the trace files
+#define DEFAULT_TRACE_LEN (1 << 20) // Default number of records kept
+#define TRACE_EXTRA       0xffff // PC of a record extending the previous one
+#define TRACE_EXTRA_REGS  10     // Register values held by an extra record
+
+/*
+ * Trace of one executed instruction, as stored in trace files (in the byte
+ * order of the host). An instruction changing registers other than Vx and VF
+ * (Fx65) is followed by extra records, whose pc is TRACE_EXTRA, holding the
+ * values of these registers in increasing order.
+ */
+struct trace_record {
+    uint16_t pc;          // address of the instruction, or TRACE_EXTRA
+    union {
+        struct {
+            uint16_t instr;   // instruction
+            uint16_t I;       // I after the instruction
+            uint16_t changed; // bit i is set if Vi was changed
+            uint8_t  vx;      // Vx after the instruction
+            uint8_t  vf;      // VF after the instruction
+            uint8_t  dt;      // delay timer
+            uint8_t  st;      // sound timer
+        };
+        uint8_t v[TRACE_EXTRA_REGS]; // extra record: changed registers
+    };
+};
+
+struct trace_header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct trace;
+
+/*
+ * Creates a trace keeping the last capacity executed instructions in memory.
+ * If stream is not NULL, the trace is written to it in bulk every time the
+ * buffer is full instead, so that stream receives the whole run. Returns NULL
+ * if the memory could not be allocated.
+ */
+struct trace *trace_create(size_t capacity, FILE *stream);
+
+/*
+ * Releases t, without writing it.
+ */
+void trace_destroy(struct trace *t);
+
+/*
+ * Records the execution of d at pc by chip, before holding the registers of
+ * chip as they were before the execution. The registers changed other than
+ * Vx and VF are recorded to extra records.
+ */
+void trace_add(struct trace *t, const struct interpreter *chip,
+        const struct decoded_instr *d, uint16_t pc, const uint8_t *before);
+
+/*
+ * Writes the records held by t, oldest first: to its stream if it has one,
+ * else to the file filename, preceded by a header. Returns 0 on success, -1
+ * otherwise (an error message is printed).
+ */
+int trace_write(struct trace *t, const char *filename);
+
+/*
+ * Writes the header of a trace file to out. Returns 0 on success, -1
+ * otherwise.
+ */
+int trace_write_header(FILE *out);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "interpreter.h"
+#include "trace.h"
+
+#define CHUNK_RECORDS 4096 // Records read at once
+
+// Prints the record r, the index-th instruction of the trace, as a line of
+// text: address, instruction, mnemonic, I, timers and changed registers, the
+// nextra values of the extra records following r being in extra. The value of
+// a changed register whose extra record is missing is printed as "??".
+static void print_record(unsigned long long index,
+        const struct trace_record *r, const uint8_t *extra, int nextra) {
+    struct decoded_instr d;
+    decode_instr(r->instr, &d);
+    printf("%10llu %03x %04x %-8s I=%03x DT=%02x ST=%02x", index, r->pc,
+            r->instr, op_name(d.op), r->I, r->dt, r->st);
+    int e = 0;
+    for (int i = 0; i < REGISTERS_SIZE; i++) {
+        if (!(r->changed & 1 << i))
+            continue;
+        if (i == VF)
+            printf(" VF=%02x", r->vf);
+        else if (i == d.x)
+            printf(" V%X=%02x", i, r->vx);
+        else if (e < nextra)
+            printf(" V%X=%02x", i, extra[e++]);
+        else
+            printf(" V%X=??", i);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        dprintf(STDERR_FILENO, "Usage: %s <trace file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror("Could not open trace");
+        return EXIT_FAILURE;
+    }
+    struct trace_header h;
+    if (fread(&h, sizeof(h), 1, in) != 1
+            || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0
+            || h.version != TRACE_VERSION
+            || h.record_size != sizeof(struct trace_record)) {
+        dprintf(STDERR_FILENO, "%s: not a trace of this interpreter\n",
+                argv[1]);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    // a record is printed once its extra records are read, extra records
+    // whose instruction was dropped from the ring buffer are skipped
+    static struct trace_record records[CHUNK_RECORDS];
+    struct trace_record        last;
+    uint8_t                    extra[REGISTERS_SIZE];
+    int                        nextra = 0;
+    int                        pending = 0;
+    unsigned long long         index = 0;
+    size_t                     n;
+    while ((n = fread(records, sizeof(records[0]), CHUNK_RECORDS, in)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            const struct trace_record *r = &records[i];
+            if (r->pc == TRACE_EXTRA) {
+                for (int j = 0; j < TRACE_EXTRA_REGS
+                        && nextra < REGISTERS_SIZE; j++)
+                    extra[nextra++] = r->v[j];
+                continue;
+            }
+            if (pending)
+                print_record(index++, &last, extra, nextra);
+            last    = *r;
+            nextra  = 0;
+            pending = 1;
+        }
+    }
+    if (pending)
+        print_record(index, &last, extra, nextra);
+    fclose(in);
+    return EXIT_SUCCESS;
+}
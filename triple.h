@@ -0,0 +1,85 @@
+#ifndef TRIPLE_H
+#define TRIPLE_H
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "interpreter.h"
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64  // Size in bytes of a cache line
+#endif
+#define TB_FRESH   4   // Flag of the middle slot: published, not yet taken
+
+/*
+ * Completed frame, as published by the emulation thread.
+ */
+struct tb_frame {
+    uint64_t vbuf[HIRES_HEIGHT][VBUF_WORDS]; // display rows, see vbuf_to_rows
+    uint64_t cycle;                          // instructions executed before
+                                             // the frame
+};
+
+/*
+ * Lock-free triple buffer of frames between one writer thread and one reader
+ * thread. The writer fills the back slot and swaps it with the middle one, the
+ * reader swaps the middle slot with the front one when it holds a newer frame.
+ * Neither ever waits: the writer overwrites a frame the reader skipped, and
+ * the reader keeps the frame it has until a newer one comes.
+ */
+struct triple_buffer {
+    struct tb_frame             frames[3];
+    alignas(CACHE_LINE) _Atomic uint32_t middle; // middle slot | TB_FRESH
+    alignas(CACHE_LINE) uint32_t         back;   // slot of the writer
+    alignas(CACHE_LINE) uint32_t         front;  // slot of the reader
+};
+
+/*
+ * Empties tb, its front frame is blank. Must not be called while tb is in
+ * use.
+ */
+static inline void tb_init(struct triple_buffer *tb) {
+    for (int i = 0; i < 3; i++)
+        tb->frames[i] = (struct tb_frame){{{0}}, 0};
+    tb->back  = 0;
+    tb->front = 2;
+    atomic_init(&tb->middle, 1);
+}
+
+/*
+ * Returns the frame the writer fills before publishing it.
+ */
+static inline struct tb_frame *tb_back(struct triple_buffer *tb) {
+    return &tb->frames[tb->back];
+}
+
+/*
+ * Publishes the back frame of tb, from the writer thread.
+ */
+static inline void tb_publish(struct triple_buffer *tb) {
+    // the frame is visible before the slot is handed over
+    uint32_t prev = atomic_exchange_explicit(&tb->middle,
+            tb->back | TB_FRESH, memory_order_acq_rel);
+    tb->back = prev & ~TB_FRESH;
+}
+
+/*
+ * Takes the latest published frame of tb, from the reader thread. Returns 1
+ * if the front frame was replaced by a newer one, 0 otherwise.
+ */
+static inline int tb_take(struct triple_buffer *tb) {
+    if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TB_FRESH))
+        return 0;
+    uint32_t prev = atomic_exchange_explicit(&tb->middle, tb->front,
+            memory_order_acq_rel);
+    tb->front = prev & ~TB_FRESH;
+    return 1;
+}
+
+/*
+ * Returns the frame the reader presents.
+ */
+static inline const struct tb_frame *tb_front(const struct triple_buffer *tb) {
+    return &tb->frames[tb->front];
+}
+
+#endif